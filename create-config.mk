@@ -142,6 +142,12 @@ ifneq ($(call check_compile,memfd_create,$(HASH)include <sys/mman.h>\nvoid *c =
 	MEMFD_SUPPORT := 1
 endif
 
+ifneq ($(ENABLE_USDT),0)
+ifneq ($(call check_compile,sys/sdt.h,$(HASH)include <sys/sdt.h>\nvoid f(int a) { STAP_PROBE1(test, test, a); }),0)
+	DEFINES += HAVE_SYS_SDT_H
+endif
+endif
+
 ENABLE_LIBDMMP := $(call check_cmd,$(PKG_CONFIG) --exists json-c)
 
 ifeq ($(ENABLE_DMEVENTS_POLL),0)
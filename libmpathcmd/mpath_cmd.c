@@ -215,6 +215,109 @@ int mpath_send_cmd(int fd, const char *cmd)
 	return 0;
 }
 
+int mpath_send_cmd_chunked(int fd, const char *cmd)
+{
+	static const char flag = MPATH_CMD_CHUNKED;
+	size_t len;
+
+	if (cmd == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	len = strlen(cmd) + 2;
+	if (write_all(fd, &len, sizeof(len)) != sizeof(len))
+		return -1;
+	if (write_all(fd, cmd, len - 1) != len - 1 ||
+	    write_all(fd, &flag, 1) != 1)
+		return -1;
+	return 0;
+}
+
+static int recv_chunk_len(int fd, size_t *len, unsigned int timeout)
+{
+	ssize_t ret;
+
+	ret = read_all(fd, len, sizeof(*len), timeout);
+	if (ret < 0)
+		return -1;
+	if (ret != sizeof(*len)) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+static int recv_reply_chunks(int fd, mpath_reply_fn fn, void *arg,
+			     unsigned int timeout)
+{
+	char *buf = NULL, *tmp;
+	size_t len, size = 0;
+	ssize_t ret;
+	int rc = -1;
+
+	for (;;) {
+		if (recv_chunk_len(fd, &len, timeout) != 0)
+			break;
+		if (len == 0) {
+			rc = 0;
+			break;
+		}
+		if (len >= MAX_REPLY_LEN) {
+			errno = ERANGE;
+			break;
+		}
+		if (len + 1 > size) {
+			tmp = realloc(buf, len + 1);
+			if (!tmp)
+				break;
+			buf = tmp;
+			size = len + 1;
+		}
+		ret = read_all(fd, buf, len, timeout);
+		if (ret < 0)
+			break;
+		if ((size_t)ret != len) {
+			errno = EIO;
+			break;
+		}
+		buf[len] = '\0';
+		ret = fn(buf, len, arg);
+		if (ret != 0) {
+			rc = ret;
+			break;
+		}
+	}
+	free(buf);
+	return rc;
+}
+
+int mpath_recv_reply_chunked(int fd, mpath_reply_fn fn, void *arg,
+			     unsigned int timeout)
+{
+	char *buf;
+	size_t len;
+	int rc = -1;
+
+	if (recv_chunk_len(fd, &len, timeout) != 0)
+		return -1;
+
+	if (len == MPATH_REPLY_CHUNKED)
+		return recv_reply_chunks(fd, fn, arg, timeout);
+
+	/* reply in one piece */
+	if (len == 0 || len >= MAX_REPLY_LEN) {
+		errno = ERANGE;
+		return -1;
+	}
+	buf = malloc(len);
+	if (!buf)
+		return -1;
+	if (mpath_recv_reply_data(fd, buf, len, timeout) == 0)
+		rc = fn(buf, strnlen(buf, len), arg);
+	free(buf);
+	return rc;
+}
+
 int mpath_process_cmd(int fd, const char *cmd, char **reply,
 		      unsigned int timeout)
 {
@@ -20,6 +20,20 @@ extern "C" {
 
 #define DEFAULT_REPLY_TIMEOUT	4000
 
+/*
+ * Chunked replies
+ *
+ * A command sent with mpath_send_cmd_chunked() carries the byte
+ * MPATH_CMD_CHUNKED after its terminating 0 byte. multipathd may then
+ * send MPATH_REPLY_CHUNKED instead of the reply length, followed by a
+ * sequence of chunks. Each chunk is prefixed by its length, and isn't
+ * 0-terminated. A chunk of length 0 terminates the reply.
+ * Older versions of multipathd ignore MPATH_CMD_CHUNKED, and always
+ * send the reply in one piece.
+ */
+#define MPATH_CMD_CHUNKED	'c'
+#define MPATH_REPLY_CHUNKED	((size_t)-1)
+
 
 /*
  * DESCRIPTION:
@@ -125,6 +139,47 @@ ssize_t mpath_recv_reply_len(int fd, unsigned int timeout);
 int mpath_recv_reply_data(int fd, char *reply, size_t len,
 			  unsigned int timeout);
 
+
+/*
+ * DESCRIPTION:
+ *	Send a command to multipathd, indicating that the caller accepts
+ *	a chunked reply. The reply must be read with
+ *	mpath_recv_reply_chunked().
+ *
+ * RETURNS:
+ *	0 on success. -1 on failure (with errno set)
+ */
+int mpath_send_cmd_chunked(int fd, const char *cmd);
+
+
+/*
+ * DESCRIPTION:
+ *	Callback for mpath_recv_reply_chunked(). data is 0-terminated,
+ *	len doesn't include the terminating 0. data is only valid until
+ *	the callback returns.
+ *
+ * RETURNS:
+ *	0 to continue receiving, any other value to stop.
+ */
+typedef int (*mpath_reply_fn)(const char *data, size_t len, void *arg);
+
+
+/*
+ * DESCRIPTION:
+ *	Receive the reply to a command sent with mpath_send_cmd_chunked(),
+ *	and pass it to fn piece by piece. If multipathd sent the reply in
+ *	one piece, fn is called once. This way, the memory needed for
+ *	receiving large replies is bounded by the chunk size. timeout
+ *	applies to every single chunk.
+ *
+ * RETURNS:
+ *	0 on success. -1 on failure (with errno set). If fn returns
+ *	non-zero, receiving stops, and its return value is returned. In
+ *	the latter two cases, the connection must not be used any more.
+ */
+int mpath_recv_reply_chunked(int fd, mpath_reply_fn fn, void *arg,
+			     unsigned int timeout);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdint.h>
+#include "histogram.h"
+
+#define SUB_BUCKETS (1U << LAT_HIST_SUB_BITS)
+
+static unsigned int bucket_index(unsigned int us)
+{
+	unsigned int v = us >> LAT_HIST_UNIT_SHIFT;
+	unsigned int msb, idx;
+
+	if (v < SUB_BUCKETS)
+		return v;
+	msb = 31 - __builtin_clz(v);
+	idx = ((msb - LAT_HIST_SUB_BITS + 1) << LAT_HIST_SUB_BITS) +
+		((v >> (msb - LAT_HIST_SUB_BITS)) & (SUB_BUCKETS - 1));
+	return idx < LAT_HIST_BUCKETS ? idx : LAT_HIST_BUCKETS - 1;
+}
+
+/* Exclusive upper bound of a bucket, in microseconds */
+static unsigned long long bucket_limit(unsigned int idx)
+{
+	unsigned int shift, sub;
+
+	if (idx < SUB_BUCKETS)
+		return (unsigned long long)(idx + 1) << LAT_HIST_UNIT_SHIFT;
+	shift = (idx >> LAT_HIST_SUB_BITS) - 1;
+	sub = idx & (SUB_BUCKETS - 1);
+	return (unsigned long long)(SUB_BUCKETS + sub + 1) <<
+		(shift + LAT_HIST_UNIT_SHIFT);
+}
+
+void lat_hist_add(struct lat_hist *h, unsigned int us)
+{
+	unsigned int idx = bucket_index(us);
+	unsigned int i;
+
+	if (h->bucket[idx] == UINT16_MAX)
+		for (i = 0; i < LAT_HIST_BUCKETS; i++)
+			h->bucket[i] >>= 1;
+	h->bucket[idx]++;
+	h->last_us = us;
+	if (us > h->max_us)
+		h->max_us = us;
+}
+
+unsigned int lat_hist_count(const struct lat_hist *h)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; i++)
+		n += h->bucket[i];
+	return n;
+}
+
+unsigned int lat_hist_percentile(const struct lat_hist *h, unsigned int pct)
+{
+	unsigned int i, rank, n = lat_hist_count(h), sum = 0;
+
+	if (n == 0)
+		return 0;
+	if (pct > 100)
+		pct = 100;
+	rank = (n * pct + 99) / 100;
+	if (rank == 0)
+		rank = 1;
+	for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+		sum += h->bucket[i];
+		if (sum >= rank)
+			break;
+	}
+	if (i == LAT_HIST_BUCKETS || bucket_limit(i) > h->max_us)
+		return h->max_us;
+	return bucket_limit(i);
+}
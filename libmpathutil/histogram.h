@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef HISTOGRAM_H_INCLUDED
+#define HISTOGRAM_H_INCLUDED
+#include <stdint.h>
+
+/*
+ * Compact log-linear latency histogram. Every power of two is split
+ * into 1 << LAT_HIST_SUB_BITS buckets, so that percentiles are reported
+ * with at most 25% error. The resolution is 16us, values of 67s and
+ * more end up in the last bucket. The counters are 16 bit; if one of
+ * them would overflow, all of them are halved, which gives more recent
+ * values a higher weight.
+ */
+#define LAT_HIST_SUB_BITS 2
+#define LAT_HIST_UNIT_SHIFT 4
+#define LAT_HIST_BUCKETS 84
+
+struct lat_hist {
+	uint16_t bucket[LAT_HIST_BUCKETS];
+	uint32_t max_us;
+	uint32_t last_us;
+};
+
+/**
+ * lat_hist_add(): record a value
+ * @param h: the histogram
+ * @param us: the value in microseconds
+ */
+void lat_hist_add(struct lat_hist *h, unsigned int us);
+
+/**
+ * lat_hist_count(): number of recorded values
+ * @param h: the histogram
+ * @returns: number of values, after halving if counters overflowed
+ */
+unsigned int lat_hist_count(const struct lat_hist *h);
+
+/**
+ * lat_hist_percentile(): estimate a percentile
+ * @param h: the histogram
+ * @param pct: percentile, 0 - 100
+ * @returns: the upper bound of the bucket containing the percentile,
+ * in microseconds, but at most the largest value recorded. 0 if the
+ * histogram is empty.
+ */
+unsigned int lat_hist_percentile(const struct lat_hist *h, unsigned int pct);
+
+#endif
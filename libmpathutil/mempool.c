@@ -0,0 +1,252 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <stddef.h>
+#include "mempool.h"
+#include "time-util.h"
+#include "strbuf.h"
+#include "debug.h"
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mempool *registry;
+
+static void lock_pool(struct mempool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+}
+
+static void unlock_pool(struct mempool *pool)
+{
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static time_t now_secs(void)
+{
+	struct timespec now;
+
+	get_monotonic_time(&now);
+	return now.tv_sec;
+}
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+/*
+ * The slots follow the slab header. Every object is preceded by a pointer
+ * to its slab, padded to keep the object aligned as its type requires.
+ */
+struct slab {
+	struct list_head node;
+	void *free_list;
+	unsigned int n_free;
+};
+
+static struct slab *obj_to_slab(void *obj)
+{
+	return ((struct slab **)obj)[-1];
+}
+
+/* Pools are set up on first use, so that they can be statically defined */
+static void init_pool(struct mempool *pool)
+{
+	size_t obj_size = pool->size < sizeof(void *) ?
+		sizeof(void *) : pool->size;
+
+	if (pool->align < __alignof__(max_align_t))
+		pool->align = __alignof__(max_align_t);
+	pool->slot_hdr = ALIGN_UP(sizeof(struct slab *), pool->align);
+	pool->slot_size = pool->slot_hdr + ALIGN_UP(obj_size, pool->align);
+	pool->slab_objs = (MEMPOOL_SLAB_SIZE -
+			   ALIGN_UP(sizeof(struct slab), pool->align)) /
+		pool->slot_size;
+	if (pool->slab_objs < MEMPOOL_MIN_SLAB_OBJS)
+		pool->slab_objs = MEMPOOL_MIN_SLAB_OBJS;
+	INIT_LIST_HEAD(&pool->partial);
+	INIT_LIST_HEAD(&pool->full);
+	pool->registered = true;
+}
+
+static void register_pool(struct mempool *pool)
+{
+	pthread_mutex_lock(&registry_lock);
+	pool->next = registry;
+	registry = pool;
+	pthread_mutex_unlock(&registry_lock);
+}
+
+static struct slab *alloc_slab(const struct mempool *pool)
+{
+	struct slab *slab;
+	void *mem;
+	char *slots;
+	unsigned int i;
+
+	if (posix_memalign(&mem, pool->align,
+			   ALIGN_UP(sizeof(*slab), pool->align) +
+			   pool->slab_objs * pool->slot_size) != 0)
+		return NULL;
+	slab = mem;
+	slab->free_list = NULL;
+	slab->n_free = pool->slab_objs;
+	slots = (char *)slab + ALIGN_UP(sizeof(*slab), pool->align);
+	/* Link the objects backwards, so that they're handed out in order */
+	for (i = pool->slab_objs; i > 0; i--) {
+		char *obj = slots + (i - 1) * pool->slot_size + pool->slot_hdr;
+
+		((struct slab **)obj)[-1] = slab;
+		*(void **)obj = slab->free_list;
+		slab->free_list = obj;
+	}
+	return slab;
+}
+
+void *mempool_alloc(struct mempool *pool)
+{
+	struct slab *slab, *new_slab = NULL;
+	void *obj;
+	bool first = false;
+
+	lock_pool(pool);
+	if (!pool->registered) {
+		init_pool(pool);
+		first = true;
+	}
+	if (list_empty(&pool->partial)) {
+		unlock_pool(pool);
+		if (first)
+			register_pool(pool);
+		first = false;
+		new_slab = alloc_slab(pool);
+		if (!new_slab)
+			return NULL;
+		lock_pool(pool);
+		list_add(&new_slab->node, &pool->partial);
+		pool->stats.slabs++;
+		pool->stats.cached += new_slab->n_free;
+	}
+	slab = list_entry(pool->partial.next, struct slab, node);
+	obj = slab->free_list;
+	slab->free_list = *(void **)obj;
+	if (--slab->n_free == 0)
+		list_move(&slab->node, &pool->full);
+	pool->stats.cached--;
+	pool->stats.allocs++;
+	if (++pool->stats.in_use > pool->stats.peak)
+		pool->stats.peak = pool->stats.in_use;
+	unlock_pool(pool);
+
+	if (first)
+		register_pool(pool);
+
+	memset(obj, 0, pool->size);
+	return obj;
+}
+
+void mempool_free(struct mempool *pool, void *obj)
+{
+	struct slab *slab, *release = NULL;
+
+	if (!obj)
+		return;
+
+	slab = obj_to_slab(obj);
+	lock_pool(pool);
+	*(void **)obj = slab->free_list;
+	slab->free_list = obj;
+	if (++slab->n_free == 1)
+		list_move(&slab->node, &pool->partial);
+	pool->stats.cached++;
+	if (pool->stats.in_use > 0)
+		pool->stats.in_use--;
+	pool->last_free = now_secs();
+	if (slab->n_free == pool->slab_objs &&
+	    pool->stats.cached - slab->n_free >= pool->max_cached) {
+		list_del(&slab->node);
+		pool->stats.cached -= slab->n_free;
+		pool->stats.slabs--;
+		pool->stats.released++;
+		release = slab;
+	}
+	unlock_pool(pool);
+
+	free(release);
+}
+
+static unsigned int mempool_trim(struct mempool *pool)
+{
+	struct slab *slab, *tmp;
+	LIST_HEAD(empty);
+	unsigned int n = 0;
+
+	lock_pool(pool);
+	list_for_each_entry_safe(slab, tmp, &pool->partial, node) {
+		if (slab->n_free != pool->slab_objs)
+			continue;
+		list_move(&slab->node, &empty);
+		pool->stats.cached -= slab->n_free;
+		pool->stats.slabs--;
+		pool->stats.released++;
+		n++;
+	}
+	unlock_pool(pool);
+
+	list_for_each_entry_safe(slab, tmp, &empty, node)
+		free(slab);
+	return n;
+}
+
+bool mempool_release_idle(time_t idle_secs)
+{
+	struct mempool *pool;
+	time_t now = now_secs();
+	unsigned int n = 0;
+
+	pthread_mutex_lock(&registry_lock);
+	for (pool = registry; pool; pool = pool->next) {
+		bool idle;
+
+		lock_pool(pool);
+		idle = pool->stats.cached > 0 &&
+			now - pool->last_free >= idle_secs;
+		unlock_pool(pool);
+		if (idle) {
+			unsigned int r = mempool_trim(pool);
+
+			condlog(4, "%s: released %u empty %s slabs",
+				__func__, r, pool->name);
+			n += r;
+		}
+	}
+	pthread_mutex_unlock(&registry_lock);
+
+	if (n == 0)
+		return false;
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+	return true;
+}
+
+int print_mempool_stats(struct strbuf *buf)
+{
+	struct mempool *pool;
+	struct mempool_stats st;
+	int rc, len = 0;
+
+	pthread_mutex_lock(&registry_lock);
+	for (pool = registry; pool; pool = pool->next) {
+		lock_pool(pool);
+		st = pool->stats;
+		unlock_pool(pool);
+		rc = print_strbuf(buf, "pool %s: %u in use, %u peak, %u cached, %u slabs, %llu allocs, %llu slabs released\n",
+				  pool->name, st.in_use, st.peak, st.cached,
+				  st.slabs, st.allocs, st.released);
+		if (rc < 0) {
+			len = rc;
+			break;
+		}
+		len += rc;
+	}
+	pthread_mutex_unlock(&registry_lock);
+	return len;
+}
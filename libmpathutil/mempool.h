@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef MEMPOOL_H_INCLUDED
+#define MEMPOOL_H_INCLUDED
+#include <pthread.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "list.h"
+
+struct strbuf;
+
+/*
+ * Slab cache for a single object type. Objects are carved out of slabs,
+ * blocks of MEMPOOL_SLAB_SIZE bytes, and freed objects go back to the
+ * free list of their slab. During uevent storms, this avoids allocator
+ * churn and keeps objects of the same type together rather than
+ * scattered over the heap.
+ * A slab is given back to malloc when its last object is freed and the
+ * pool has more than max_cached free objects, or by
+ * mempool_release_idle() after the pool has been idle for a while.
+ * Slabs with objects in use are never released.
+ */
+#define MEMPOOL_SLAB_SIZE (64 * 1024)
+#define MEMPOOL_MIN_SLAB_OBJS 4
+
+struct mempool_stats {
+	unsigned long long allocs;	/* total mempool_alloc() calls */
+	unsigned long long released;	/* slabs given back to malloc */
+	unsigned int in_use;
+	unsigned int peak;
+	unsigned int cached;		/* free objects in all slabs */
+	unsigned int slabs;
+};
+
+struct mempool {
+	const char *name;
+	size_t size;
+	size_t align;
+	unsigned int max_cached;
+	pthread_mutex_t lock;
+	/* set up on first use */
+	size_t slot_hdr;
+	size_t slot_size;
+	unsigned int slab_objs;
+	struct list_head partial;	/* slabs with free objects */
+	struct list_head full;
+	time_t last_free;
+	bool registered;
+	struct mempool *next;
+	struct mempool_stats stats;
+};
+
+#define MEMPOOL_INIT(nm, type, max)			\
+	{						\
+		.name = nm,				\
+		.size = sizeof(type),			\
+		.align = __alignof__(type),		\
+		.max_cached = max,			\
+		.lock = PTHREAD_MUTEX_INITIALIZER,	\
+	}
+
+/**
+ * mempool_alloc(): allocate an object
+ * @param pool: the pool to allocate from
+ * @returns: zero-initialized object, or NULL if out of memory
+ */
+void *mempool_alloc(struct mempool *pool);
+
+/**
+ * mempool_free(): free an object
+ * @param pool: the pool the object was allocated from
+ * @param obj: the object, may be NULL
+ *
+ * @obj must have been obtained with mempool_alloc() from the same pool.
+ */
+void mempool_free(struct mempool *pool, void *obj);
+
+/**
+ * mempool_release_idle(): give cached memory back to the system
+ * @param idle_secs: minimum time since the last mempool_free() call
+ * @returns: true if any memory was released
+ *
+ * Frees the empty slabs of all pools that haven't seen a free for
+ * @idle_secs seconds, and trims the malloc heap afterwards.
+ */
+bool mempool_release_idle(time_t idle_secs);
+
+/**
+ * print_mempool_stats(): print statistics for all pools in use
+ * @param buf: string buffer to print to
+ * @returns: number of characters printed, or negative error code
+ */
+int print_mempool_stats(struct strbuf *buf);
+
+#endif
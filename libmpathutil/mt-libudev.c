@@ -1,16 +1,54 @@
 #include "mt-libudev.h"
 #include <stddef.h>
+#include <errno.h>
+#include <time.h>
 #include <libudev.h>
 #include "util.h"
+#include "time-util.h"
 
 static pthread_mutex_t libudev_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* protected by libudev_mutex */
+static struct mt_udev_lock_stats lock_stats;
+
+/*
+ * Try the fast path first, and only if the lock is busy account for the
+ * time spent waiting. The counters tell how much the serialization of
+ * libudev calls actually costs.
+ */
+static void libudev_lock(void)
+{
+	struct timespec start, end, diff;
+
+	if (pthread_mutex_trylock(&libudev_mutex) == 0) {
+		lock_stats.calls++;
+		return;
+	}
+	get_monotonic_time(&start);
+	pthread_mutex_lock(&libudev_mutex);
+	get_monotonic_time(&end);
+	timespecsub(&end, &start, &diff);
+	lock_stats.calls++;
+	lock_stats.contended++;
+	lock_stats.wait_us += diff.tv_sec * 1000000ULL + diff.tv_nsec / 1000;
+}
+
+void mt_udev_get_lock_stats(struct mt_udev_lock_stats *st)
+{
+	int oldstate;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+	pthread_mutex_lock(&libudev_mutex);
+	*st = lock_stats;
+	pthread_mutex_unlock(&libudev_mutex);
+	pthread_setcancelstate(oldstate, NULL);
+}
 
 #define LU_WRAP_0(rtype, func)						\
 	rtype mt_##func(void) {						\
 		int __oldstate;						\
 		rtype __r;						\
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &__oldstate); \
-		pthread_mutex_lock(&libudev_mutex);			\
+		libudev_lock();						\
 		__r = func();						\
 		pthread_mutex_unlock(&libudev_mutex);			\
 		pthread_setcancelstate(__oldstate, NULL);		\
@@ -23,7 +61,7 @@ static pthread_mutex_t libudev_mutex = PTHREAD_MUTEX_INITIALIZER;
 		int __oldstate;						\
 		rtype __r;						\
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &__oldstate); \
-		pthread_mutex_lock(&libudev_mutex);			\
+		libudev_lock();						\
 		__r = func(__arg1);						\
 		pthread_mutex_unlock(&libudev_mutex);			\
 		pthread_setcancelstate(__oldstate, NULL);		\
@@ -36,7 +74,7 @@ static pthread_mutex_t libudev_mutex = PTHREAD_MUTEX_INITIALIZER;
 		int __oldstate;						\
 		rtype __r;						\
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &__oldstate); \
-		pthread_mutex_lock(&libudev_mutex);			\
+		libudev_lock();						\
 		__r = func(__arg1, __arg2);				\
 		pthread_mutex_unlock(&libudev_mutex);			\
 		pthread_setcancelstate(__oldstate, NULL);		\
@@ -49,7 +87,7 @@ static pthread_mutex_t libudev_mutex = PTHREAD_MUTEX_INITIALIZER;
 		int __oldstate;						\
 		rtype __r;						\
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &__oldstate); \
-		pthread_mutex_lock(&libudev_mutex);			\
+		libudev_lock();						\
 		__r = func(__arg1, __arg2, __arg3);			\
 		pthread_mutex_unlock(&libudev_mutex);			\
 		pthread_setcancelstate(__oldstate, NULL);		\
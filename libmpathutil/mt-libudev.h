@@ -11,6 +11,18 @@ struct udev_device;
 struct udev_monitor;
 struct udev_enumerate;
 
+/*
+ * All libudev calls are serialized by one mutex, because libudev
+ * isn't thread-safe. These counters show how often callers had to wait.
+ */
+struct mt_udev_lock_stats {
+	unsigned long long calls;
+	unsigned long long contended;
+	unsigned long long wait_us;
+};
+
+void mt_udev_get_lock_stats(struct mt_udev_lock_stats *st);
+
 struct udev *mt_udev_ref(struct udev *udev);
 struct udev *mt_udev_unref(struct udev *udev);
 struct udev *mt_udev_new(void);
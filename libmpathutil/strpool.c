@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "strpool.h"
+#include "util.h"
+#include "debug.h"
+
+#define STRPOOL_BUCKETS 256
+
+struct interned_str {
+	struct interned_str *next;
+	unsigned int refcount;
+	unsigned int hash;
+	char str[];
+};
+
+static pthread_mutex_t strpool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct interned_str *strpool[STRPOOL_BUCKETS];
+static const char empty_str[] = "";
+
+const char *get_interned_str(const char *str)
+{
+	struct interned_str *is;
+	unsigned int h;
+	size_t len;
+
+	if (!str || !*str)
+		return empty_str;
+
+	h = str_hash(str);
+	pthread_mutex_lock(&strpool_lock);
+	for (is = strpool[h % STRPOOL_BUCKETS]; is; is = is->next) {
+		if (is->hash == h && !strcmp(is->str, str)) {
+			is->refcount++;
+			pthread_mutex_unlock(&strpool_lock);
+			return is->str;
+		}
+	}
+
+	len = strlen(str);
+	is = malloc(sizeof(*is) + len + 1);
+	if (!is) {
+		pthread_mutex_unlock(&strpool_lock);
+		condlog(0, "%s: failed to intern \"%s\"", __func__, str);
+		return empty_str;
+	}
+	memcpy(is->str, str, len + 1);
+	is->hash = h;
+	is->refcount = 1;
+	is->next = strpool[h % STRPOOL_BUCKETS];
+	strpool[h % STRPOOL_BUCKETS] = is;
+	pthread_mutex_unlock(&strpool_lock);
+	return is->str;
+}
+
+void put_interned_str(const char *str)
+{
+	struct interned_str *is, **prev;
+	unsigned int h;
+
+	if (!str || !*str)
+		return;
+
+	h = str_hash(str);
+	pthread_mutex_lock(&strpool_lock);
+	for (prev = &strpool[h % STRPOOL_BUCKETS]; (is = *prev) != NULL;
+	     prev = &is->next) {
+		if (is->str != str)
+			continue;
+		if (--is->refcount == 0)
+			*prev = is->next;
+		else
+			is = NULL;
+		break;
+	}
+	pthread_mutex_unlock(&strpool_lock);
+	free(is);
+}
+
+void set_interned_str(const char **field, const char *str)
+{
+	const char *old = *field;
+
+	*field = get_interned_str(str);
+	put_interned_str(old);
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef STRPOOL_H_INCLUDED
+#define STRPOOL_H_INCLUDED
+
+/*
+ * Interned strings. Identity strings like vendor, product or target node
+ * names are shared by thousands of paths. Keep one reference-counted copy
+ * of every distinct value, so that paths only carry pointers to them,
+ * and equal values can be compared by pointer.
+ * Interned strings must never be modified.
+ */
+
+/**
+ * get_interned_str(): get a reference to the interned copy of a string
+ * @param str: the string to look up. NULL is treated like "".
+ * @returns: the interned copy. Never NULL; if memory allocation fails,
+ * "" is returned.
+ */
+const char *get_interned_str(const char *str);
+
+/**
+ * put_interned_str(): drop a reference obtained by get_interned_str()
+ * @param str: the interned string. NULL, "", and strings that haven't
+ * been obtained from get_interned_str() are ignored.
+ */
+void put_interned_str(const char *str);
+
+/**
+ * set_interned_str(): replace an interned string
+ * @param field: pointer to the interned string to replace
+ * @param str: the new value, doesn't need to be interned
+ */
+void set_interned_str(const char **field, const char *str);
+
+#endif
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <string.h>
+#include <limits.h>
+#include "timing.h"
+#include "time-util.h"
+#include "strbuf.h"
+#include "util.h"
+
+static const unsigned int windows[] = { 1, 5, 15 };
+
+unsigned long long timespec_us(const struct timespec *ts)
+{
+	if (ts->tv_sec < 0)
+		return 0;
+	return ts->tv_sec * 1000000ULL + ts->tv_nsec / 1000;
+}
+
+static time_t current_idx(void)
+{
+	struct timespec now;
+
+	get_monotonic_time(&now);
+	return now.tv_sec / TIMING_SLOT_SECS;
+}
+
+void timing_add(struct timing_stats *ts, unsigned long long us)
+{
+	time_t idx = current_idx();
+	struct timing_slot *slot = &ts->slot[idx % TIMING_SLOTS];
+
+	if (slot->idx != idx) {
+		memset(slot, 0, sizeof(*slot));
+		slot->idx = idx;
+	}
+	slot->count++;
+	slot->total_us += us;
+	if (us > slot->max_us)
+		slot->max_us = us > UINT_MAX ? UINT_MAX : us;
+}
+
+void timing_sum(const struct timing_stats *ts, unsigned int minutes,
+		struct timing_slot *sum)
+{
+	time_t idx = current_idx();
+	unsigned int i;
+
+	memset(sum, 0, sizeof(*sum));
+	if (minutes > TIMING_SLOTS)
+		minutes = TIMING_SLOTS;
+	for (i = 0; i < TIMING_SLOTS; i++) {
+		const struct timing_slot *slot = &ts->slot[i];
+
+		if (slot->idx > idx || slot->idx <= idx - (time_t)minutes)
+			continue;
+		sum->count += slot->count;
+		sum->total_us += slot->total_us;
+		if (slot->max_us > sum->max_us)
+			sum->max_us = slot->max_us;
+	}
+}
+
+int print_timing_header(struct strbuf *buf, const char *title)
+{
+	static const char * const labels[] = {
+		"last minute", "last 5 minutes", "last 15 minutes",
+	};
+	size_t initial_len = get_strbuf_len(buf);
+	unsigned int i;
+	int rc;
+
+	if ((rc = print_strbuf(buf, "%-24s", "")) < 0)
+		return rc;
+	for (i = 0; i < ARRAY_SIZE(windows); i++)
+		if ((rc = print_strbuf(buf, "  %28s", labels[i])) < 0)
+			return rc;
+	if ((rc = print_strbuf(buf, "\n%-24s", title)) < 0)
+		return rc;
+	for (i = 0; i < ARRAY_SIZE(windows); i++)
+		if ((rc = print_strbuf(buf, "  %8s %9s %9s", "count",
+				       "avg ms", "max ms")) < 0)
+			return rc;
+	if ((rc = append_strbuf_str(buf, "\n")) < 0)
+		return rc;
+	return get_strbuf_len(buf) - initial_len;
+}
+
+int print_timing(struct strbuf *buf, const char *name,
+		 const struct timing_stats *ts)
+{
+	size_t initial_len = get_strbuf_len(buf);
+	struct timing_slot sum;
+	unsigned int i;
+	int rc;
+
+	if ((rc = print_strbuf(buf, "%-24s", name)) < 0)
+		return rc;
+	for (i = 0; i < ARRAY_SIZE(windows); i++) {
+		unsigned long long avg;
+
+		timing_sum(ts, windows[i], &sum);
+		avg = sum.count ? sum.total_us / sum.count : 0;
+		if ((rc = print_strbuf(buf, "  %8u %5llu.%03llu %5u.%03u",
+				       sum.count, avg / 1000, avg % 1000,
+				       sum.max_us / 1000,
+				       sum.max_us % 1000)) < 0)
+			return rc;
+	}
+	if ((rc = append_strbuf_str(buf, "\n")) < 0)
+		return rc;
+	return get_strbuf_len(buf) - initial_len;
+}
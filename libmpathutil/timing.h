@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef TIMING_H_INCLUDED
+#define TIMING_H_INCLUDED
+#include <time.h>
+
+struct strbuf;
+
+/*
+ * Durations over rolling windows: one slot per minute, for the last
+ * TIMING_SLOTS minutes. The caller must serialize access.
+ */
+#define TIMING_SLOT_SECS 60
+#define TIMING_SLOTS 15
+
+struct timing_slot {
+	time_t idx;
+	unsigned int count;
+	unsigned int max_us;
+	unsigned long long total_us;
+};
+
+struct timing_stats {
+	struct timing_slot slot[TIMING_SLOTS];
+};
+
+/**
+ * timespec_us(): convert a duration to microseconds
+ * @param ts: the duration. Negative values are treated as 0.
+ */
+unsigned long long timespec_us(const struct timespec *ts);
+
+/**
+ * timing_add(): record a duration
+ * @param ts: the statistics
+ * @param us: the duration in microseconds
+ */
+void timing_add(struct timing_stats *ts, unsigned long long us);
+
+/**
+ * timing_sum(): sum up a window
+ * @param ts: the statistics
+ * @param minutes: the window size, at most TIMING_SLOTS
+ * @param sum: the result. sum->idx is not set.
+ */
+void timing_sum(const struct timing_stats *ts, unsigned int minutes,
+		struct timing_slot *sum);
+
+/**
+ * print_timing_header(): print the column headers for print_timing()
+ * @param buf: string buffer to print to
+ * @param title: title of the first column
+ * @returns: number of characters printed, or negative error code
+ */
+int print_timing_header(struct strbuf *buf, const char *title);
+
+/**
+ * print_timing(): print count, average and maximum for the last 1, 5
+ * and 15 minutes
+ * @param buf: string buffer to print to
+ * @param name: label of the row
+ * @param ts: the statistics
+ * @returns: number of characters printed, or negative error code
+ */
+int print_timing(struct strbuf *buf, const char *name,
+		 const struct timing_stats *ts);
+
+#endif
@@ -158,6 +158,18 @@ size_t libmp_strlcat(char * restrict dst, const char * restrict src, size_t size
 	return bytes;
 }
 
+/* FNV-1a */
+unsigned int str_hash(const char *str)
+{
+	unsigned int h = 2166136261U;
+
+	for (; *str; str++) {
+		h ^= (unsigned char)*str;
+		h *= 16777619U;
+	}
+	return h;
+}
+
 /* This function returns a pointer inside of the supplied pathname string.
  * If is_path_device is true, it may also modify the supplied string */
 char *convert_dev(char *name, int is_path_device)
@@ -30,6 +30,7 @@ char *get_next_string(char **temp, const char *split_char);
 int get_word (const char * sentence, char ** word);
 size_t libmp_strlcpy(char * restrict dst, const char * restrict src, size_t size);
 size_t libmp_strlcat(char * restrict dst, const char * restrict src, size_t size);
+unsigned int str_hash(const char *str);
 #if defined(__GLIBC__) && ! (__GLIBC_PREREQ(2, 38))
 #define strlcpy(dst, src, size) libmp_strlcpy(dst, src, size)
 #define strlcat(dst, src, size) libmp_strlcat(dst, src, size)
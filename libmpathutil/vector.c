@@ -11,6 +11,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "vector.h"
 #include "msort.h"
 
@@ -25,27 +26,74 @@ vector_alloc(void)
 	return v;
 }
 
-/* allocated one slot */
+/* Smallest number of slots allocated for a non-empty vector */
+#define VECTOR_MIN_CAPACITY 4
+
+static bool
+vector_realloc(vector v, int capacity)
+{
+	void **new_slot;
+
+	new_slot = realloc(v->slot, sizeof(void *) * capacity);
+	if (!new_slot)
+		return false;
+
+	v->slot = new_slot;
+	v->capacity = capacity;
+	return true;
+}
+
+/*
+ * Make sure that the vector can hold at least "size" elements without
+ * reallocating. Doesn't change VECTOR_SIZE().
+ */
 bool
-vector_alloc_slot(vector v)
+vector_reserve(vector v, int size)
 {
-	void *new_slot = NULL;
-	int new_allocated;
-	int i;
+	if (!v || size < 0)
+		return false;
+	if (size <= v->capacity)
+		return true;
+	return vector_realloc(v, size);
+}
 
+/*
+ * Allocate one slot. The slot array grows geometrically, so that
+ * filling a vector with n elements takes O(log n) reallocations.
+ */
+bool
+vector_alloc_slot(vector v)
+{
 	if (!v)
 		return false;
 
-	new_allocated = v->allocated + 1;
-	new_slot = realloc(v->slot, sizeof (void *) * new_allocated);
-	if (!new_slot)
+	if (v->allocated == v->capacity &&
+	    !vector_realloc(v, v->capacity >= VECTOR_MIN_CAPACITY ?
+			    2 * v->capacity : VECTOR_MIN_CAPACITY))
 		return false;
 
-	v->slot = new_slot;
-	for (i = v->allocated; i < new_allocated; i++)
-		v->slot[i] = NULL;
+	v->slot[v->allocated++] = NULL;
+	return true;
+}
+
+/* Append all elements of src to v */
+bool
+vector_append(vector v, const struct vector_s *src)
+{
+	int n = VECTOR_SIZE(src);
 
-	v->allocated = new_allocated;
+	if (!v)
+		return false;
+	if (n == 0)
+		return true;
+
+	if (v->allocated + n > v->capacity &&
+	    !vector_realloc(v, v->allocated + n > 2 * v->capacity ?
+			    v->allocated + n : 2 * v->capacity))
+		return false;
+
+	memcpy(v->slot + v->allocated, src->slot, sizeof(void *) * n);
+	v->allocated += n;
 	return true;
 }
 
@@ -98,35 +146,25 @@ int find_slot(vector v, const void *addr)
 void
 vector_del_slot(vector v, int slot)
 {
-	int i;
-
 	if (!v || !v->allocated || slot < 0 || slot >= VECTOR_SIZE(v))
 		return;
 
-	for (i = slot + 1; i < VECTOR_SIZE(v); i++)
-		v->slot[i - 1] = v->slot[i];
-
+	memmove(v->slot + slot, v->slot + slot + 1,
+		sizeof(void *) * (v->allocated - slot - 1));
 	v->allocated--;
 
 	if (v->allocated <= 0) {
 		free(v->slot);
 		v->slot = NULL;
 		v->allocated = 0;
-	} else {
-		void *new_slot;
-
-		new_slot = realloc(v->slot, sizeof (void *) * v->allocated);
+		v->capacity = 0;
+	} else if (v->capacity > VECTOR_MIN_CAPACITY &&
+		   v->allocated <= v->capacity / 4)
 		/*
-		 * If realloc() fails, v->allocated will be smaller than the
-		 * actual allocated size vector size.
-		 * This is intentional; we want VECTOR_SIZE() to return
-		 * the number of used elements. Otherwise, vector_for_each_slot()
-		 * et al. wouldn't work as intended; there might be duplicate
-		 * or stale elements at the end of the vector.
+		 * Give back memory if the vector has shrunk a lot. If
+		 * realloc() fails, we simply keep the bigger array.
 		 */
-		if (new_slot)
-			v->slot = new_slot;
-	}
+		vector_realloc(v, v->capacity / 2);
 }
 
 vector
@@ -139,6 +177,7 @@ vector_reset(vector v)
 		free(v->slot);
 
 	v->allocated = 0;
+	v->capacity = 0;
 	v->slot = NULL;
 	return v;
 }
@@ -16,10 +16,15 @@
 
 #include <stdbool.h>
 
-/* vector definition */
+/*
+ * vector definition
+ * "allocated" is the number of used slots, "capacity" the number of
+ * slots actually allocated in memory.
+ */
 struct vector_s {
 	int allocated;
 	void **slot;
+	int capacity;
 };
 typedef struct vector_s *vector;
 
@@ -50,6 +55,11 @@ typedef struct vector_s *vector;
 									\
 		if (__t == NULL)					\
 			__t = vector_alloc();				\
+		if (__t != NULL &&					\
+		    !vector_reserve(__t, VECTOR_SIZE(__t) + VECTOR_SIZE(__v))) { \
+			vector_free(__t);				\
+			__t = NULL;					\
+		}							\
 		if (__t != NULL) {					\
 			vector_foreach_slot(__v, __j, __i) {		\
 				if (!vector_alloc_slot(__t)) {	\
@@ -66,6 +76,8 @@ typedef struct vector_s *vector;
 /* Prototypes */
 extern vector vector_alloc(void);
 extern bool vector_alloc_slot(vector v);
+bool vector_reserve(vector v, int size);
+bool vector_append(vector v, const struct vector_s *src);
 vector vector_reset(vector v);
 extern void vector_free(vector v);
 void cleanup_vector(vector *pv);
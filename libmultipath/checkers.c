@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stddef.h>
+#include <limits.h>
 #include <dlfcn.h>
 #include <sys/stat.h>
 #include <urcu.h>
@@ -13,6 +14,8 @@
 #include "vector.h"
 #include "util.h"
 #include "structs.h"
+#include "time-util.h"
+#include "metrics.h"
 
 static const char * const checker_dir = MULTIPATH_DIR;
 
@@ -270,6 +273,26 @@ void checker_put (struct checker * dst)
 	put_shared_ptr(src);
 }
 
+/*
+ * Called when a check has finished. For asynchronous checkers, this
+ * happens when the result is picked up by checker_get_state().
+ */
+static void checker_account(struct path *pp)
+{
+	struct checker *c = &pp->checker;
+	struct timespec now, diff;
+	unsigned long long us;
+
+	get_monotonic_time(&now);
+	timespecsub(&now, &c->start, &diff);
+	metric_observe(MP_METRIC_CHECKER_DURATION, c->cls->name, &diff);
+	if (c->path_state == PATH_TIMEOUT)
+		metric_inc(MP_METRIC_CHECKER_TIMEOUTS, c->cls->name);
+
+	us = diff.tv_sec < 0 ? 0 : diff.tv_sec * 1000000ULL + diff.tv_nsec / 1000;
+	lat_hist_add(&pp->chk_latency, us > UINT_MAX ? UINT_MAX : us);
+}
+
 int checker_get_state(struct path *pp)
 {
 	struct checker *c = &pp->checker;
@@ -281,6 +304,8 @@ int checker_get_state(struct path *pp)
 		return c->path_state;
 	mpc = pp->mpp ? &pp->mpp->mpcontext : NULL;
 	c->path_state = c->cls->pending(c, mpc);
+	if (c->path_state != PATH_PENDING)
+		checker_account(pp);
 	return c->path_state;
 }
 
@@ -312,7 +337,10 @@ void checker_check(struct path *pp, int path_state)
 		union checker_mpcontext *mpc;
 
 		mpc = pp->mpp ? &pp->mpp->mpcontext : NULL;
+		get_monotonic_time(&c->start);
 		c->path_state = c->cls->check(c, mpc);
+		if (c->path_state != PATH_PENDING)
+			checker_account(pp);
 	}
 }
 
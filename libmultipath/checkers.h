@@ -3,6 +3,7 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <time.h>
 #include "list.h"
 #include "defaults.h"
 
@@ -175,6 +176,7 @@ struct checker {
 	int path_state;
 	short msgid;		             /* checker-internal extra status */
 	void *context;			     /* store for persistent data */
+	struct timespec start;		     /* start of the current check */
 };
 
 static inline int checker_selected(const struct checker *c)
@@ -214,7 +214,7 @@ find_hwe (const struct vector_s *hwtable,
 	return n;
 }
 
-struct mpentry *find_mpe(vector mptable, char *wwid)
+struct mpentry *find_mpe(vector mptable, const char *wwid)
 {
 	int i;
 	struct mpentry * mpe;
@@ -788,6 +788,7 @@ static void _uninit_config(struct config *conf)
 	free_hwtable(conf->hwtable);
 	free_hwe(conf->overrides);
 	free_keywords(conf->keywords);
+	free_propsel_cache(conf->propsel_cache);
 
 	memset(conf, 0, sizeof(*conf));
 }
@@ -136,6 +136,8 @@ struct mpentry {
 	mode_t mode;
 };
 
+struct propsel_cache;
+
 struct config {
 	struct rcu_head rcu;
 	int verbosity;
@@ -232,6 +234,9 @@ struct config {
 	vector elist_property;
 	vector elist_protocol;
 	char *enable_foreign;
+
+	/* resolved map settings for this configuration, see propsel.c */
+	struct propsel_cache *propsel_cache;
 };
 
 /**
@@ -285,7 +290,7 @@ void libmultipath_exit(void);
 int find_hwe (const struct vector_s *hwtable,
 	      const char * vendor, const char * product, const char *revision,
 	      vector result);
-struct mpentry * find_mpe (vector mptable, char * wwid);
+struct mpentry * find_mpe (vector mptable, const char * wwid);
 const char *get_mpe_wwid (const struct vector_s *mptable, const char *alias);
 
 struct hwentry * alloc_hwe (void);
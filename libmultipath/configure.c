@@ -42,6 +42,7 @@
 #include "wwids.h"
 #include "sysfs.h"
 #include "io_err_stat.h"
+#include "time-util.h"
 
 /* group paths in pg by host adapter
  */
@@ -303,6 +304,7 @@ int setup_map(struct multipath *mpp, char **params, struct vectors *vecs)
 	conf = get_multipath_config();
 	pthread_cleanup_push(put_multipath_config, conf);
 
+	mpp->profile = get_propsel_profile(conf, mpp->mpe, mpp->hwe);
 	select_pgfailback(conf, mpp);
 	select_detect_pgpolicy(conf, mpp);
 	select_detect_pgpolicy_use_tpg(conf, mpp);
@@ -356,6 +358,8 @@ int setup_map(struct multipath *mpp, char **params, struct vectors *vecs)
 	select_flush_on_last_del(conf, mpp);
 	select_purge_disconnected(conf, mpp);
 
+	mpp->profile = NULL;
+
 	sysfs_set_scsi_tmo(conf, mpp);
 	marginal_pathgroups = conf->marginal_pathgroups;
 	mpp->sync_tick = conf->max_checkint;
@@ -673,6 +677,7 @@ select_reload_action(struct multipath *mpp, const char *reason)
 {
 	mpp->action = mpp->action == ACT_RENAME ? ACT_RELOAD_RENAME :
 		      ACT_RELOAD;
+	mpp->reload_reason = reason;
 	condlog(3, "%s: set ACT_RELOAD (%s)", mpp->alias, reason);
 }
 
@@ -863,6 +868,7 @@ int domap(struct multipath *mpp, char *params, int is_daemon)
 			condlog(3, "%s: map already present",
 				mpp->alias);
 			mpp->action = ACT_RELOAD;
+			mpp->reload_reason = "map already present";
 		} else if (rc == DMP_OK) {
 			condlog(1, "%s: map \"%s\" already present with WWID \"%s\", skipping\n"
 				   "please check alias settings in config and bindings file",
@@ -892,6 +898,7 @@ int domap(struct multipath *mpp, char *params, int is_daemon)
 				mpp->alias, alias);
 			strlcpy(mpp->alias_old, alias, WWID_SIZE);
 			mpp->action = ACT_RELOAD_RENAME;
+			mpp->reload_reason = "rename";
 		}
 	}
 	if (mpp->action == ACT_RENAME || mpp->action == ACT_SWITCHPG_RENAME ||
@@ -1027,6 +1034,36 @@ out:
 	return ret;
 }
 
+/* Time spent in the phases of coalesce_paths() */
+struct coalesce_times {
+	struct timespec setup;
+	struct timespec dm;
+	struct timespec udev;
+	int maps;
+};
+
+static void add_elapsed(struct timespec *sum, const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	get_monotonic_time(&now);
+	timespecsub(&now, start, &diff);
+	sum->tv_sec += diff.tv_sec;
+	sum->tv_nsec += diff.tv_nsec;
+	normalize_timespec(sum);
+}
+
+static void wait_udev_batch(struct coalesce_times *times)
+{
+	struct timespec start;
+
+	get_monotonic_time(&start);
+	dm_udev_batch_wait();
+	add_elapsed(&times->udev, &start);
+}
+
+#define TS_MSEC(ts) ((long)(ts).tv_sec * 1000 + (ts).tv_nsec / 1000000)
+
 /*
  * The force_reload parameter determines how coalesce_paths treats existing maps.
  * FORCE_RELOAD_NONE: existing maps aren't touched at all
@@ -1051,6 +1088,9 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 	int allow_queueing;
 	union bitfield *size_mismatch_seen;
 	struct multipath * cmpp;
+	struct wwid_index *idx = NULL;
+	struct coalesce_times times = { .maps = 0 };
+	struct timespec start;
 
 	/* ignore refwwid if it's empty */
 	if (refwwid && !strlen(refwwid))
@@ -1077,6 +1117,22 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 		goto out;
 	}
 
+	/*
+	 * pathvec isn't modified below, so we can look up the paths
+	 * of every map in an index instead of scanning all paths.
+	 * Without the index, wwid_index_next() falls back to scanning.
+	 */
+	idx = alloc_wwid_index(pathvec);
+
+	/*
+	 * The multipath command doesn't need to wait for udev after every
+	 * map. Create and reload the maps back to back, and wait for udev
+	 * once per batch. multipathd tracks the udev state of each map
+	 * and doesn't batch.
+	 */
+	if (!is_daemon)
+		dm_udev_batch_open();
+
 	vector_foreach_slot (pathvec, pp1, k) {
 		int invalid;
 
@@ -1132,7 +1188,7 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 		/*
 		 * at this point, we know we really got a new mp
 		 */
-		mpp = add_map_with_path(vecs, pp1, 0, cmpp);
+		mpp = add_map_with_path__(vecs, pp1, 0, cmpp, idx);
 		if (!mpp) {
 			orphan_path(pp1, "failed to create multipath device");
 			continue;
@@ -1144,12 +1200,10 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 			continue;
 		}
 
-		for (i = k + 1; i < VECTOR_SIZE(pathvec); i++) {
+		for (i = wwid_index_next(idx, pathvec, pp1->wwid, k); i >= 0;
+		     i = wwid_index_next(idx, pathvec, pp1->wwid, i)) {
 			pp2 = VECTOR_SLOT(pathvec, i);
 
-			if (strcmp(pp1->wwid, pp2->wwid))
-				continue;
-
 			if (!mpp->size && pp2->size)
 				mpp->size = pp2->size;
 
@@ -1171,6 +1225,7 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 			mpp->queue_mode = cmpp->queue_mode;
 		if (cmd == CMD_DRY_RUN && mpp->action == ACT_UNDEF)
 			mpp->action = ACT_DRY_RUN;
+		get_monotonic_time(&start);
 		if (setup_map(mpp, &params, vecs)) {
 			remove_map(mpp, vecs->pathvec);
 			continue;
@@ -1179,10 +1234,16 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 		if (mpp->action == ACT_UNDEF)
 			select_action(mpp, curmp,
 				      force_reload == FORCE_RELOAD_YES ? 1 : 0);
+		add_elapsed(&times.setup, &start);
 
+		get_monotonic_time(&start);
 		r = domap(mpp, params, is_daemon);
 		free(params);
 		params = NULL;
+		add_elapsed(&times.dm, &start);
+		times.maps++;
+		if (dm_udev_batch_size() >= DM_UDEV_BATCH_MAX)
+			wait_udev_batch(&times);
 
 		if (r == DOMAP_FAIL || r == DOMAP_RETRY) {
 			condlog(3, "%s: domap (%u) failure "
@@ -1234,6 +1295,14 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 	}
 	ret = CP_OK;
 out:
+	if (!is_daemon) {
+		wait_udev_batch(&times);
+		dm_udev_batch_close();
+		condlog(3, "%d maps: setup %ldms, dm %ldms, udev wait %ldms",
+			times.maps, TS_MSEC(times.setup), TS_MSEC(times.dm),
+			TS_MSEC(times.udev));
+	}
+	free_wwid_index(idx);
 	free(size_mismatch_seen);
 	if (!mpvec) {
 		vector_foreach_slot (newmp, mpp, i)
@@ -1396,3 +1465,148 @@ int get_refwwid(enum mpath_cmds cmd, const char *dev, enum devtypes dev_type,
 	pthread_cleanup_pop(1);
 	return ret;
 }
+
+int mpentry_changed(const struct config *old, const struct config *conf,
+		    const char *wwid)
+{
+	const struct mpentry *old_mpe = find_mpe(old->mptable, wwid);
+	const struct mpentry *new_mpe = find_mpe(conf->mptable, wwid);
+	const char *old_alias = old_mpe ? old_mpe->alias : NULL;
+	const char *new_alias = new_mpe ? new_mpe->alias : NULL;
+
+	if (!mpes_differ(conf, old_mpe, new_mpe))
+		return MPE_UNCHANGED;
+	if (old_alias != new_alias &&
+	    (!old_alias || !new_alias || strcmp(old_alias, new_alias)))
+		return MPE_ALIAS_CHANGED;
+	return MPE_CHANGED;
+}
+
+/* The hwtable entries for one vendor / product / revision */
+struct hwe_lookup {
+	/* interned strings, compared by address */
+	const char *vendor;
+	const char *product;
+	const char *rev;
+	vector hwe;
+	bool changed;
+};
+
+/* The revision is only used for SCSI and CCISS, see *_sysfs_pathinfo() */
+static const char *hwe_rev(const struct path *pp)
+{
+	if (pp->bus == SYSFS_BUS_SCSI || pp->bus == SYSFS_BUS_CCISS)
+		return pp->rev;
+	return NULL;
+}
+
+/*
+ * Matching paths against the hwtable is expensive, and there are usually
+ * just a few different device types. Look up every type only once.
+ */
+static struct hwe_lookup *lookup_hwe(vector cache, const struct config *conf,
+				     const struct path *pp)
+{
+	const char *rev = hwe_rev(pp);
+	struct hwe_lookup *hl;
+	int i;
+
+	vector_foreach_slot(cache, hl, i)
+		if (hl->vendor == pp->vendor_id &&
+		    hl->product == pp->product_id && hl->rev == rev)
+			return hl;
+
+	hl = calloc(1, sizeof(*hl));
+	if (!hl)
+		return NULL;
+	hl->vendor = pp->vendor_id;
+	hl->product = pp->product_id;
+	hl->rev = rev;
+	if (!(hl->hwe = vector_alloc()) || !vector_alloc_slot(cache)) {
+		vector_free(hl->hwe);
+		free(hl);
+		return NULL;
+	}
+	vector_set_slot(cache, hl);
+	find_hwe(conf->hwtable, pp->vendor_id, pp->product_id, rev, hl->hwe);
+	/* All paths of this type have the same entries from the old config */
+	hl->changed = hwes_differ(conf, pp->hwe, hl->hwe);
+	return hl;
+}
+
+/*
+ * Make the checker and prioritizer of a path be selected again with the
+ * current configuration, like for a new path.
+ */
+static void reset_path_selection(struct config *conf, struct path *pp)
+{
+	if (checker_selected(&pp->checker))
+		checker_put(&pp->checker);
+	if (prio_selected(&pp->prio))
+		prio_put(&pp->prio);
+	pp->checker_timeout = 0;
+	/* Don't pick up the result of a check by the old checker */
+	if (pp->is_checked == CHECK_PATH_STARTED)
+		pp->is_checked = CHECK_PATH_SKIPPED;
+	if (pp->mpp)
+		pathinfo(pp, conf, DI_PRIO);
+}
+
+int reconfigure_paths(vector pathvec, const struct config *old,
+		      struct config *conf, bool all, bool mptable_changed,
+		      union bitfield *changed)
+{
+	vector cache = vector_alloc();
+	struct hwe_lookup *hl;
+	struct hwentry *hwe;
+	struct path *pp;
+	const char *uid_attribute;
+	int i, j, ret = -1;
+
+	if (!cache)
+		return -1;
+
+	vector_foreach_slot(pathvec, pp, i) {
+		bool path_changed = all;
+
+		if (!(hl = lookup_hwe(cache, conf, pp)))
+			goto out;
+		path_changed = path_changed || hl->changed;
+		vector_reset(pp->hwe);
+		vector_foreach_slot(hl->hwe, hwe, j) {
+			if (!vector_alloc_slot(pp->hwe))
+				goto out;
+			vector_set_slot(pp->hwe, hwe);
+		}
+
+		/* A new uid_attribute may change the WWID */
+		uid_attribute = pp->uid_attribute;
+		select_getuid(conf, pp);
+		select_recheck_wwid(conf, pp);
+		if (uid_attribute != pp->uid_attribute &&
+		    (!uid_attribute || !pp->uid_attribute ||
+		     strcmp(uid_attribute, pp->uid_attribute))) {
+			condlog(2, "%s: uid_attribute changed", pp->dev);
+			ret = 1;
+			goto out;
+		}
+
+		/* multipaths entries can set the prioritizer */
+		if (!path_changed && mptable_changed && *pp->wwid &&
+		    mpentry_changed(old, conf, pp->wwid) != MPE_UNCHANGED)
+			path_changed = true;
+
+		if (path_changed) {
+			reset_path_selection(conf, pp);
+			set_bit_in_bitfield(i, changed);
+		}
+	}
+	ret = 0;
+out:
+	vector_foreach_slot(cache, hl, i) {
+		vector_free(hl->hwe);
+		free(hl);
+	}
+	vector_free(cache);
+	return ret;
+}
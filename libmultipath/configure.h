@@ -65,4 +65,32 @@ void trigger_paths_udev_change(struct multipath *mpp, bool is_mpath);
 void trigger_partitions_udev_change(struct udev_device *dev, const char *action,
 				    int len);
 int check_daemon(void);
+
+/*
+ * Incremental reconfiguration in multipathd. @old is the configuration
+ * that @conf replaces. It must not be freed before these functions
+ * return.
+ */
+enum {
+	MPE_UNCHANGED,
+	MPE_CHANGED,
+	MPE_ALIAS_CHANGED,
+};
+struct config;
+union bitfield;
+
+/* Compare the multipaths entries for @wwid in @old and @conf */
+int mpentry_changed(const struct config *old, const struct config *conf,
+		    const char *wwid);
+/*
+ * Apply @conf to the paths in @pathvec, without running path discovery
+ * again. The hwtable entries and uid_attribute of all paths are updated.
+ * Paths with changed settings, or all paths if @all is set, get their
+ * checker and prioritizer selected again, and are marked in @changed.
+ * Returns 0 on success, 1 if the paths have to be discovered again
+ * because the uid_attribute of a path changed, -1 on error.
+ */
+int reconfigure_paths(vector pathvec, const struct config *old,
+		      struct config *conf, bool all, bool mptable_changed,
+		      union bitfield *changed);
 #endif
@@ -12,6 +12,10 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <limits.h>
 #include <syslog.h>
 #include <sys/sysmacros.h>
 
@@ -24,6 +28,9 @@
 #include "wwids.h"
 #include "version.h"
 #include "time-util.h"
+#include "metrics.h"
+#include "history.h"
+#include "trace.h"
 
 #include "log_pthread.h"
 #include <sys/types.h>
@@ -50,7 +57,8 @@ static int dm_cancel_remove_partmaps(const char * mapname);
 #define DR_UNUSED__ __attribute__((unused))
 #endif
 
-static int dm_remove_partmaps (const char *mapname, int flags);
+static int dm_remove_partmaps (const char *mapname, int flags,
+			       uint32_t *cookie);
 static int do_foreach_partmaps(const char *mapname,
 			       int (*partmap_func)(const char *, void *),
 			       void *data);
@@ -79,6 +87,61 @@ static void libmp_udev_wait(unsigned int c)
 }
 #endif
 
+/*
+ * udev batch of the multipath command. While a batch is open, map
+ * creations and resumes add their udev cookie to the batch cookie
+ * instead of waiting for udev one map at a time. The batch isn't
+ * thread-safe, multipathd doesn't use it.
+ */
+static struct {
+	bool open;
+	unsigned int count;
+	uint32_t cookie;
+} udev_batch;
+
+/* Returns the cookie to use for a DM task that needs udev sync */
+static uint32_t *udev_task_cookie(uint32_t *cookie)
+{
+	if (!udev_batch.open)
+		return cookie;
+	udev_batch.count++;
+	return &udev_batch.cookie;
+}
+
+void dm_udev_batch_open(void)
+{
+	udev_batch.open = true;
+}
+
+unsigned int dm_udev_batch_size(void)
+{
+	return udev_batch.count;
+}
+
+void dm_udev_batch_wait(void)
+{
+	if (udev_batch.cookie)
+		libmp_udev_wait(udev_batch.cookie);
+	udev_batch.cookie = 0;
+	udev_batch.count = 0;
+}
+
+void dm_udev_batch_close(void)
+{
+	dm_udev_batch_wait();
+	udev_batch.open = false;
+}
+
+/*
+ * Called before a DM operation that changes the map @mapname.
+ * Overridden by multipathd, which waits there until the path messages
+ * it has queued for the map have been sent, so that they can't undo
+ * the operation.
+ */
+void dm_sync_map_callback(const char *mapname __attribute__((unused)))
+{
+}
+
 const char *dmp_errstr(int rc)
 {
 	static const char *str[] = {
@@ -105,6 +168,16 @@ int libmp_dm_task_run(struct dm_task *dmt)
 	return r;
 }
 
+/* Record the duration of a DM operation that was started at @start */
+static void observe_dm_op(const char *op, const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	get_monotonic_time(&now);
+	timespecsub(&now, start, &diff);
+	metric_observe(MP_METRIC_DM_OP_DURATION, op, &diff);
+}
+
 static void cleanup_dm_task(struct dm_task **pdmt)
 {
 	if (*pdmt)
@@ -398,21 +471,30 @@ libmp_dm_task_create(int task)
 	return dm_task_create(task);
 }
 
+/*
+ * If @batch_cookie is not NULL, the udev cookie is added to it, and the
+ * caller must wait for it. Otherwise, wait for udev here.
+ */
 static int
-dm_simplecmd (int task, const char *name, int flags, uint16_t udev_flags) {
+dm_simplecmd__ (int task, const char *name, int flags, uint16_t udev_flags,
+		uint32_t *batch_cookie) {
 	int r;
 	int udev_wait_flag = (((flags & DMFL_NEED_SYNC) || udev_flags) &&
 			      (task == DM_DEVICE_RESUME ||
 			       task == DM_DEVICE_REMOVE));
 	uint32_t cookie = 0;
+	uint32_t *pcookie = batch_cookie ? batch_cookie : &cookie;
 	struct dm_task __attribute__((cleanup(cleanup_dm_task))) *dmt = NULL;
+	struct timespec start;
 
+	dm_sync_map_callback(name);
 	if (!(dmt = libmp_dm_task_create (task)))
 		return 0;
 
 	if (!dm_task_set_name (dmt, name))
 		return 0;
 
+	get_monotonic_time(&start);
 	dm_task_skip_lockfs(dmt);	/* for DM_DEVICE_RESUME */
 #ifdef LIBDM_API_FLUSH
 	if (flags & DMFL_NO_FLUSH)
@@ -422,20 +504,32 @@ dm_simplecmd (int task, const char *name, int flags, uint16_t udev_flags) {
 	if (flags & DMFL_DEFERRED)
 		dm_task_deferred_remove(dmt);
 #endif
-	if (udev_wait_flag &&
-	    !dm_task_set_cookie(dmt, &cookie,
-				DM_UDEV_DISABLE_LIBRARY_FALLBACK | udev_flags))
-		return 0;
+	if (udev_wait_flag) {
+		if (!batch_cookie)
+			pcookie = udev_task_cookie(&cookie);
+		if (!dm_task_set_cookie(dmt, pcookie,
+					DM_UDEV_DISABLE_LIBRARY_FALLBACK |
+					udev_flags))
+			return 0;
+	}
 
 	r = libmp_dm_task_run (dmt);
 	if (!r)
 		dm_log_error(2, task, dmt);
 
-	if (udev_wait_flag)
+	if (udev_wait_flag && pcookie == &cookie)
 			libmp_udev_wait(cookie);
+	observe_dm_op(task == DM_DEVICE_SUSPEND ? "suspend" :
+		      task == DM_DEVICE_RESUME ? "resume" :
+		      task == DM_DEVICE_REMOVE ? "remove" : "other", &start);
 	return r;
 }
 
+static int
+dm_simplecmd (int task, const char *name, int flags, uint16_t udev_flags) {
+	return dm_simplecmd__(task, name, flags, udev_flags, NULL);
+}
+
 int dm_simplecmd_flush (int task, const char *name, uint16_t udev_flags)
 {
 	return dm_simplecmd(task, name, DMFL_NEED_SYNC, udev_flags);
@@ -451,6 +545,11 @@ dm_device_remove (const char *name, int flags) {
 	return dm_simplecmd(DM_DEVICE_REMOVE, name, flags, 0);
 }
 
+static int
+dm_device_remove_batch (const char *name, int flags, uint32_t *cookie) {
+	return dm_simplecmd__(DM_DEVICE_REMOVE, name, flags, 0, cookie);
+}
+
 static int
 dm_addmap (int task, const char *target, struct multipath *mpp,
 	   char * params, int ro, uint16_t udev_flags) {
@@ -459,6 +558,7 @@ dm_addmap (int task, const char *target, struct multipath *mpp,
 	char __attribute__((cleanup(cleanup_charp))) *prefixed_uuid = NULL;
 
 	uint32_t cookie = 0;
+	uint32_t *pcookie = &cookie;
 
 	if (task == DM_DEVICE_CREATE && strlen(mpp->wwid) == 0) {
 		condlog(1, "%s: refusing to create map with empty WWID",
@@ -469,6 +569,7 @@ dm_addmap (int task, const char *target, struct multipath *mpp,
 	/* Need to add this here to allow 0 to be passed in udev_flags */
 	udev_flags |= DM_UDEV_DISABLE_LIBRARY_FALLBACK;
 
+	dm_sync_map_callback(mpp->alias);
 	if (!(dmt = libmp_dm_task_create (task)))
 		return 0;
 
@@ -509,15 +610,17 @@ dm_addmap (int task, const char *target, struct multipath *mpp,
 		task == DM_DEVICE_RELOAD ? "reload" : "addmap", mpp->size,
 		target, params);
 
-	if (task == DM_DEVICE_CREATE &&
-	    !dm_task_set_cookie(dmt, &cookie, udev_flags))
-		return 0;
+	if (task == DM_DEVICE_CREATE) {
+		pcookie = udev_task_cookie(&cookie);
+		if (!dm_task_set_cookie(dmt, pcookie, udev_flags))
+			return 0;
+	}
 
 	r = libmp_dm_task_run (dmt);
 	if (!r)
 		dm_log_error(2, task, dmt);
 
-	if (task == DM_DEVICE_CREATE)
+	if (task == DM_DEVICE_CREATE && pcookie == &cookie)
 		libmp_udev_wait(cookie);
 
 	if (r)
@@ -575,7 +678,7 @@ int dm_addmap_create (struct multipath *mpp, char *params)
 #define ADDMAP_RW 0
 #define ADDMAP_RO 1
 
-int dm_addmap_reload(struct multipath *mpp, char *params, int flush)
+static int addmap_reload(struct multipath *mpp, char *params, int flush)
 {
 	int r = 0;
 	uint16_t udev_flags = build_udev_flags(mpp, 1);
@@ -599,8 +702,14 @@ int dm_addmap_reload(struct multipath *mpp, char *params, int flush)
 		r = dm_simplecmd(DM_DEVICE_RESUME, mpp->alias,
 				 DMFL_NEED_SYNC | (flush ? 0 : DMFL_NO_FLUSH),
 				 udev_flags);
-	if (r)
+	if (r) {
+		metric_inc(MP_METRIC_DM_RELOADS, NULL);
+		history_map(HIST_MAP_RELOAD, mpp->alias, 0,
+			    mpp->reload_reason ? mpp->reload_reason :
+			    flush ? "size change" : NULL);
+		mpp->reload_reason = NULL;
 		return r;
+	}
 
 	/* If the resume failed, dm will leave the device suspended, and
 	 * drop the new table, so doing a second resume will try using
@@ -612,6 +721,19 @@ int dm_addmap_reload(struct multipath *mpp, char *params, int flush)
 	return 0;
 }
 
+int dm_addmap_reload(struct multipath *mpp, char *params, int flush)
+{
+	struct timespec start;
+	int r;
+
+	TRACE_PROBE(map_reload_start, mpp->alias, mpp->reload_reason, flush);
+	get_monotonic_time(&start);
+	r = addmap_reload(mpp, params, flush);
+	observe_dm_op("reload", &start);
+	TRACE_PROBE(map_reload_done, mpp->alias, r);
+	return r;
+}
+
 static bool is_mpath_uuid(const char uuid[DM_UUID_LEN])
 {
 	return !strncmp(uuid, UUID_PREFIX, UUID_PREFIX_LEN);
@@ -984,84 +1106,190 @@ int mpath_in_use(const char *name)
 	return 0;
 }
 
-int dm_flush_map__ (const char *mapname, int flags, int retries)
+/*
+ * State of a map in dm_flush_map_list(). The maps of a batch are
+ * removed together, and one udev cookie covers all their removals,
+ * including their partition maps. Retries share the same sleep.
+ */
+struct flush_state {
+	const char *name;
+	int flags;
+	int udev_flags;
+	int queue_if_no_path;
+	int retries;
+	int removed;
+	int result;
+	bool done;
+};
+
+static bool flush_done(struct flush_state *fs, int result)
+{
+	fs->result = result;
+	fs->done = true;
+	return false;
+}
+
+/*
+ * Checks whether the map can be removed, and removes its partitions.
+ * Returns true if the map itself must be removed.
+ */
+static bool flush_prepare(struct flush_state *fs, uint32_t *cookie)
 {
 	int r;
-	int queue_if_no_path = 0;
-	int udev_flags = 0;
 	char *params __attribute__((cleanup(cleanup_charp))) = NULL;
 
 	r = libmp_mapinfo(DM_MAP_BY_NAME | MAPINFO_MPATH_ONLY | MAPINFO_CHECK_UUID,
-			  (mapid_t) { .str = mapname },
+			  (mapid_t) { .str = fs->name },
 			  (mapinfo_t) { .target = &params });
 	if (r != DMP_OK && r != DMP_EMPTY)
-		return DM_FLUSH_OK; /* nothing to do */
+		return flush_done(fs, DM_FLUSH_OK); /* nothing to do */
 
 	/* device mapper will not let you resume an empty device */
 	if (r == DMP_EMPTY)
-		flags &= ~DMFL_SUSPEND;
+		fs->flags &= ~DMFL_SUSPEND;
 
 	/* if the device currently has no partitions, do not
 	   run kpartx on it if you fail to delete it */
-	if (do_foreach_partmaps(mapname, has_partmap, NULL) == 0)
-		udev_flags |= MPATH_UDEV_NO_KPARTX_FLAG;
+	if (do_foreach_partmaps(fs->name, has_partmap, NULL) == 0)
+		fs->udev_flags |= MPATH_UDEV_NO_KPARTX_FLAG;
 
 	/* If you aren't doing a deferred remove, make sure that no
 	 * devices are in use */
-	if (!(flags & DMFL_DEFERRED) && mpath_in_use(mapname))
-			return DM_FLUSH_BUSY;
+	if (!(fs->flags & DMFL_DEFERRED) && mpath_in_use(fs->name))
+		return flush_done(fs, DM_FLUSH_BUSY);
 
-	if ((flags & DMFL_SUSPEND) &&
+	if ((fs->flags & DMFL_SUSPEND) &&
 	    strstr(params, "queue_if_no_path")) {
-		if (!_dm_queue_if_no_path(mapname, 0))
-			queue_if_no_path = 1;
+		if (!_dm_queue_if_no_path(fs->name, 0))
+			fs->queue_if_no_path = 1;
 		else
 			/* Leave queue_if_no_path alone if unset failed */
-			queue_if_no_path = -1;
+			fs->queue_if_no_path = -1;
 	}
 
-	if ((r = dm_remove_partmaps(mapname, flags)))
-		return r;
+	if ((r = dm_remove_partmaps(fs->name, fs->flags, cookie)))
+		return flush_done(fs, r);
 
-	if (!(flags & DMFL_DEFERRED) && dm_get_opencount(mapname)) {
-		condlog(2, "%s: map in use", mapname);
-		return DM_FLUSH_BUSY;
+	if (!(fs->flags & DMFL_DEFERRED) && dm_get_opencount(fs->name)) {
+		condlog(2, "%s: map in use", fs->name);
+		return flush_done(fs, DM_FLUSH_BUSY);
 	}
+	return true;
+}
 
-	do {
-		if ((flags & DMFL_SUSPEND) && queue_if_no_path != -1)
-			dm_simplecmd_flush(DM_DEVICE_SUSPEND, mapname, 0);
+static void flush_remove(struct flush_state *fs, uint32_t *cookie)
+{
+	if ((fs->flags & DMFL_SUSPEND) && fs->queue_if_no_path != -1)
+		dm_simplecmd_flush(DM_DEVICE_SUSPEND, fs->name, 0);
 
-		r = dm_device_remove(mapname, flags);
+	fs->removed = dm_device_remove_batch(fs->name, fs->flags, cookie);
+}
 
-		if (r) {
-			if ((flags & DMFL_DEFERRED) && dm_map_present(mapname)) {
-				condlog(4, "multipath map %s remove deferred",
-					mapname);
-				return DM_FLUSH_DEFERRED;
-			}
-			condlog(4, "multipath map %s removed", mapname);
-			return DM_FLUSH_OK;
-		} else if (dm_is_mpath(mapname) != DM_IS_MPATH_YES) {
-			condlog(4, "multipath map %s removed externally",
-				mapname);
-			return DM_FLUSH_OK; /* raced. someone else removed it */
-		} else {
-			condlog(2, "failed to remove multipath map %s",
-				mapname);
-			if ((flags & DMFL_SUSPEND) && queue_if_no_path != -1) {
-				dm_simplecmd_noflush(DM_DEVICE_RESUME,
-						     mapname, udev_flags);
-			}
+/* Called after udev has processed the removal */
+static void flush_check(struct flush_state *fs)
+{
+	if (fs->removed) {
+		if ((fs->flags & DMFL_DEFERRED) && dm_map_present(fs->name)) {
+			condlog(4, "multipath map %s remove deferred",
+				fs->name);
+			flush_done(fs, DM_FLUSH_DEFERRED);
+			return;
 		}
-		if (retries)
-			sleep(1);
-	} while (retries-- > 0);
+		condlog(4, "multipath map %s removed", fs->name);
+		flush_done(fs, DM_FLUSH_OK);
+		return;
+	} else if (dm_is_mpath(fs->name) != DM_IS_MPATH_YES) {
+		condlog(4, "multipath map %s removed externally", fs->name);
+		flush_done(fs, DM_FLUSH_OK); /* raced. someone else removed it */
+		return;
+	}
+
+	condlog(2, "failed to remove multipath map %s", fs->name);
+	if ((fs->flags & DMFL_SUSPEND) && fs->queue_if_no_path != -1)
+		dm_simplecmd_noflush(DM_DEVICE_RESUME, fs->name, fs->udev_flags);
+
+	if (fs->retries-- > 0)
+		return;
+
+	if (fs->queue_if_no_path == 1 && _dm_queue_if_no_path(fs->name, 1) != 0)
+		flush_done(fs, DM_FLUSH_FAIL_CANT_RESTORE);
+	else
+		flush_done(fs, DM_FLUSH_FAIL);
+}
+
+static void flush_batch(struct flush_state *fs, int n)
+{
+	uint32_t cookie = 0;
+	bool pending;
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (flush_prepare(&fs[i], &cookie))
+			flush_remove(&fs[i], &cookie);
+
+	while (1) {
+		if (cookie)
+			libmp_udev_wait(cookie);
+
+		pending = false;
+		for (i = 0; i < n; i++) {
+			if (fs[i].done)
+				continue;
+			flush_check(&fs[i]);
+			if (!fs[i].done)
+				pending = true;
+		}
+		if (!pending)
+			break;
+
+		sleep(1);
+		cookie = 0;
+		for (i = 0; i < n; i++)
+			if (!fs[i].done)
+				flush_remove(&fs[i], &cookie);
+	}
+}
 
-	if (queue_if_no_path == 1 && _dm_queue_if_no_path(mapname, 1) != 0)
-		return DM_FLUSH_FAIL_CANT_RESTORE;
+static int combine_flush_results(int r, int ret)
+{
+	if (ret == DM_FLUSH_FAIL ||
+	    (r != DM_FLUSH_FAIL && ret == DM_FLUSH_BUSY))
+		return ret;
+	return r;
+}
+
+int dm_flush_map_list(const char * const *names, int n, int flags,
+		      int retries, int *results)
+{
+	struct flush_state fs[DM_FLUSH_BATCH];
+	int i, k, len, r = DM_FLUSH_OK;
 
-	return DM_FLUSH_FAIL;
+	for (i = 0; i < n; i += len) {
+		len = n - i < DM_FLUSH_BATCH ? n - i : DM_FLUSH_BATCH;
+		for (k = 0; k < len; k++)
+			fs[k] = (struct flush_state) {
+				.name = names[i + k],
+				.flags = flags,
+				.retries = retries,
+			};
+
+		flush_batch(fs, len);
+
+		for (k = 0; k < len; k++) {
+			if (results)
+				results[i + k] = fs[k].result;
+			r = combine_flush_results(r, fs[k].result);
+		}
+	}
+	return r;
+}
+
+int dm_flush_map__ (const char *mapname, int flags, int retries)
+{
+	int r;
+
+	dm_flush_map_list(&mapname, 1, flags, retries, &r);
+	return r;
 }
 
 int
@@ -1082,7 +1310,9 @@ int dm_flush_maps(int retries)
 	int r = DM_FLUSH_FAIL;
 	struct dm_task __attribute__((cleanup(cleanup_dm_task))) *dmt = NULL;
 	struct dm_names *names;
+	const char *batch[DM_FLUSH_BATCH];
 	unsigned next = 0;
+	int n = 0;
 
 	if (!(dmt = libmp_dm_task_create (DM_DEVICE_LIST)))
 		return r;
@@ -1100,15 +1330,20 @@ int dm_flush_maps(int retries)
 		return r;
 
 	do {
-		int ret;
-		ret = dm_suspend_and_flush_map(names->name, retries);
-		if (ret == DM_FLUSH_FAIL ||
-		    (r != DM_FLUSH_FAIL && ret == DM_FLUSH_BUSY))
-			r = ret;
+		batch[n++] = names->name;
+		if (n == DM_FLUSH_BATCH) {
+			r = combine_flush_results(r, dm_flush_map_list(
+				batch, n, DMFL_NEED_SYNC|DMFL_SUSPEND,
+				retries, NULL));
+			n = 0;
+		}
 		next = names->next;
 		names = (void *) names + next;
 	} while (next);
 
+	if (n > 0)
+		r = combine_flush_results(r, dm_flush_map_list(
+			batch, n, DMFL_NEED_SYNC|DMFL_SUSPEND, retries, NULL));
 	return r;
 }
 
@@ -1116,7 +1351,11 @@ int
 dm_message(const char * mapname, char * message)
 {
 	struct dm_task __attribute__((cleanup(cleanup_dm_task))) *dmt = NULL;
+	struct timespec start;
+	char op[24];
+	int r;
 
+	dm_sync_map_callback(mapname);
 	if (!(dmt = libmp_dm_task_create(DM_DEVICE_TARGET_MSG)))
 		return 1;
 
@@ -1129,7 +1368,13 @@ dm_message(const char * mapname, char * message)
 	if (!dm_task_set_message(dmt, message))
 		goto out;
 
-	if (!libmp_dm_task_run(dmt)) {
+	get_monotonic_time(&start);
+	r = libmp_dm_task_run(dmt);
+	/* the first word of the message is the operation */
+	strlcpy(op, message, sizeof(op));
+	op[strcspn(op, " ")] = '\0';
+	observe_dm_op(op, &start);
+	if (!r) {
 		dm_log_error(2, DM_DEVICE_TARGET_MSG, dmt);
 		goto out;
 	}
@@ -1181,6 +1426,7 @@ int dm_queue_if_no_path(struct multipath *mpp, int enable)
 	static const char no_path_retry[] = "queue_if_no_path";
 
 	if ((r = _dm_queue_if_no_path(mpp->alias, enable)) == 0) {
+		history_map(HIST_QUEUEING, mpp->alias, enable, NULL);
 		if (enable)
 			add_feature(&mpp->features, no_path_retry);
 		else
@@ -1203,7 +1449,13 @@ dm_groupmsg (const char * msg, const char * mapname, int index)
 int
 dm_switchgroup(const char * mapname, int index)
 {
-	return dm_groupmsg("switch", mapname, index);
+	int r = dm_groupmsg("switch", mapname, index);
+
+	if (r == 0) {
+		metric_inc(MP_METRIC_PG_SWITCHES, NULL);
+		history_map(HIST_PG_SWITCH, mapname, index, NULL);
+	}
+	return r;
 }
 
 int
@@ -1358,6 +1610,73 @@ is_valid_partmap(const char *name, const char *map_dev_t,
 		!isdigit(*(p + strlen(map_dev_t))));
 }
 
+/*
+ * Partition maps are linear maps on top of the multipath map, thus
+ * they show up in its holders directory in sysfs. Scanning the holders
+ * costs O(partitions) instead of O(maps) ioctls for listing and
+ * checking every map on the system.
+ */
+static int select_dm_holders(const struct dirent *di)
+{
+	return fnmatch("dm-*", di->d_name, FNM_FILE_NAME) == 0;
+}
+
+static int read_holder_name(const char *holder, char *name, size_t len)
+{
+	char path[PATH_MAX];
+	ssize_t n;
+	int fd;
+
+	if (safe_sprintf(path, "/sys/block/%s/dm/name", holder))
+		return -1;
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	n = read(fd, name, len - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	name[n] = '\0';
+	strchop(name);
+	return *name ? 0 : -1;
+}
+
+/*
+ * Returns -1 if the holders directory can't be read. Partition maps
+ * without a table don't hold the multipath map, and are missed here.
+ */
+static int
+foreach_partmap_holder(const char *dev_t, const char *map_uuid, int minor,
+		       int (*partmap_func)(const char *, void *), void *data)
+{
+	char path[PATH_MAX];
+	char name[WWID_SIZE];
+	struct scandir_result sr;
+	struct dirent **di;
+	int i, n, r = 0;
+
+	if (safe_sprintf(path, "/sys/block/dm-%d/holders", minor))
+		return -1;
+	n = scandir(path, &di, select_dm_holders, alphasort);
+	if (n < 0)
+		return -1;
+
+	sr.di = di;
+	sr.n = n;
+	pthread_cleanup_push_cast(free_scandir_result, &sr);
+	for (i = 0; i < n; i++) {
+		if (read_holder_name(di[i]->d_name, name, sizeof(name)) != 0)
+			continue;
+		if (is_valid_partmap(name, dev_t, map_uuid) &&
+		    partmap_func(name, data) != 0) {
+			r = 1;
+			break;
+		}
+	}
+	pthread_cleanup_pop(1);
+	return r;
+}
+
 static int
 do_foreach_partmaps (const char *mapname,
 		     int (*partmap_func)(const char *, void *),
@@ -1369,6 +1688,7 @@ do_foreach_partmaps (const char *mapname,
 	char dev_t[BLK_DEV_SIZE];
 	char map_uuid[DM_UUID_LEN];
 	struct dm_info info;
+	int r;
 
 	if (libmp_mapinfo(DM_MAP_BY_NAME | MAPINFO_CHECK_UUID,
 			  (mapid_t) { .str = mapname },
@@ -1378,6 +1698,12 @@ do_foreach_partmaps (const char *mapname,
 	if (safe_sprintf(dev_t, "%i:%i", info.major, info.minor))
 		return 1;
 
+	r = foreach_partmap_holder(dev_t, map_uuid, info.minor,
+				   partmap_func, data);
+	if (r >= 0)
+		return r;
+	condlog(4, "%s: can't read holders, scanning all maps", mapname);
+
 	if (!(dmt = libmp_dm_task_create(DM_DEVICE_LIST)))
 		return 1;
 
@@ -1405,6 +1731,7 @@ do_foreach_partmaps (const char *mapname,
 
 struct remove_data {
 	int flags;
+	uint32_t *cookie;
 };
 
 static int
@@ -1417,14 +1744,14 @@ remove_partmap(const char *name, void *data)
 		return DM_FLUSH_BUSY;
 	}
 	condlog(3, "partition map %s removed", name);
-	dm_device_remove(name, rd->flags);
+	dm_device_remove_batch(name, rd->flags, rd->cookie);
 	return DM_FLUSH_OK;
 }
 
 static int
-dm_remove_partmaps (const char * mapname, int flags)
+dm_remove_partmaps (const char * mapname, int flags, uint32_t *cookie)
 {
-	struct remove_data rd = { flags };
+	struct remove_data rd = { flags, cookie };
 	return do_foreach_partmaps(mapname, remove_partmap, &rd);
 }
 
@@ -1499,6 +1826,8 @@ dm_rename__(const char *old, char *new, int skip_kpartx)
 	uint32_t cookie = 0;
 	uint16_t udev_flags = DM_UDEV_DISABLE_LIBRARY_FALLBACK | ((skip_kpartx == SKIP_KPARTX_ON)? MPATH_UDEV_NO_KPARTX_FLAG : 0);
 
+	dm_sync_map_callback(old);
+
 	if (!(dmt = libmp_dm_task_create(DM_DEVICE_RENAME)))
 		return r;
 
@@ -149,6 +149,18 @@ int dm_addmap_create (struct multipath *mpp, char *params);
 int dm_addmap_reload (struct multipath *mpp, char *params, int flush);
 int dm_find_map_by_wwid(const char *wwid, char *name, struct dm_info *dmi);
 
+/*
+ * Batched udev synchronization for map creations and resumes. Between
+ * dm_udev_batch_open() and dm_udev_batch_close(), DM operations don't
+ * wait for udev; dm_udev_batch_wait() waits for all of them at once.
+ * Not thread-safe.
+ */
+#define DM_UDEV_BATCH_MAX 256
+void dm_udev_batch_open(void);
+unsigned int dm_udev_batch_size(void);
+void dm_udev_batch_wait(void);
+void dm_udev_batch_close(void);
+
 enum {
 	DM_IS_MPATH_NO,
 	DM_IS_MPATH_YES,
@@ -175,13 +187,23 @@ enum {
 	DMFL_NO_FLUSH  = 1 << 3,
 };
 
+/*
+ * Maximum number of maps that dm_flush_map_list() removes at once.
+ * udev processes the removals of a batch in parallel, and one cookie
+ * wait covers all of them.
+ */
+#define DM_FLUSH_BATCH 32
+
 int dm_flush_map__ (const char *mapname, int flags, int retries);
+int dm_flush_map_list(const char * const *names, int n, int flags,
+		      int retries, int *results);
 #define dm_flush_map(mapname) dm_flush_map__(mapname, DMFL_NEED_SYNC, 0)
 #define dm_suspend_and_flush_map(mapname, retries) \
 	dm_flush_map__(mapname, DMFL_NEED_SYNC|DMFL_SUSPEND, retries)
 int dm_flush_map_nopaths(const char * mapname, int deferred_remove);
 int dm_cancel_deferred_remove(struct multipath *mpp);
 int dm_flush_maps (int retries);
+void dm_sync_map_callback(const char *mapname);
 int dm_fail_path(const char * mapname, char * path);
 int dm_reinstate_path(const char * mapname, char * path);
 int dm_queue_if_no_path(struct multipath *mpp, int enable);
@@ -20,6 +20,7 @@
 #include "checkers.h"
 #include "vector.h"
 #include "util.h"
+#include "strpool.h"
 #include "structs.h"
 #include "config.h"
 #include "blacklist.h"
@@ -178,7 +179,7 @@ path_discovery (vector pathvec, int flag)
 	struct udev_list_entry *entry;
 	struct udev_device *udevice = NULL;
 	struct config *conf;
-	int num_paths = 0, total_paths = 0, ret;
+	int num_paths = 0, total_paths = 0, n_devs = 0, ret;
 
 	pthread_cleanup_push(cleanup_udev_enumerate_ptr, &udev_iter);
 	pthread_cleanup_push(cleanup_udev_device_ptr, &udevice);
@@ -199,6 +200,15 @@ path_discovery (vector pathvec, int flag)
 		goto out;
 	}
 
+	/*
+	 * Most block devices are paths on big SAN setups. Reserving room
+	 * for all of them up front avoids growing pathvec while we go.
+	 */
+	udev_list_entry_foreach(entry,
+				udev_enumerate_get_list_entry(udev_iter))
+		n_devs++;
+	vector_reserve(pathvec, VECTOR_SIZE(pathvec) + n_devs);
+
 	udev_list_entry_foreach(entry,
 				udev_enumerate_get_list_entry(udev_iter)) {
 		const char *devtype;
@@ -1556,6 +1566,8 @@ scsi_sysfs_pathinfo (struct path *pp, const struct vector_s *hwtable)
 	struct udev_device *parent;
 	const char *attr_path = NULL;
 	static const char unknown[] = "UNKNOWN";
+	char vendor[SCSI_VENDOR_SIZE], product[PATH_PRODUCT_SIZE];
+	char rev[PATH_REV_SIZE], node[NODE_NAME_SIZE] = "";
 
 	parent = udev_device_get_parent_with_subsystem_devtype(pp->udev, "scsi",
 							       "scsi_device");
@@ -1569,22 +1581,25 @@ scsi_sysfs_pathinfo (struct path *pp, const struct vector_s *hwtable)
 		   &pp->sg_id.channel, &pp->sg_id.scsi_id, &pp->sg_id.lun) != 4)
 		return PATHINFO_FAILED;
 
-	if (sysfs_get_vendor(parent, pp->vendor_id, SCSI_VENDOR_SIZE) <= 0) {
+	if (sysfs_get_vendor(parent, vendor, SCSI_VENDOR_SIZE) <= 0) {
 		condlog(1, "%s: broken device without vendor ID", pp->dev);
-		strlcpy(pp->vendor_id, unknown, SCSI_VENDOR_SIZE);
+		strlcpy(vendor, unknown, SCSI_VENDOR_SIZE);
 	}
+	set_interned_str(&pp->vendor_id, vendor);
 	condlog(3, "%s: vendor = %s", pp->dev, pp->vendor_id);
 
-	if (sysfs_get_model(parent, pp->product_id, PATH_PRODUCT_SIZE) <= 0) {
+	if (sysfs_get_model(parent, product, PATH_PRODUCT_SIZE) <= 0) {
 		condlog(1, "%s: broken device without product ID", pp->dev);
-		strlcpy(pp->product_id, unknown, PATH_PRODUCT_SIZE);
+		strlcpy(product, unknown, PATH_PRODUCT_SIZE);
 	}
+	set_interned_str(&pp->product_id, product);
 	condlog(3, "%s: product = %s", pp->dev, pp->product_id);
 
-	if (sysfs_get_rev(parent, pp->rev, PATH_REV_SIZE) < 0) {
+	if (sysfs_get_rev(parent, rev, PATH_REV_SIZE) < 0) {
 		condlog(2, "%s: broken device without revision", pp->dev);
-		strlcpy(pp->rev, unknown, PATH_REV_SIZE);
+		strlcpy(rev, unknown, PATH_REV_SIZE);
 	}
+	set_interned_str(&pp->rev, rev);
 	condlog(3, "%s: rev = %s", pp->dev, pp->rev);
 
 	/*
@@ -1605,8 +1620,9 @@ scsi_sysfs_pathinfo (struct path *pp, const struct vector_s *hwtable)
 	/*
 	 * target node name
 	 */
-	if(sysfs_get_tgt_nodename(pp, pp->tgt_node_name))
+	if(sysfs_get_tgt_nodename(pp, node))
 		return PATHINFO_FAILED;
+	set_interned_str(&pp->tgt_node_name, node);
 
 	condlog(3, "%s: tgt_node_name = %s",
 		pp->dev, pp->tgt_node_name);
@@ -1623,6 +1639,7 @@ nvme_sysfs_pathinfo (struct path *pp, const struct vector_s *hwtable)
 	struct udev_device *parent;
 	const char *attr_path = NULL;
 	const char *attr;
+	char product[PATH_PRODUCT_SIZE], rev[PATH_REV_SIZE];
 	int i;
 
 	if (pp->udev)
@@ -1658,13 +1675,15 @@ nvme_sysfs_pathinfo (struct path *pp, const struct vector_s *hwtable)
 		}
 	}
 
-	snprintf(pp->vendor_id, SCSI_VENDOR_SIZE, "NVME");
-	snprintf(pp->product_id, PATH_PRODUCT_SIZE, "%s",
+	set_interned_str(&pp->vendor_id, "NVME");
+	snprintf(product, PATH_PRODUCT_SIZE, "%s",
 		 udev_device_get_sysattr_value(parent, "model"));
+	set_interned_str(&pp->product_id, product);
 	snprintf(pp->serial, SERIAL_SIZE, "%s",
 		 udev_device_get_sysattr_value(parent, "serial"));
-	snprintf(pp->rev, PATH_REV_SIZE, "%s",
+	snprintf(rev, PATH_REV_SIZE, "%s",
 		 udev_device_get_sysattr_value(parent, "firmware_rev"));
+	set_interned_str(&pp->rev, rev);
 
 	condlog(3, "%s: vendor = %s", pp->dev, pp->vendor_id);
 	condlog(3, "%s: product = %s", pp->dev, pp->product_id);
@@ -1694,7 +1713,7 @@ ccw_sysfs_pathinfo (struct path *pp, const struct vector_s *hwtable)
 		return PATHINFO_FAILED;
 
 	// Identified as IBM, but any other PAV array vendor is also supported
-	sprintf(pp->vendor_id, "IBM");
+	set_interned_str(&pp->vendor_id, "IBM");
 
 	condlog(3, "%s: vendor = %s", pp->dev, pp->vendor_id);
 
@@ -1702,11 +1721,11 @@ ccw_sysfs_pathinfo (struct path *pp, const struct vector_s *hwtable)
 		return PATHINFO_FAILED;
 
 	if (!strncmp(attr_buff, "3370", 4)) {
-		sprintf(pp->product_id,"S/390 DASD FBA");
+		set_interned_str(&pp->product_id, "S/390 DASD FBA");
 	} else if (!strncmp(attr_buff, "9336", 4)) {
-		sprintf(pp->product_id,"S/390 DASD FBA");
+		set_interned_str(&pp->product_id, "S/390 DASD FBA");
 	} else {
-		sprintf(pp->product_id,"S/390 DASD ECKD");
+		set_interned_str(&pp->product_id, "S/390 DASD ECKD");
 	}
 
 	condlog(3, "%s: product = %s", pp->dev, pp->product_id);
@@ -1743,6 +1762,8 @@ cciss_sysfs_pathinfo (struct path *pp, const struct vector_s *hwtable)
 {
 	const char * attr_path = NULL;
 	struct udev_device *parent;
+	char vendor[SCSI_VENDOR_SIZE], product[PATH_PRODUCT_SIZE];
+	char rev[PATH_REV_SIZE];
 
 	parent = pp->udev;
 	while (parent) {
@@ -1761,18 +1782,21 @@ cciss_sysfs_pathinfo (struct path *pp, const struct vector_s *hwtable)
 	if (!attr_path || pp->sg_id.host_no == -1)
 		return PATHINFO_FAILED;
 
-	if (sysfs_get_vendor(parent, pp->vendor_id, SCSI_VENDOR_SIZE) <= 0)
+	if (sysfs_get_vendor(parent, vendor, SCSI_VENDOR_SIZE) <= 0)
 		return PATHINFO_FAILED;
+	set_interned_str(&pp->vendor_id, vendor);
 
 	condlog(3, "%s: vendor = %s", pp->dev, pp->vendor_id);
 
-	if (sysfs_get_model(parent, pp->product_id, PATH_PRODUCT_SIZE) <= 0)
+	if (sysfs_get_model(parent, product, PATH_PRODUCT_SIZE) <= 0)
 		return PATHINFO_FAILED;
+	set_interned_str(&pp->product_id, product);
 
 	condlog(3, "%s: product = %s", pp->dev, pp->product_id);
 
-	if (sysfs_get_rev(parent, pp->rev, PATH_REV_SIZE) <= 0)
+	if (sysfs_get_rev(parent, rev, PATH_REV_SIZE) <= 0)
 		return PATHINFO_FAILED;
+	set_interned_str(&pp->rev, rev);
 
 	condlog(3, "%s: rev = %s", pp->dev, pp->rev);
 
@@ -1824,6 +1848,12 @@ common_sysfs_pathinfo (struct path * pp)
 	return PATHINFO_OK;
 }
 
+static void clear_sysfs_state_path(struct path *pp)
+{
+	free(pp->sysfs_state_path);
+	pp->sysfs_state_path = NULL;
+}
+
 int
 path_sysfs_state(struct path * pp)
 {
@@ -1843,6 +1873,20 @@ path_sysfs_state(struct path * pp)
 		goto out;
 	}
 
+	memset(buff, 0x0, SCSI_STATE_SIZE);
+	/*
+	 * This is called for every path in every checker tick. Once we know
+	 * where the state attribute lives, read it directly rather than
+	 * walking the udev device hierarchy under the libudev lock again.
+	 */
+	if (pp->sysfs_state_path) {
+		err = sysfs_file_get_value(pp->sysfs_state_path, buff,
+					   sizeof(buff));
+		if (err != -ENOENT)
+			goto check;
+		clear_sysfs_state_path(pp);
+	}
+
 	parent = pp->udev;
 	while (parent) {
 		const char *subsys = udev_device_get_subsystem(parent);
@@ -1857,8 +1901,12 @@ path_sysfs_state(struct path * pp)
 		goto out;
 	}
 
-	memset(buff, 0x0, SCSI_STATE_SIZE);
 	err = sysfs_attr_get_value(parent, "state", buff, sizeof(buff));
+	if (sysfs_attr_value_ok(err, sizeof(buff)) &&
+	    asprintf(&pp->sysfs_state_path, "%s/state",
+		     udev_device_get_syspath(parent)) < 0)
+		pp->sysfs_state_path = NULL;
+check:
 	if (!sysfs_attr_value_ok(err, sizeof(buff))) {
 		if (err == -ENXIO)
 			pp->sysfs_state = PATH_REMOVED;
@@ -1910,6 +1958,8 @@ sysfs_pathinfo(struct path *pp, const struct vector_s *hwtable)
 	if (r != PATHINFO_OK)
 		return r;
 
+	/* pp->udev may have changed, look up the state attribute again */
+	clear_sysfs_state_path(pp);
 	pp->bus = SYSFS_BUS_UNDEF;
 	if (!strncmp(pp->dev,"cciss",5))
 		pp->bus = SYSFS_BUS_CCISS;
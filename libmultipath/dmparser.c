@@ -3,6 +3,7 @@
  * Copyright (c) 2005 Stefan Bader, IBM
  * Copyright (c) 2005 Edward Goggin, EMC
  */
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,29 +17,102 @@
 #include "dmparser.h"
 #include "strbuf.h"
 
-#define WORD_SIZE 64
+/*
+ * Table and status strings are tokenized in place: a word is a pointer
+ * into the string and a length, nothing is copied or allocated.
+ */
+struct dm_word {
+	const char *s;
+	int len;
+};
 
-static int
-merge_words(char **dst, const char *word)
+/* Get the next word at *pp and advance *pp. Returns false at the end. */
+static bool next_word(const char **pp, struct dm_word *w)
 {
-	char * p = *dst;
-	int len, dstlen;
-
-	dstlen = strlen(*dst);
-	len = dstlen + strlen(word) + 2;
-	*dst = realloc(*dst, len);
+	const char *p = *pp;
+
+	while (*p == ' ')
+		p++;
+	w->s = p;
+	while (*p != ' ' && *p != '\0')
+		p++;
+	w->len = p - w->s;
+	*pp = p;
+	return w->len > 0;
+}
 
-	if (!*dst) {
-		free(p);
-		return 1;
+/* Like atoi(), the number ends at the first non-digit */
+static bool next_int(const char **pp, int *val)
+{
+	struct dm_word w;
+	int i = 0, v = 0;
+	bool neg = false;
+
+	if (!next_word(pp, &w))
+		return false;
+	if (w.s[0] == '-') {
+		neg = true;
+		i++;
 	}
+	for (; i < w.len && w.s[i] >= '0' && w.s[i] <= '9'; i++)
+		v = 10 * v + (w.s[i] - '0');
+	*val = neg ? -v : v;
+	return true;
+}
 
-	p = *dst + dstlen;
-	*p = ' ';
-	++p;
-	strncpy(p, word, len - dstlen - 1);
+static void skip_words(const char **pp, int n)
+{
+	struct dm_word w;
 
-	return 0;
+	while (n-- > 0 && next_word(pp, &w))
+		;
+}
+
+static bool word_equal(const struct dm_word *w, const char *str)
+{
+	return str && !strncmp(w->s, str, w->len) && str[w->len] == '\0';
+}
+
+static const char *skip_spaces(const char *p)
+{
+	while (*p == ' ')
+		p++;
+	return p;
+}
+
+/*
+ * Get a count followed by as many words, e.g. the features
+ * "2 queue_if_no_path pg_init_retries 50", as one span of the string.
+ */
+static bool next_counted_span(const char **pp, struct dm_word *span)
+{
+	int n;
+
+	*pp = skip_spaces(*pp);
+	span->s = *pp;
+	if (!next_int(pp, &n))
+		return false;
+	skip_words(pp, n);
+	span->len = *pp - span->s;
+	return true;
+}
+
+/* Get the path selector and its argument count, e.g. "round-robin 0" */
+static bool next_selector(const char **pp, struct dm_word *span, int *nargs)
+{
+	struct dm_word w;
+
+	*pp = skip_spaces(*pp);
+	span->s = *pp;
+	if (!next_word(pp, &w) || !next_int(pp, nargs))
+		return false;
+	span->len = *pp - span->s;
+	return true;
+}
+
+static char *dup_word(const struct dm_word *w)
+{
+	return strndup(w->s, w->len);
 }
 
 /*
@@ -106,6 +180,63 @@ err:
 	return 1;
 }
 
+/*
+ * Check if the table @params describes the path groups that are already
+ * in @mpp, with the same features, hardware handler and path selector.
+ * This is the common case when the map is resynced with the kernel, and
+ * it saves rebuilding the path groups. Only pp->pgindex, mpp->nextpg
+ * and mpp->minio are set here.
+ */
+static bool map_matches_pg(const char *params, struct multipath *mpp)
+{
+	const char *p = params;
+	struct dm_word w;
+	struct pathgroup *pgp;
+	struct path *pp;
+	int i, j, n, num_pg, nextpg, num_pg_args, num_paths_args;
+	int minio = mpp->minio;
+
+	if (!mpp->pg || !mpp->features || !mpp->hwhandler || !mpp->selector)
+		return false;
+
+	if (!next_counted_span(&p, &w) || !word_equal(&w, mpp->features))
+		return false;
+	if (!next_counted_span(&p, &w) || !word_equal(&w, mpp->hwhandler))
+		return false;
+	if (!next_int(&p, &num_pg) || num_pg != VECTOR_SIZE(mpp->pg) ||
+	    !next_int(&p, &nextpg))
+		return false;
+
+	vector_foreach_slot(mpp->pg, pgp, i) {
+		if (!next_selector(&p, &w, &num_pg_args) ||
+		    !word_equal(&w, mpp->selector))
+			return false;
+		skip_words(&p, num_pg_args);
+		if (!next_int(&p, &n) || n != VECTOR_SIZE(pgp->paths) ||
+		    !next_int(&p, &num_paths_args))
+			return false;
+		vector_foreach_slot(pgp->paths, pp, j) {
+			if (!next_word(&p, &w) || !word_equal(&w, pp->dev_t) ||
+			    pp->mpp != mpp)
+				return false;
+			if (num_paths_args > 0) {
+				if (!next_int(&p, &minio))
+					return false;
+				skip_words(&p, num_paths_args - 1);
+			}
+		}
+	}
+	if (next_word(&p, &w))
+		return false;
+
+	mpp->nextpg = nextpg;
+	mpp->minio = minio;
+	vector_foreach_slot(mpp->pg, pgp, i)
+		vector_foreach_slot(pgp->paths, pp, j)
+			pp->pgindex = i + 1;
+	return true;
+}
+
 /*
  * Caution callers: If this function encounters yet unknown path devices, it
  * adds them uninitialized to the mpp.
@@ -115,11 +246,10 @@ err:
 int disassemble_map(const struct vector_s *pathvec,
 		    const char *params, struct multipath *mpp)
 {
-	char * word;
 	const char *p;
-	int i, j, k;
-	int num_features = 0;
-	int num_hwhandler = 0;
+	struct dm_word w;
+	char devt[BLK_DEV_SIZE];
+	int i, j;
 	int num_pg = 0;
 	int num_pg_args = 0;
 	int num_paths = 0;
@@ -133,119 +263,61 @@ int disassemble_map(const struct vector_s *pathvec,
 
 	condlog(4, "%s: disassemble map [%s]", mpp->alias, params);
 
+	if (map_matches_pg(params, mpp)) {
+		condlog(4, "%s: path groups unchanged", mpp->alias);
+		return 0;
+	}
+	free_multipath_attributes(mpp);
+	free_pgvec(mpp->pg);
+	mpp->pg = NULL;
+
 	/*
 	 * features
 	 */
-	p += get_word(p, &mpp->features);
-
-	if (!mpp->features)
+	if (!next_counted_span(&p, &w) || !(mpp->features = dup_word(&w)))
 		return 1;
-
-	num_features = atoi(mpp->features);
-
-	for (i = 0; i < num_features; i++) {
-		p += get_word(p, &word);
-
-		if (!word)
-			return 1;
-
-		if (merge_words(&mpp->features, word)) {
-			free(word);
-			return 1;
-		}
-
-		free(word);
-	}
 	mpp->queue_mode = strstr(mpp->features, "queue_mode bio") ?
 			  QUEUE_MODE_BIO : QUEUE_MODE_RQ;
 
 	/*
 	 * hwhandler
 	 */
-	p += get_word(p, &mpp->hwhandler);
-
-	if (!mpp->hwhandler)
+	if (!next_counted_span(&p, &w) || !(mpp->hwhandler = dup_word(&w)))
 		return 1;
 
-	num_hwhandler = atoi(mpp->hwhandler);
-
-	for (i = 0; i < num_hwhandler; i++) {
-		p += get_word(p, &word);
-
-		if (!word)
-			return 1;
-
-		if (merge_words(&mpp->hwhandler, word)) {
-			free(word);
-			return 1;
-		}
-		free(word);
-	}
-
 	/*
 	 * nb of path groups
 	 */
-	p += get_word(p, &word);
-
-	if (!word)
+	if (!next_int(&p, &num_pg))
 		return 1;
 
-	num_pg = atoi(word);
-	free(word);
-
 	if (num_pg > 0) {
-		if (!mpp->pg) {
-			mpp->pg = vector_alloc();
-			if (!mpp->pg)
-				return 1;
-		}
-	} else {
-		free_pgvec(mpp->pg);
-		mpp->pg = NULL;
+		mpp->pg = vector_alloc();
+		if (!mpp->pg)
+			return 1;
 	}
 
 	/*
 	 * first pg to try
 	 */
-	p += get_word(p, &word);
-
-	if (!word)
+	if (!next_int(&p, &mpp->nextpg))
 		goto out;
 
-	mpp->nextpg = atoi(word);
-	free(word);
-
 	for (i = 0; i < num_pg; i++) {
 		/*
 		 * selector
 		 */
-
 		if (!mpp->selector) {
-			p += get_word(p, &mpp->selector);
-
-			if (!mpp->selector)
+			if (!next_selector(&p, &w, &num_pg_args) ||
+			    !(mpp->selector = dup_word(&w)))
 				goto out;
+		} else
+			skip_words(&p, 2);
 
-			/*
-			 * selector args
-			 */
-			p += get_word(p, &word);
-
-			if (!word)
-				goto out;
-
-			num_pg_args = atoi(word);
-
-			if (merge_words(&mpp->selector, word))
-				goto out1;
-			free(word);
-		} else {
-			p += get_word(p, NULL);
-			p += get_word(p, NULL);
-		}
-
-		for (j = 0; j < num_pg_args; j++)
-			p += get_word(p, NULL);
+		/*
+		 * selector args
+		 */
+		skip_words(&p, num_pg_args);
 
 		/*
 		 * paths
@@ -260,67 +332,43 @@ int disassemble_map(const struct vector_s *pathvec,
 			goto out;
 		}
 
-		p += get_word(p, &word);
-
-		if (!word)
+		if (!next_int(&p, &num_paths) || !next_int(&p, &num_paths_args))
 			goto out;
 
-		num_paths = atoi(word);
-		free(word);
-
-		p += get_word(p, &word);
-
-		if (!word)
-			goto out;
-
-		num_paths_args = atoi(word);
-		free(word);
-
 		for (j = 0; j < num_paths; j++) {
-			pp = NULL;
-			p += get_word(p, &word);
-
-			if (!word)
+			if (!next_word(&p, &w) || w.len >= BLK_DEV_SIZE)
 				goto out;
+			memcpy(devt, w.s, w.len);
+			devt[w.len] = '\0';
 
-			pp = find_path_by_devt(pathvec, word);
+			pp = find_path_by_devt(pathvec, devt);
 
 			if (!pp) {
 				pp = alloc_path();
 
 				if (!pp)
-					goto out1;
+					goto out;
 
-				strlcpy(pp->dev_t, word, BLK_DEV_SIZE);
+				strlcpy(pp->dev_t, devt, BLK_DEV_SIZE);
 
 				if (store_path(pgp->paths, pp)) {
 					free_path(pp);
-					goto out1;
+					goto out;
 				}
 			} else if (store_path(pgp->paths, pp))
-				goto out1;
-
-			free(word);
+				goto out;
 
 			pp->pgindex = i + 1;
 
-			for (k = 0; k < num_paths_args; k++)
-				if (k == 0) {
-					p += get_word(p, &word);
-					def_minio = atoi(word);
-					free(word);
-
-					if (def_minio != mpp->minio)
-						mpp->minio = def_minio;
-				}
-				else
-					p += get_word(p, NULL);
-
+			if (num_paths_args > 0) {
+				if (next_int(&p, &def_minio) &&
+				    def_minio != mpp->minio)
+					mpp->minio = def_minio;
+				skip_words(&p, num_paths_args - 1);
+			}
 		}
 	}
 	return 0;
-out1:
-	free(word);
 out:
 	free_pgvec(mpp->pg);
 	mpp->pg = NULL;
@@ -329,9 +377,9 @@ out:
 
 int disassemble_status(const char *params, struct multipath *mpp)
 {
-	char *word;
 	const char *p;
-	int i, j, k;
+	struct dm_word w;
+	int i, j;
 	int num_feature_args;
 	int num_hwhandler_args;
 	int num_pg;
@@ -347,60 +395,39 @@ int disassemble_status(const char *params, struct multipath *mpp)
 	/*
 	 * features
 	 */
-	p += get_word(p, &word);
-
-	if (!word)
+	if (!next_int(&p, &num_feature_args))
 		return 1;
 
-	num_feature_args = atoi(word);
-	free(word);
-
 	for (i = 0; i < num_feature_args; i++) {
 		if (i == 1) {
-			p += get_word(p, &word);
-
-			if (!word)
+			if (!next_int(&p, &mpp->queuedio))
 				return 1;
-
-			mpp->queuedio = atoi(word);
-			free(word);
 			continue;
 		}
 		/* unknown */
-		p += get_word(p, NULL);
+		skip_words(&p, 1);
 	}
 	/*
 	 * hwhandler
 	 */
-	p += get_word(p, &word);
-
-	if (!word)
+	if (!next_int(&p, &num_hwhandler_args))
 		return 1;
 
-	num_hwhandler_args = atoi(word);
-	free(word);
-
-	for (i = 0; i < num_hwhandler_args; i++)
-		p += get_word(p, NULL);
+	skip_words(&p, num_hwhandler_args);
 
 	/*
 	 * nb of path groups
 	 */
-	p += get_word(p, &word);
-
-	if (!word)
+	if (!next_int(&p, &num_pg))
 		return 1;
 
-	num_pg = atoi(word);
-	free(word);
-
 	if (num_pg == 0)
 		return 0;
 
 	/*
 	 * next pg to try
 	 */
-	p += get_word(p, NULL);
+	skip_words(&p, 1);
 
 	if (VECTOR_SIZE(mpp->pg) < num_pg)
 		return 1;
@@ -410,12 +437,10 @@ int disassemble_status(const char *params, struct multipath *mpp)
 		/*
 		 * PG status
 		 */
-		p += get_word(p, &word);
-
-		if (!word)
+		if (!next_word(&p, &w))
 			return 1;
 
-		switch (*word) {
+		switch (*w.s) {
 		case 'D':
 			pgp->status = PGSTATE_DISABLED;
 			break;
@@ -429,39 +454,19 @@ int disassemble_status(const char *params, struct multipath *mpp)
 			pgp->status = PGSTATE_UNDEF;
 			break;
 		}
-		free(word);
 
 		/*
 		 * Path Selector Group Arguments
 		 */
-		p += get_word(p, &word);
-
-		if (!word)
+		if (!next_int(&p, &num_pg_args))
 			return 1;
 
-		num_pg_args = atoi(word);
-		free(word);
-
 		/* Ignore ps group arguments */
-		for (j = 0; j < num_pg_args; j++)
-			p += get_word(p, NULL);
-
-		p += get_word(p, &word);
-
-		if (!word)
-			return 1;
+		skip_words(&p, num_pg_args);
 
-		num_paths = atoi(word);
-		free(word);
-
-		p += get_word(p, &word);
-
-		if (!word)
+		if (!next_int(&p, &num_paths) || !next_int(&p, &num_pg_args))
 			return 1;
 
-		num_pg_args = atoi(word);
-		free(word);
-
 		if (VECTOR_SIZE(pgp->paths) < num_paths)
 			return 1;
 
@@ -470,17 +475,15 @@ int disassemble_status(const char *params, struct multipath *mpp)
 			/*
 			 * path
 			 */
-			p += get_word(p, NULL);
+			skip_words(&p, 1);
 
 			/*
 			 * path status
 			 */
-			p += get_word(p, &word);
-
-			if (!word)
+			if (!next_word(&p, &w))
 				return 1;
 
-			switch (*word) {
+			switch (*w.s) {
 			case 'F':
 				pp->dmstate = PSTATE_FAILED;
 				break;
@@ -490,24 +493,16 @@ int disassemble_status(const char *params, struct multipath *mpp)
 			default:
 				break;
 			}
-			free(word);
 			/*
 			 * fail count
 			 */
-			p += get_word(p, &word);
-
-			if (!word)
+			if (!next_int(&p, &pp->failcount))
 				return 1;
 
-			pp->failcount = atoi(word);
-			free(word);
-
 			/*
 			 * selector args
 			 */
-			for (k = 0; k < num_pg_args; k++) {
-				p += get_word(p, NULL);
-			}
+			skip_words(&p, num_pg_args);
 		}
 	}
 	return 0;
@@ -551,7 +551,8 @@ void print_foreign_topology(int verbosity)
 		fgn->lock(fgn->context);
 		pthread_cleanup_push(fgn->unlock, fgn->context);
 		vec = fgn->get_paths(fgn->context);
-		get_path_layout__(vec, LAYOUT_RESET_NOT, p_width);
+		get_path_layout_fmt__(vec, LAYOUT_RESET_NOT, PRINT_PATH_INDENT,
+				      p_width);
 		fgn->release_paths(fgn->context, vec);
 		pthread_cleanup_pop(1);
 	}
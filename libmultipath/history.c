@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <urcu/arch.h>
+#include <urcu/uatomic.h>
+#include "history.h"
+#include "checkers.h"
+#include "structs.h"
+#include "strbuf.h"
+#include "util.h"
+#include "debug.h"
+
+/* Must be a power of 2 */
+#define HISTORY_SIZE 2048
+#define HISTORY_PATH_LEN 16
+#define HISTORY_MAP_LEN WWID_SIZE
+#define HISTORY_MSG_LEN 40
+
+struct history_record {
+	/* sequence number, 0 while the record is being written */
+	unsigned long seq;
+	/* CLOCK_REALTIME, in microseconds */
+	uint64_t usec;
+	uint8_t event;
+	uint8_t oldstate;
+	uint8_t newstate;
+	int32_t arg;
+	char path[HISTORY_PATH_LEN];
+	char map[HISTORY_MAP_LEN];
+	char msg[HISTORY_MSG_LEN];
+};
+
+static bool history_enabled;
+static unsigned long history_seq; /* uatomic access only */
+static struct history_record history[HISTORY_SIZE];
+
+void history_enable(void)
+{
+	history_enabled = true;
+}
+
+/*
+ * Claim the next slot. Writers don't block each other; readers check
+ * the sequence number to skip records that are being (over)written.
+ */
+static struct history_record *
+history_start(enum history_event ev, unsigned long *seq)
+{
+	struct history_record *r;
+	struct timespec now;
+
+	*seq = uatomic_add_return(&history_seq, 1);
+	r = &history[*seq & (HISTORY_SIZE - 1)];
+	uatomic_set(&r->seq, 0);
+	cmm_smp_wmb();
+	clock_gettime(CLOCK_REALTIME, &now);
+	r->usec = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+	r->event = ev;
+	r->oldstate = r->newstate = 0;
+	r->arg = 0;
+	r->path[0] = r->map[0] = r->msg[0] = '\0';
+	return r;
+}
+
+static void history_finish(struct history_record *r, unsigned long seq)
+{
+	cmm_smp_wmb();
+	uatomic_set(&r->seq, seq);
+}
+
+void history_path_state(const struct path *pp, int oldstate, int newstate)
+{
+	struct history_record *r;
+	unsigned long seq;
+
+	if (!history_enabled)
+		return;
+	r = history_start(HIST_PATH_STATE, &seq);
+	r->oldstate = oldstate;
+	r->newstate = newstate;
+	strlcpy(r->path, pp->dev, sizeof(r->path));
+	if (pp->mpp && pp->mpp->alias)
+		strlcpy(r->map, pp->mpp->alias, sizeof(r->map));
+	strlcpy(r->msg, checker_message(&pp->checker), sizeof(r->msg));
+	history_finish(r, seq);
+}
+
+void history_map(enum history_event ev, const char *mapname, int arg,
+		 const char *reason)
+{
+	struct history_record *r;
+	unsigned long seq;
+
+	if (!history_enabled)
+		return;
+	r = history_start(ev, &seq);
+	r->arg = arg;
+	strlcpy(r->map, mapname, sizeof(r->map));
+	if (reason)
+		strlcpy(r->msg, reason, sizeof(r->msg));
+	history_finish(r, seq);
+}
+
+/* Copy record @seq, returns false if it has been overwritten */
+static bool history_get(unsigned long seq, struct history_record *copy)
+{
+	const struct history_record *r = &history[seq & (HISTORY_SIZE - 1)];
+
+	if (uatomic_read(&r->seq) != seq)
+		return false;
+	cmm_smp_rmb();
+	memcpy(copy, r, sizeof(*copy));
+	cmm_smp_rmb();
+	return uatomic_read(&r->seq) == seq;
+}
+
+static int print_record(struct strbuf *buf, const struct history_record *r)
+{
+	time_t t = r->usec / 1000000;
+	struct tm tm;
+	char tbuf[32];
+	int rc;
+
+	if (!localtime_r(&t, &tm) ||
+	    strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", &tm) == 0)
+		tbuf[0] = '\0';
+	if ((rc = print_strbuf(buf, "%s.%06u %s", tbuf,
+			       (unsigned int)(r->usec % 1000000), r->map)) < 0)
+		return rc;
+
+	switch (r->event) {
+	case HIST_PATH_STATE:
+		rc = print_strbuf(buf, " %s: %s -> %s%s%s%s\n", r->path,
+				  checker_state_name(r->oldstate),
+				  checker_state_name(r->newstate),
+				  *r->msg ? " (" : "", r->msg,
+				  *r->msg ? ")" : "");
+		break;
+	case HIST_MAP_RELOAD:
+		rc = print_strbuf(buf, ": reload (%s)\n",
+				  *r->msg ? r->msg : "unknown reason");
+		break;
+	case HIST_PG_SWITCH:
+		rc = print_strbuf(buf, ": switch to path group %d\n", r->arg);
+		break;
+	case HIST_QUEUEING:
+		rc = print_strbuf(buf, ": queueing %s\n",
+				  r->arg ? "enabled" : "disabled");
+		break;
+	default:
+		rc = print_strbuf(buf, ": unknown event %d\n", r->event);
+		break;
+	}
+	return rc;
+}
+
+int print_history(struct strbuf *buf, const char *map, const char *path)
+{
+	size_t initial_len = get_strbuf_len(buf);
+	unsigned long seq, last = uatomic_read(&history_seq);
+	struct history_record r;
+	int rc;
+
+	seq = last > HISTORY_SIZE ? last - HISTORY_SIZE + 1 : 1;
+	for (; seq <= last; seq++) {
+		if (!history_get(seq, &r))
+			continue;
+		if (map && strcmp(r.map, map))
+			continue;
+		if (path && strcmp(r.path, path))
+			continue;
+		if ((rc = print_record(buf, &r)) < 0)
+			return rc;
+	}
+	return get_strbuf_len(buf) - initial_len;
+}
+
+int dump_history(const char *file)
+{
+	STRBUF_ON_STACK(buf);
+	int fd, rc = 0;
+
+	if (print_history(&buf, NULL, NULL) < 0)
+		return -ENOMEM;
+	fd = open(file, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+	if (fd == -1) {
+		rc = -errno;
+		condlog(1, "%s: failed to open %s: %m", __func__, file);
+		return rc;
+	}
+	if (safe_write(fd, get_strbuf_str(&buf), get_strbuf_len(&buf)) != 0) {
+		rc = -errno;
+		condlog(1, "%s: failed to write %s: %m", __func__, file);
+	} else
+		condlog(2, "history written to %s", file);
+	close(fd);
+	return rc;
+}
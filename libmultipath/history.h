@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef HISTORY_H_INCLUDED
+#define HISTORY_H_INCLUDED
+
+struct strbuf;
+struct path;
+struct multipath;
+
+/*
+ * Flight recorder: a fixed size ring of binary records of path state
+ * changes, map reloads, path group switches and queueing mode changes.
+ * Records are only formatted when the history is printed, so that
+ * recording is cheap enough to be always on. Nothing is recorded
+ * before history_enable() is called.
+ */
+enum history_event {
+	HIST_PATH_STATE,
+	HIST_MAP_RELOAD,
+	HIST_PG_SWITCH,
+	HIST_QUEUEING,
+};
+
+void history_enable(void);
+
+/**
+ * history_path_state(): record a path state change
+ * @param pp: the path, pp->state is @newstate already
+ * @param oldstate: previous state
+ * @param newstate: new state
+ */
+void history_path_state(const struct path *pp, int oldstate, int newstate);
+
+/**
+ * history_map(): record a map event
+ * @param ev: HIST_MAP_RELOAD, HIST_PG_SWITCH or HIST_QUEUEING
+ * @param mapname: map alias
+ * @param arg: path group number for HIST_PG_SWITCH, 1 or 0 for
+ * HIST_QUEUEING (queueing enabled / disabled)
+ * @param reason: reason for HIST_MAP_RELOAD, or NULL
+ */
+void history_map(enum history_event ev, const char *mapname, int arg,
+		 const char *reason);
+
+/**
+ * print_history(): print the recorded events, oldest first
+ * @param buf: string buffer to print to
+ * @param map: only print events of this map, or NULL
+ * @param path: only print events of this path, or NULL
+ * @returns: number of characters printed, or negative error code
+ */
+int print_history(struct strbuf *buf, const char *map, const char *path);
+
+/**
+ * dump_history(): write the recorded events to a file
+ * @param file: file name, the file is replaced if it exists
+ * @returns: 0 on success, -errno on failure
+ */
+int dump_history(const char *file);
+
+#endif
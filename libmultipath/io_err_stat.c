@@ -434,7 +434,7 @@ static void end_io_err_stat(struct io_err_stat_path *pp)
 	io_err_stat_log(3, "%s: IO error rate (%.1f/1000)",
 			pp->devname, err_rate);
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
-	lock(&vecs->lock);
+	lock(&vecs->lock, __func__);
 	pthread_testcancel();
 	path = find_path_by_dev(vecs->pathvec, pp->devname);
 	if (!path) {
@@ -664,7 +664,6 @@ static void *io_err_stat_loop(void *data)
 	pthread_cleanup_push(cleanup_exited, NULL);
 
 	sigfillset(&set);
-	sigdelset(&set, SIGUSR2);
 
 	mlockall(MCL_CURRENT | MCL_FUTURE);
 
@@ -682,7 +681,7 @@ static void *io_err_stat_loop(void *data)
 		ts.tv_nsec = 100 * 1000 * 1000;
 		/*
 		 * pselect() with no fds, a timeout, and a sigmask:
-		 * sleep for 100ms and react on SIGUSR2.
+		 * sleep for 100ms with all signals blocked.
 		 */
 		pselect(1, NULL, NULL, NULL, &ts, &set);
 	}
@@ -1,18 +1,94 @@
+#include <string.h>
 #include "lock.h"
+#include "time-util.h"
+#include "strbuf.h"
+#include "metrics.h"
+#include "trace.h"
 
-void cleanup_lock (void * data)
+static struct lock_site *find_site(struct mutex_lock *a, const char *name)
+{
+	struct lock_site *s;
+	unsigned int i;
+
+	/* Sites are usually __func__, so comparing pointers is enough */
+	for (i = 0; i < a->n_sites; i++)
+		if (a->sites[i].name == name)
+			return &a->sites[i];
+	if (a->n_sites == LOCK_MAX_SITES) {
+		s = &a->other;
+		if (!s->name) {
+			memset(s, 0, sizeof(*s));
+			s->name = "other";
+		}
+		return s;
+	}
+	s = &a->sites[a->n_sites++];
+	memset(s, 0, sizeof(*s));
+	s->name = name;
+	return s;
+}
+
+void lock_acquired(struct mutex_lock *a, const char *site,
+		   const struct timespec *start)
+{
+	struct lock_site *s = find_site(a, site);
+	unsigned long long wait_us = 0;
+	struct timespec diff;
+
+	get_monotonic_time(&a->acquired);
+	if (start) {
+		timespecsub(&a->acquired, start, &diff);
+		wait_us = timespec_us(&diff);
+		metric_observe(MP_METRIC_LOCK_WAIT, NULL, &diff);
+	}
+	timing_add(&s->wait, wait_us);
+	a->holder = s;
+	TRACE_PROBE(lock_acquired, a, site, wait_us);
+}
+
+void lock_released(struct mutex_lock *a)
 {
-	struct mutex_lock *lock = data;
-	wakeup_fn *fn = lock->wakeup;
+	struct timespec now, diff;
+	unsigned long long hold_us;
 
-	unlock__(lock);
-	if (fn)
-		fn();
+	if (!a->holder)
+		return;
+	get_monotonic_time(&now);
+	timespecsub(&now, &a->acquired, &diff);
+	hold_us = timespec_us(&diff);
+	timing_add(&a->holder->hold, hold_us);
+	TRACE_PROBE(lock_released, a, a->holder->name, hold_us);
+	a->holder = NULL;
 }
 
-void set_wakeup_fn(struct mutex_lock *lck, wakeup_fn *fn)
+int print_lock_timing(struct strbuf *buf, const struct mutex_lock *a)
+{
+	size_t initial_len = get_strbuf_len(buf);
+	unsigned int i;
+	int rc;
+
+	if ((rc = print_timing_header(buf, "lock wait")) < 0)
+		return rc;
+	for (i = 0; i < a->n_sites; i++)
+		if ((rc = print_timing(buf, a->sites[i].name,
+				       &a->sites[i].wait)) < 0)
+			return rc;
+	if (a->other.name &&
+	    (rc = print_timing(buf, a->other.name, &a->other.wait)) < 0)
+		return rc;
+	if ((rc = print_timing_header(buf, "lock hold")) < 0)
+		return rc;
+	for (i = 0; i < a->n_sites; i++)
+		if ((rc = print_timing(buf, a->sites[i].name,
+				       &a->sites[i].hold)) < 0)
+			return rc;
+	if (a->other.name &&
+	    (rc = print_timing(buf, a->other.name, &a->other.hold)) < 0)
+		return rc;
+	return get_strbuf_len(buf) - initial_len;
+}
+
+void cleanup_lock (void * data)
 {
-	lock(lck);
-	lck->wakeup = fn;
-	unlock__(lck);
+	unlock__((struct mutex_lock *)data);
 }
@@ -5,21 +5,52 @@
 #include <urcu.h>
 #include <urcu/uatomic.h>
 #include <stdbool.h>
+#include "time-util.h"
+#include "timing.h"
 
-typedef void (wakeup_fn)(void);
+struct strbuf;
+
+/*
+ * Wait and hold times are accounted per call site. If there are more
+ * than LOCK_MAX_SITES sites, "other" collects the rest.
+ */
+#define LOCK_MAX_SITES 16
+
+struct lock_site {
+	const char *name;
+	struct timing_stats wait;
+	struct timing_stats hold;
+};
 
 struct mutex_lock {
 	pthread_mutex_t mutex;
-	wakeup_fn *wakeup;
 	int waiters; /* uatomic access only */
+	/* The members below are only accessed with the mutex held */
+	struct lock_site *holder;
+	struct timespec acquired;
+	unsigned int n_sites;
+	struct lock_site sites[LOCK_MAX_SITES];
+	struct lock_site other;
 };
 
 static inline void init_lock(struct mutex_lock *a)
 {
 	pthread_mutex_init(&a->mutex, NULL);
 	uatomic_set(&a->waiters, 0);
+	a->holder = NULL;
+	a->n_sites = 0;
+	a->other.name = NULL;
 }
 
+/*
+ * Called with the mutex held. @start is the time the caller started
+ * waiting, or NULL if the mutex was taken without waiting.
+ */
+void lock_acquired(struct mutex_lock *a, const char *site,
+		   const struct timespec *start);
+/* Called with the mutex held, just before releasing it */
+void lock_released(struct mutex_lock *a);
+
 #if defined(__GNUC__) && __GNUC__ == 12 && URCU_VERSION < 0xe00
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Warray-bounds"
@@ -30,11 +61,20 @@ static inline int uatomic_xchg_int(int *ptr, int val)
 	return uatomic_xchg(ptr, val);
 }
 
-static inline void lock(struct mutex_lock *a)
+/* @site is the tag for the statistics, usually __func__ */
+static inline void lock(struct mutex_lock *a, const char *site)
 {
+	struct timespec start;
+	bool waited = false;
+
 	uatomic_inc(&a->waiters);
-	pthread_mutex_lock(&a->mutex);
+	if (pthread_mutex_trylock(&a->mutex) != 0) {
+		get_monotonic_time(&start);
+		pthread_mutex_lock(&a->mutex);
+		waited = true;
+	}
 	uatomic_dec(&a->waiters);
+	lock_acquired(a, site, waited ? &start : NULL);
 }
 
 #if defined(__GNUC__) && __GNUC__ == 12 && URCU_VERSION < 0xe00
@@ -53,6 +93,7 @@ static inline int timedlock(struct mutex_lock *a, struct timespec *tmo)
 
 static inline void unlock__(struct mutex_lock *a)
 {
+	lock_released(a);
 	pthread_mutex_unlock(&a->mutex);
 }
 
@@ -64,6 +105,7 @@ static inline bool lock_has_waiters(struct mutex_lock *a)
 #define lock_cleanup_pop(a) pthread_cleanup_pop(1)
 
 void cleanup_lock (void * data);
-void set_wakeup_fn(struct mutex_lock *lock, wakeup_fn *fn);
+/* Call with the mutex held */
+int print_lock_timing(struct strbuf *buf, const struct mutex_lock *a);
 
 #endif /* LOCK_H_INCLUDED */
@@ -0,0 +1,368 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metrics.h"
+#include "strbuf.h"
+#include "util.h"
+#include "debug.h"
+
+#define USEC_PER_SEC 1000000ULL
+
+struct metric_value {
+	struct metric_value *next;
+	char *label;
+	/* counter value, or number of observations for histograms */
+	unsigned long long count;
+	long long gauge;
+	unsigned long long sum_us;
+	unsigned long long buckets[];
+};
+
+struct metric {
+	const char *name;
+	const char *help;
+	enum metric_type type;
+	const char *label_name;
+	/* histogram bucket upper bounds, in microseconds */
+	const unsigned long long *bounds;
+	unsigned int n_bounds;
+	struct metric_value *values;
+};
+
+static const unsigned long long checker_bounds[] = {
+	1000, 5000, 10000, 50000, 100000, 500000,
+	1000000, 5000000, 10000000, 30000000,
+};
+
+static const unsigned long long lock_bounds[] = {
+	10, 100, 1000, 10000, 100000, 1000000, 10000000,
+};
+
+static const unsigned long long dm_op_bounds[] = {
+	100, 1000, 10000, 100000, 1000000, 10000000,
+};
+
+static const unsigned long long tick_bounds[] = {
+	1000, 10000, 100000, 250000, 500000, 1000000, 5000000,
+};
+
+#define METRIC(nm, hlp, tp, lbl)		\
+	{					\
+		.name = "multipathd_" nm,	\
+		.help = hlp,			\
+		.type = tp,			\
+		.label_name = lbl,		\
+	}
+
+#define HISTOGRAM(nm, hlp, lbl, b)		\
+	{					\
+		.name = "multipathd_" nm,	\
+		.help = hlp,			\
+		.type = METRIC_HISTOGRAM,	\
+		.label_name = lbl,		\
+		.bounds = b,			\
+		.n_bounds = ARRAY_SIZE(b),	\
+	}
+
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct metric metrics[MP_METRIC_MAX__] = {
+	[MP_METRIC_CHECKER_DURATION] =
+	HISTOGRAM("checker_duration_seconds",
+		  "Time from starting a path check to its result",
+		  "checker", checker_bounds),
+	[MP_METRIC_CHECKER_TIMEOUTS] =
+	METRIC("checker_timeouts", "Path checks that timed out",
+	       METRIC_COUNTER, "checker"),
+	[MP_METRIC_PATH_STATE_CHANGES] =
+	METRIC("path_state_changes", "Path state changes, by new state",
+	       METRIC_COUNTER, "state"),
+	[MP_METRIC_DM_RELOADS] =
+	METRIC("dm_reloads", "Successful map table reloads",
+	       METRIC_COUNTER, NULL),
+	[MP_METRIC_PG_SWITCHES] =
+	METRIC("pg_switches", "Path group switches",
+	       METRIC_COUNTER, NULL),
+	[MP_METRIC_PATH_MSGS] =
+	METRIC("path_messages",
+	       "Path fail and reinstate messages sent to device-mapper",
+	       METRIC_COUNTER, "message"),
+	[MP_METRIC_PATH_MSGS_SAVED] =
+	METRIC("path_messages_saved",
+	       "Path messages superseded by a later message in the same tick",
+	       METRIC_COUNTER, NULL),
+	[MP_METRIC_DM_OP_DURATION] =
+	HISTOGRAM("dm_op_duration_seconds",
+		  "Duration of device-mapper operations, by operation",
+		  "op", dm_op_bounds),
+	[MP_METRIC_DM_QUEUE_WAIT] =
+	HISTOGRAM("dm_queue_wait_seconds",
+		  "Time path messages spent in the device-mapper queue",
+		  NULL, dm_op_bounds),
+	[MP_METRIC_MAP_SYNCS_SKIPPED] =
+	METRIC("map_syncs_skipped",
+	       "Map resyncs skipped because there was no device-mapper event",
+	       METRIC_COUNTER, NULL),
+	[MP_METRIC_UEVENTS] =
+	METRIC("uevents", "Uevents processed", METRIC_COUNTER, NULL),
+	[MP_METRIC_UEVENTS_MERGED] =
+	METRIC("uevents_merged", "Uevents merged into later uevents",
+	       METRIC_COUNTER, NULL),
+	[MP_METRIC_LOCK_WAIT] =
+	HISTOGRAM("lock_wait_seconds",
+		  "Time spent waiting for the vecs lock, if contended",
+		  NULL, lock_bounds),
+	[MP_METRIC_TICK_DURATION] =
+	HISTOGRAM("tick_duration_seconds",
+		  "Duration of a path checker loop iteration",
+		  NULL, tick_bounds),
+	[MP_METRIC_PATHS] =
+	METRIC("paths", "Number of paths, by state",
+	       METRIC_GAUGE, "state"),
+	[MP_METRIC_MAPS] =
+	METRIC("maps", "Number of multipath maps", METRIC_GAUGE, NULL),
+};
+
+static struct metric_value *alloc_value(const struct metric *m,
+					const char *label)
+{
+	struct metric_value *v;
+
+	v = calloc(1, sizeof(*v) + m->n_bounds * sizeof(v->buckets[0]));
+	if (!v)
+		return NULL;
+	if (label && !(v->label = strdup(label))) {
+		free(v);
+		return NULL;
+	}
+	return v;
+}
+
+/* Call with metrics_lock held */
+static struct metric_value *get_value(struct metric *m, const char *label)
+{
+	struct metric_value *v, **pv;
+
+	if (!m->label_name)
+		label = NULL;
+	else if (!label)
+		label = "";
+
+	for (pv = &m->values; (v = *pv) != NULL; pv = &v->next) {
+		if (!label || !strcmp(v->label, label))
+			return v;
+	}
+	v = alloc_value(m, label);
+	if (!v)
+		condlog(2, "%s: failed to allocate value for %s", __func__,
+			m->name);
+	else
+		*pv = v;
+	return v;
+}
+
+static struct metric *get_metric(enum mp_metric id, enum metric_type type)
+{
+	if ((unsigned int)id >= MP_METRIC_MAX__ || metrics[id].type != type) {
+		condlog(1, "%s: invalid metric %d", __func__, id);
+		return NULL;
+	}
+	return &metrics[id];
+}
+
+void metric_add(enum mp_metric id, const char *label, unsigned long long n)
+{
+	struct metric *m = get_metric(id, METRIC_COUNTER);
+	struct metric_value *v;
+
+	if (!m)
+		return;
+	pthread_mutex_lock(&metrics_lock);
+	v = get_value(m, label);
+	if (v)
+		v->count += n;
+	pthread_mutex_unlock(&metrics_lock);
+}
+
+void metric_set(enum mp_metric id, const char *label, long long val)
+{
+	struct metric *m = get_metric(id, METRIC_GAUGE);
+	struct metric_value *v;
+
+	if (!m)
+		return;
+	pthread_mutex_lock(&metrics_lock);
+	v = get_value(m, label);
+	if (v)
+		v->gauge = val;
+	pthread_mutex_unlock(&metrics_lock);
+}
+
+void metric_observe(enum mp_metric id, const char *label,
+		    const struct timespec *duration)
+{
+	struct metric *m = get_metric(id, METRIC_HISTOGRAM);
+	struct metric_value *v;
+	unsigned long long us;
+	unsigned int i;
+
+	if (!m)
+		return;
+	if (duration->tv_sec < 0)
+		us = 0;
+	else
+		us = duration->tv_sec * USEC_PER_SEC +
+			duration->tv_nsec / 1000;
+
+	for (i = 0; i < m->n_bounds && us > m->bounds[i]; i++)
+		;
+	pthread_mutex_lock(&metrics_lock);
+	v = get_value(m, label);
+	if (v) {
+		v->count++;
+		v->sum_us += us;
+		if (i < m->n_bounds)
+			v->buckets[i]++;
+	}
+	pthread_mutex_unlock(&metrics_lock);
+}
+
+/* Prints '{label="value"' or nothing, the caller closes the brace */
+static int print_label(struct strbuf *buf, const struct metric *m,
+		       const struct metric_value *v)
+{
+	if (!m->label_name)
+		return 0;
+	return print_strbuf(buf, "{%s=\"%s\"", m->label_name, v->label);
+}
+
+static int print_seconds(struct strbuf *buf, unsigned long long us)
+{
+	return print_strbuf(buf, "%llu.%06llu", us / USEC_PER_SEC,
+			    us % USEC_PER_SEC);
+}
+
+static int print_histogram(struct strbuf *buf, const struct metric *m,
+			   const struct metric_value *v)
+{
+	unsigned long long cum = 0;
+	unsigned int i;
+	const char *sep = m->label_name ? "," : "{";
+	const char *end = m->label_name ? "}" : "";
+
+	for (i = 0; i <= m->n_bounds; i++) {
+		if (print_strbuf(buf, "%s_bucket", m->name) < 0 ||
+		    print_label(buf, m, v) < 0 ||
+		    print_strbuf(buf, "%sle=\"", sep) < 0)
+			return -ENOMEM;
+		if (i < m->n_bounds) {
+			cum += v->buckets[i];
+			if (print_seconds(buf, m->bounds[i]) < 0)
+				return -ENOMEM;
+		} else {
+			cum = v->count;
+			if (append_strbuf_str(buf, "+Inf") < 0)
+				return -ENOMEM;
+		}
+		if (print_strbuf(buf, "\"} %llu\n", cum) < 0)
+			return -ENOMEM;
+	}
+	if (print_strbuf(buf, "%s_count", m->name) < 0 ||
+	    print_label(buf, m, v) < 0 ||
+	    print_strbuf(buf, "%s %llu\n", end, v->count) < 0 ||
+	    print_strbuf(buf, "%s_sum", m->name) < 0 ||
+	    print_label(buf, m, v) < 0 ||
+	    print_strbuf(buf, "%s ", end) < 0 ||
+	    print_seconds(buf, v->sum_us) < 0 ||
+	    append_strbuf_str(buf, "\n") < 0)
+		return -ENOMEM;
+	return 0;
+}
+
+static int print_value(struct strbuf *buf, const struct metric *m,
+		       const struct metric_value *v)
+{
+	const char *end = m->label_name ? "}" : "";
+
+	switch (m->type) {
+	case METRIC_COUNTER:
+		if (print_strbuf(buf, "%s_total", m->name) < 0 ||
+		    print_label(buf, m, v) < 0 ||
+		    print_strbuf(buf, "%s %llu\n", end, v->count) < 0)
+			return -ENOMEM;
+		return 0;
+	case METRIC_GAUGE:
+		if (append_strbuf_str(buf, m->name) < 0 ||
+		    print_label(buf, m, v) < 0 ||
+		    print_strbuf(buf, "%s %lld\n", end, v->gauge) < 0)
+			return -ENOMEM;
+		return 0;
+	case METRIC_HISTOGRAM:
+		return print_histogram(buf, m, v);
+	}
+	return 0;
+}
+
+static const char *type_name(enum metric_type type)
+{
+	switch (type) {
+	case METRIC_COUNTER:
+		return "counter";
+	case METRIC_GAUGE:
+		return "gauge";
+	case METRIC_HISTOGRAM:
+		return "histogram";
+	}
+	return "unknown";
+}
+
+int print_metrics(struct strbuf *buf)
+{
+	size_t initial_len = get_strbuf_len(buf);
+	int i, rc = 0;
+
+	pthread_mutex_lock(&metrics_lock);
+	for (i = 0; i < MP_METRIC_MAX__; i++) {
+		struct metric *m = &metrics[i];
+		struct metric_value *v;
+
+		if (print_strbuf(buf, "# TYPE %s %s\n# HELP %s %s.\n",
+				 m->name, type_name(m->type),
+				 m->name, m->help) < 0) {
+			rc = -ENOMEM;
+			break;
+		}
+		/* Metrics without label are always printed, even if zero */
+		if (!m->label_name)
+			get_value(m, NULL);
+		for (v = m->values; v && rc == 0; v = v->next)
+			rc = print_value(buf, m, v);
+		if (rc < 0)
+			break;
+	}
+	pthread_mutex_unlock(&metrics_lock);
+
+	if (rc == 0 && append_strbuf_str(buf, "# EOF\n") < 0)
+		rc = -ENOMEM;
+	return rc < 0 ? rc : (int)(get_strbuf_len(buf) - initial_len);
+}
+
+void reset_metrics(void)
+{
+	int i;
+
+	pthread_mutex_lock(&metrics_lock);
+	for (i = 0; i < MP_METRIC_MAX__; i++) {
+		struct metric_value *v, *next;
+
+		for (v = metrics[i].values; v; v = next) {
+			next = v->next;
+			free(v->label);
+			free(v);
+		}
+		metrics[i].values = NULL;
+	}
+	pthread_mutex_unlock(&metrics_lock);
+}
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+#include <time.h>
+
+struct strbuf;
+
+/*
+ * Registry of daemon metrics, exported in OpenMetrics text format by
+ * "multipathd show metrics".
+ *
+ * Metrics have at most one label. Label values are added on first use,
+ * e.g. one time series per checker class for the checker metrics.
+ * Histograms record durations.
+ */
+enum metric_type {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM,
+};
+
+enum mp_metric {
+	MP_METRIC_CHECKER_DURATION,
+	MP_METRIC_CHECKER_TIMEOUTS,
+	MP_METRIC_PATH_STATE_CHANGES,
+	MP_METRIC_DM_RELOADS,
+	MP_METRIC_PG_SWITCHES,
+	MP_METRIC_PATH_MSGS,
+	MP_METRIC_PATH_MSGS_SAVED,
+	MP_METRIC_DM_OP_DURATION,
+	MP_METRIC_DM_QUEUE_WAIT,
+	MP_METRIC_MAP_SYNCS_SKIPPED,
+	MP_METRIC_UEVENTS,
+	MP_METRIC_UEVENTS_MERGED,
+	MP_METRIC_LOCK_WAIT,
+	MP_METRIC_TICK_DURATION,
+	MP_METRIC_PATHS,
+	MP_METRIC_MAPS,
+	MP_METRIC_MAX__,
+};
+
+/**
+ * metric_add(): increase a counter
+ * @param id: the metric
+ * @param label: label value, or NULL for metrics without label
+ * @param n: increment
+ */
+void metric_add(enum mp_metric id, const char *label, unsigned long long n);
+
+static inline void metric_inc(enum mp_metric id, const char *label)
+{
+	metric_add(id, label, 1);
+}
+
+/**
+ * metric_set(): set a gauge
+ * @param id: the metric
+ * @param label: label value, or NULL for metrics without label
+ * @param val: new value
+ */
+void metric_set(enum mp_metric id, const char *label, long long val);
+
+/**
+ * metric_observe(): record a duration in a histogram
+ * @param id: the metric
+ * @param label: label value, or NULL for metrics without label
+ * @param duration: the observed duration
+ */
+void metric_observe(enum mp_metric id, const char *label,
+		    const struct timespec *duration);
+
+/**
+ * print_metrics(): print all metrics in OpenMetrics text format
+ * @param buf: string buffer to print to
+ * @returns: number of characters printed, or negative error code
+ */
+int print_metrics(struct strbuf *buf);
+
+/**
+ * reset_metrics(): drop all recorded values
+ */
+void reset_metrics(void);
+
+#endif
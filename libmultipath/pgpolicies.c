@@ -173,8 +173,8 @@ typedef bool (path_match_fn)(struct path *pp1, struct path *pp2);
 bool
 node_names_match(struct path *pp1, struct path *pp2)
 {
-	return (strncmp(pp1->tgt_node_name, pp2->tgt_node_name,
-			NODE_NAME_SIZE) == 0);
+	/* interned strings */
+	return pp1->tgt_node_name == pp2->tgt_node_name;
 }
 
 bool
@@ -321,8 +321,6 @@ out:
 
 int one_group(struct multipath *mp, vector paths)	/* aka multibus */
 {
-	int i;
-	struct path * pp;
 	struct pathgroup * pgp;
 
 	pgp = alloc_pathgroup();
@@ -333,12 +331,8 @@ int one_group(struct multipath *mp, vector paths)	/* aka multibus */
 	if (add_pathgroup(mp, pgp))
 		goto out1;
 
-	for (i = 0; i < VECTOR_SIZE(paths); i++) {
-		pp = VECTOR_SLOT(paths, i);
-
-		if (store_path(pgp->paths, pp))
-			goto out;
-	}
+	if (!vector_append(pgp->paths, paths))
+		goto out;
 	return 0;
 out1:
 	free_pathgroup(pgp);
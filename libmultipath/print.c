@@ -35,7 +35,6 @@
 #include "sysfs.h"
 
 #define PRINT_PATH_LONG      "%w %i %d %D %p %t %T %s %o"
-#define PRINT_PATH_INDENT    "%i %d %D %t %T %o"
 #define PRINT_MAP_PROPS      "size=%S features='%f' hwhandler='%h' wp=%r"
 #define PRINT_PG_INDENT      "policy='%s' prio=%p status=%t"
 
@@ -783,6 +782,36 @@ snprint_path_failures(struct strbuf *buff, const struct path * pp)
 	return snprint_int(buff, pp->failcount);
 }
 
+/* checker round trip times, in milliseconds */
+static int
+snprint_chk_latency(struct strbuf *buff, const struct path * pp,
+		    unsigned int us)
+{
+	if (lat_hist_count(&pp->chk_latency) == 0)
+		return append_strbuf_str(buff, "-");
+	return print_strbuf(buff, "%u.%03u", us / 1000, us % 1000);
+}
+
+static int
+snprint_chk_p50(struct strbuf *buff, const struct path * pp)
+{
+	return snprint_chk_latency(buff, pp,
+				   lat_hist_percentile(&pp->chk_latency, 50));
+}
+
+static int
+snprint_chk_p99(struct strbuf *buff, const struct path * pp)
+{
+	return snprint_chk_latency(buff, pp,
+				   lat_hist_percentile(&pp->chk_latency, 99));
+}
+
+static int
+snprint_chk_max(struct strbuf *buff, const struct path * pp)
+{
+	return snprint_chk_latency(buff, pp, pp->chk_latency.max_us);
+}
+
 /* if you add a protocol string bigger than "scsi:unspec" you must
  * also change PROTOCOL_BUF_SIZE */
 int
@@ -889,6 +918,9 @@ static const struct path_data pd[] = {
 	{'L', "LUN hex",       snprint_path_lunhex},
 	{'A', "TPG",           snprint_alua_tpg},
 	{'k', "max_sectors_kb",snprint_path_max_sectors_kb},
+	{'l', "chk_p50",       snprint_chk_p50},
+	{'q', "chk_p99",       snprint_chk_p99},
+	{'x', "chk_max",       snprint_chk_max},
 };
 
 static const struct pathgroup_data pgd[] = {
@@ -921,17 +953,45 @@ int snprint_wildcards(struct strbuf *buff)
 	return get_strbuf_len(buff) - initial_len;
 }
 
+static int pd_lookup(char wildcard);
+static int mpd_lookup(char wildcard);
+
+/*
+ * Mark the columns of the pd[] or mpd[] table that are referenced
+ * in format. If format is NULL, all columns are used.
+ */
+static void get_used_columns(const char *format, int (*lookup)(char),
+			     bool *used, unsigned int n_cols)
+{
+	const char *f;
+	int col;
+
+	memset(used, format == NULL, n_cols * sizeof(*used));
+	if (format == NULL)
+		return;
+	for (f = strchr(format, '%'); f && f[1]; f = strchr(f + 2, '%')) {
+		if ((col = lookup(f[1])) != -1)
+			used[col] = true;
+	}
+}
+
 fieldwidth_t *alloc_path_layout(void) {
 	return calloc(ARRAY_SIZE(pd), sizeof(fieldwidth_t));
 }
 
 void get_path_layout(vector pathvec, int header, fieldwidth_t *width)
+{
+	get_path_layout_fmt(pathvec, header, NULL, width);
+}
+
+void get_path_layout_fmt(vector pathvec, int header, const char *format,
+			 fieldwidth_t *width)
 {
 	vector gpvec = vector_convert(NULL, pathvec, struct path,
 				      dm_path_to_gen);
-	get_path_layout__(gpvec,
-			 header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO,
-			 width);
+	get_path_layout_fmt__(gpvec,
+			      header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO,
+			      format, width);
 	vector_free(gpvec);
 }
 
@@ -953,19 +1013,32 @@ reset_width(fieldwidth_t *width, enum layout_reset reset, const char *header)
 
 void get_path_layout__ (const struct vector_s *gpvec, enum layout_reset reset,
 		       fieldwidth_t *width)
+{
+	get_path_layout_fmt__(gpvec, reset, NULL, width);
+}
+
+/*
+ * Only the columns used in format are computed. Some wildcards read
+ * sysfs, computing them for every path would be expensive.
+ */
+void get_path_layout_fmt__ (const struct vector_s *gpvec,
+			    enum layout_reset reset, const char *format,
+			    fieldwidth_t *width)
 {
 	unsigned int i, j;
 	const struct gen_path *gp;
+	bool used[ARRAY_SIZE(pd)];
 
 	if (width == NULL)
 		return;
 
+	get_used_columns(format, pd_lookup, used, ARRAY_SIZE(pd));
 	for (j = 0; j < ARRAY_SIZE(pd); j++) {
 		STRBUF_ON_STACK(buff);
 
 		reset_width(&width[j], reset, pd[j].header);
 
-		if (gpvec == NULL)
+		if (gpvec == NULL || !used[j])
 			continue;
 
 		vector_foreach_slot (gpvec, gp, i) {
@@ -983,29 +1056,44 @@ fieldwidth_t *alloc_multipath_layout(void) {
 }
 
 void get_multipath_layout (vector mpvec, int header, fieldwidth_t *width) {
+	get_multipath_layout_fmt(mpvec, header, NULL, width);
+}
+
+void get_multipath_layout_fmt (vector mpvec, int header, const char *format,
+			       fieldwidth_t *width) {
 	vector gmvec = vector_convert(NULL, mpvec, struct multipath,
 				      dm_multipath_to_gen);
-	get_multipath_layout__(gmvec,
-			      header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO,
-			      width);
+	get_multipath_layout_fmt__(gmvec,
+				   header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO,
+				   format, width);
 	vector_free(gmvec);
 }
 
 void
 get_multipath_layout__ (const struct vector_s *gmvec, enum layout_reset reset,
 		       fieldwidth_t *width)
+{
+	get_multipath_layout_fmt__(gmvec, reset, NULL, width);
+}
+
+void
+get_multipath_layout_fmt__ (const struct vector_s *gmvec,
+			    enum layout_reset reset, const char *format,
+			    fieldwidth_t *width)
 {
 	unsigned int i, j;
 	const struct gen_multipath * gm;
+	bool used[ARRAY_SIZE(mpd)];
 
 	if (width == NULL)
 		return;
+	get_used_columns(format, mpd_lookup, used, ARRAY_SIZE(mpd));
 	for (j = 0; j < ARRAY_SIZE(mpd); j++) {
 		STRBUF_ON_STACK(buff);
 
 		reset_width(&width[j], reset, mpd[j].header);
 
-		if (gmvec == NULL)
+		if (gmvec == NULL || !used[j])
 			continue;
 
 		vector_foreach_slot (gmvec, gm, i) {
@@ -1084,6 +1172,272 @@ int snprint_pathgroup_attr(const struct gen_pathgroup* gpg,
 	return pgd[i].snprint(buf, pg);
 }
 
+/*
+ * A format string compiled into a list of operations. Each operation
+ * prints literal text from the format, followed by a wildcard's value.
+ * col is the wildcard's index in pd[] or mpd[], or -1 if it's unknown.
+ * Unknown wildcards are skipped, like in snprint_path__().
+ */
+struct print_op {
+	unsigned int lit_off;
+	unsigned int lit_len;
+	int col;
+	char wildcard;
+};
+
+struct print_format {
+	char *format;
+	const char *tail;
+	unsigned int n_ops;
+	struct print_op ops[];
+};
+
+static struct print_format *compile_format(const char *format,
+					   int (*lookup)(char))
+{
+	struct print_format *pf;
+	const char *f;
+	char *start, *p;
+	unsigned int n = 0;
+
+	for (f = strchr(format, '%'); f && f[1]; f = strchr(f + 2, '%'))
+		n++;
+
+	pf = calloc(1, sizeof(*pf) + n * sizeof(pf->ops[0]));
+	if (!pf)
+		return NULL;
+	pf->format = strdup(format);
+	if (!pf->format) {
+		free(pf);
+		return NULL;
+	}
+
+	start = pf->format;
+	for (p = strchr(start, '%'); p && p[1]; p = strchr(start, '%')) {
+		struct print_op *op = &pf->ops[pf->n_ops++];
+
+		op->lit_off = start - pf->format;
+		op->lit_len = p - start;
+		op->wildcard = p[1];
+		op->col = lookup(p[1]);
+		start = p + 2;
+	}
+	/* a trailing '%' is dropped */
+	if (p)
+		*p = '\0';
+	pf->tail = start;
+	return pf;
+}
+
+static void free_print_format(struct print_format *pf)
+{
+	if (!pf)
+		return;
+	free(pf->format);
+	free(pf);
+}
+
+/*
+ * A table of paths or maps, printed with the same format.
+ * All cells are rendered once, when the table is created. They're
+ * used both for computing the column widths and for printing,
+ * so every wildcard is evaluated only once per row.
+ * The cell for row r and operation k is
+ * cells[offsets[r * n_ops + k]] ... cells[offsets[r * n_ops + k + 1]].
+ */
+struct print_table {
+	struct print_format *pf;
+	bool is_path;
+	fieldwidth_t *width;
+	unsigned int n_rows;
+	unsigned int *offsets;
+	struct strbuf cells;
+};
+
+void free_print_table(struct print_table *t)
+{
+	if (!t)
+		return;
+	free_print_format(t->pf);
+	free(t->width);
+	free(t->offsets);
+	reset_strbuf(&t->cells);
+	free(t);
+}
+
+static struct print_table *alloc_table(const char *format, bool is_path,
+				       unsigned int n_rows, int header)
+{
+	struct print_table *t;
+	unsigned int n_cols = is_path ? ARRAY_SIZE(pd) : ARRAY_SIZE(mpd);
+	unsigned int k;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+	t->is_path = is_path;
+	t->n_rows = n_rows;
+	if (!(t->pf = compile_format(format, is_path ? pd_lookup : mpd_lookup)) ||
+	    !(t->width = calloc(n_cols, sizeof(*t->width))) ||
+	    !(t->offsets = calloc((size_t)n_rows * t->pf->n_ops + 1,
+				  sizeof(*t->offsets)))) {
+		free_print_table(t);
+		return NULL;
+	}
+	for (k = 0; k < n_cols; k++)
+		reset_width(&t->width[k],
+			    header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO,
+			    is_path ? pd[k].header : mpd[k].header);
+	return t;
+}
+
+/* Account for the cell that has just been rendered */
+static void add_cell(struct print_table *t, unsigned int idx)
+{
+	const struct print_op *op = &t->pf->ops[idx % t->pf->n_ops];
+	unsigned int len;
+
+	t->offsets[idx + 1] = get_strbuf_len(&t->cells);
+	len = t->offsets[idx + 1] - t->offsets[idx];
+	if (op->col != -1)
+		t->width[op->col] = MAX(t->width[op->col],
+					MIN(len, MAX_FIELD_WIDTH));
+}
+
+struct print_table *alloc_path_table(const struct vector_s *pathvec,
+				     const char *format, int header)
+{
+	struct print_table *t;
+	const struct path *pp;
+	unsigned int i, k, idx = 0;
+
+	t = alloc_table(format, true, VECTOR_SIZE(pathvec), header);
+	if (!t)
+		return NULL;
+
+	vector_foreach_slot (pathvec, pp, i) {
+		const struct gen_path *gp = dm_path_to_gen(pp);
+
+		for (k = 0; k < t->pf->n_ops; k++, idx++) {
+			const struct print_op *op = &t->pf->ops[k];
+
+			if (op->col != -1 &&
+			    gp->ops->snprint(gp, &t->cells, op->wildcard) < 0) {
+				free_print_table(t);
+				return NULL;
+			}
+			add_cell(t, idx);
+		}
+	}
+	return t;
+}
+
+struct print_table *alloc_multipath_table(const struct vector_s *mpvec,
+					  const char *format, int header)
+{
+	struct print_table *t;
+	const struct multipath *mpp;
+	unsigned int i, k, idx = 0;
+
+	t = alloc_table(format, false, VECTOR_SIZE(mpvec), header);
+	if (!t)
+		return NULL;
+
+	vector_foreach_slot (mpvec, mpp, i) {
+		const struct gen_multipath *gm = dm_multipath_to_gen(mpp);
+
+		for (k = 0; k < t->pf->n_ops; k++, idx++) {
+			const struct print_op *op = &t->pf->ops[k];
+
+			if (op->col != -1 &&
+			    gm->ops->snprint(gm, &t->cells, op->wildcard) < 0) {
+				free_print_table(t);
+				return NULL;
+			}
+			add_cell(t, idx);
+		}
+	}
+	return t;
+}
+
+unsigned int print_table_rows(const struct print_table *t)
+{
+	return t->n_rows;
+}
+
+/* Foreign layouts may be merged into this */
+fieldwidth_t *print_table_width(struct print_table *t)
+{
+	return t->width;
+}
+
+static int snprint_table_cell(struct strbuf *line, const struct print_table *t,
+			      const struct print_op *op, const char *cell,
+			      unsigned int len)
+{
+	int rc;
+
+	if ((rc = append_strbuf_str__(line, t->pf->format + op->lit_off,
+				      op->lit_len)) < 0)
+		return rc;
+	if (op->col == -1)
+		return 0;
+	if ((rc = append_strbuf_str__(line, cell, len)) < 0)
+		return rc;
+	if (len < t->width[op->col] &&
+	    (rc = fill_strbuf(line, ' ', t->width[op->col] - len)) < 0)
+		return rc;
+	return 0;
+}
+
+int snprint_table_header(struct strbuf *line, const struct print_table *t)
+{
+	int initial_len = get_strbuf_len(line);
+	unsigned int k;
+	int rc;
+
+	for (k = 0; k < t->pf->n_ops; k++) {
+		const struct print_op *op = &t->pf->ops[k];
+		const char *hdr = "";
+
+		if (op->col != -1)
+			hdr = t->is_path ? pd[op->col].header :
+				mpd[op->col].header;
+		if ((rc = snprint_table_cell(line, t, op, hdr,
+					     strlen(hdr))) < 0)
+			return rc;
+	}
+
+	if ((rc = print_strbuf(line, "%s\n", t->pf->tail)) < 0)
+		return rc;
+	return get_strbuf_len(line) - initial_len;
+}
+
+int snprint_table_row(struct strbuf *line, const struct print_table *t,
+		      unsigned int row)
+{
+	int initial_len = get_strbuf_len(line);
+	const char *cells = get_strbuf_str(&t->cells);
+	unsigned int k, idx;
+	int rc;
+
+	if (row >= t->n_rows)
+		return -EINVAL;
+
+	for (k = 0; k < t->pf->n_ops; k++) {
+		idx = row * t->pf->n_ops + k;
+		if ((rc = snprint_table_cell(line, t, &t->pf->ops[k],
+					     cells + t->offsets[idx],
+					     t->offsets[idx + 1] -
+					     t->offsets[idx])) < 0)
+			return rc;
+	}
+
+	if ((rc = print_strbuf(line, "%s\n", t->pf->tail)) < 0)
+		return rc;
+	return get_strbuf_len(line) - initial_len;
+}
+
 int snprint_multipath_header(struct strbuf *line, const char *format,
 			     const fieldwidth_t *width)
 {
@@ -1246,7 +1600,8 @@ void print_multipath_topology__(const struct gen_multipath *gmp, int verbosity)
 			pathvec = gpg->ops->get_paths(gpg);
 			if (pathvec == NULL)
 				continue;
-			get_path_layout__(pathvec, LAYOUT_RESET_NOT, p_width);
+			get_path_layout_fmt__(pathvec, LAYOUT_RESET_NOT,
+					      PRINT_PATH_INDENT, p_width);
 			gpg->ops->rel_paths(gpg, pathvec);
 		}
 		gmp->ops->rel_pathgroups(gmp, pgvec);
@@ -1374,8 +1729,9 @@ static int snprint_json_elem_footer(struct strbuf *buff, int indent, bool last)
 		return append_strbuf_str(buff, PRINT_JSON_END_ELEM);
 }
 
-static int snprint_multipath_fields_json(struct strbuf *buff,
-					 const struct multipath *mpp, int last)
+/* Like snprint_multipath_fields_json(), without the element footer */
+static int snprint_multipath_fields_json__(struct strbuf *buff,
+					   const struct multipath *mpp)
 {
 	int i, j, rc;
 	struct path *pp;
@@ -1407,7 +1763,19 @@ static int snprint_multipath_fields_json(struct strbuf *buff,
 			return rc;
 	}
 
-	if ((rc = snprint_json(buff, 0, PRINT_JSON_END_ARRAY)) < 0 ||
+	if ((rc = snprint_json(buff, 0, PRINT_JSON_END_ARRAY)) < 0)
+		return rc;
+
+	return get_strbuf_len(buff) - initial_len;
+}
+
+static int snprint_multipath_fields_json(struct strbuf *buff,
+					 const struct multipath *mpp, int last)
+{
+	size_t initial_len = get_strbuf_len(buff);
+	int rc;
+
+	if ((rc = snprint_multipath_fields_json__(buff, mpp)) < 0 ||
 	    (rc = snprint_json_elem_footer(buff, 1, last)) < 0)
 		return rc;
 
@@ -1433,6 +1801,50 @@ int snprint_multipath_map_json(struct strbuf *buff, const struct multipath * mpp
 	return get_strbuf_len(buff) - initial_len;
 }
 
+int snprint_multipath_topology_json_start(struct strbuf *buff)
+{
+	size_t initial_len = get_strbuf_len(buff);
+	int rc;
+
+	if ((rc = snprint_json_header(buff)) < 0 ||
+	    (rc = snprint_json(buff, 1, PRINT_JSON_START_MAPS)) < 0)
+		return rc;
+
+	return get_strbuf_len(buff) - initial_len;
+}
+
+/*
+ * The footer of the previous map is printed before the next one, so that
+ * the caller doesn't need to know in advance which map is the last one.
+ */
+int snprint_multipath_topology_json_map(struct strbuf *buff,
+					const struct multipath *mpp, bool first)
+{
+	size_t initial_len = get_strbuf_len(buff);
+	int rc;
+
+	if (!first && (rc = snprint_json_elem_footer(buff, 1, false)) < 0)
+		return rc;
+	if ((rc = snprint_multipath_fields_json__(buff, mpp)) < 0)
+		return rc;
+
+	return get_strbuf_len(buff) - initial_len;
+}
+
+int snprint_multipath_topology_json_end(struct strbuf *buff, bool empty)
+{
+	size_t initial_len = get_strbuf_len(buff);
+	int rc;
+
+	if (!empty && (rc = snprint_json_elem_footer(buff, 1, true)) < 0)
+		return rc;
+	if ((rc = snprint_json(buff, 0, PRINT_JSON_END_ARRAY)) < 0 ||
+	    (rc = snprint_json(buff, 0, PRINT_JSON_END_LAST)) < 0)
+		return rc;
+
+	return get_strbuf_len(buff) - initial_len;
+}
+
 int snprint_multipath_topology_json (struct strbuf *buff,
 				     const struct vectors * vecs)
 {
@@ -1441,18 +1853,17 @@ int snprint_multipath_topology_json (struct strbuf *buff,
 	size_t initial_len = get_strbuf_len(buff);
 	int rc;
 
-	if ((rc = snprint_json_header(buff)) < 0 ||
-	    (rc = snprint_json(buff, 1, PRINT_JSON_START_MAPS)) < 0)
+	if ((rc = snprint_multipath_topology_json_start(buff)) < 0)
 		return rc;
 
 	vector_foreach_slot(vecs->mpvec, mpp, i) {
-		if ((rc = snprint_multipath_fields_json(
-			     buff, mpp, i + 1 == VECTOR_SIZE(vecs->mpvec))) < 0)
+		if ((rc = snprint_multipath_topology_json_map(
+			     buff, mpp, i == 0)) < 0)
 			return rc;
 	}
 
-	if ((rc = snprint_json(buff, 0, PRINT_JSON_END_ARRAY)) < 0 ||
-	    (rc = snprint_json(buff, 0, PRINT_JSON_END_LAST)) < 0)
+	if ((rc = snprint_multipath_topology_json_end(
+		     buff, VECTOR_SIZE(vecs->mpvec) == 0)) < 0)
 		return rc;
 
 	return get_strbuf_len(buff) - initial_len;
@@ -1951,6 +2362,83 @@ char *snprint_config(const struct config *conf, int *len,
 	return reply;
 }
 
+void free_config_snapshot(struct config_snapshot *snap)
+{
+	free(snap->global);
+	free(snap->devices);
+	free(snap->overrides);
+	free(snap->mptable);
+	memset(snap, 0, sizeof(*snap));
+}
+
+int snapshot_config(const struct config *conf, struct config_snapshot *snap)
+{
+	STRBUF_ON_STACK(buff);
+	int rc;
+
+	memset(snap, 0, sizeof(*snap));
+	if ((rc = snprint_defaults(conf, &buff)) < 0 ||
+	    (rc = snprint_blacklist(conf, &buff)) < 0 ||
+	    (rc = snprint_blacklist_except(conf, &buff)) < 0)
+		goto fail;
+	snap->global = steal_strbuf_str(&buff);
+
+	if ((rc = snprint_hwtable(conf, &buff, conf->hwtable)) < 0)
+		goto fail;
+	snap->devices = steal_strbuf_str(&buff);
+
+	if ((rc = snprint_overrides(conf, &buff, conf->overrides)) < 0)
+		goto fail;
+	snap->overrides = steal_strbuf_str(&buff);
+
+	if ((rc = snprint_mptable(conf, &buff, NULL)) < 0)
+		goto fail;
+	snap->mptable = steal_strbuf_str(&buff);
+
+	if (!snap->global || !snap->devices || !snap->overrides ||
+	    !snap->mptable) {
+		rc = -ENOMEM;
+		goto fail;
+	}
+	return 0;
+fail:
+	free_config_snapshot(snap);
+	return rc;
+}
+
+bool hwes_differ(const struct config *conf, const struct vector_s *old_hwe,
+		 const struct vector_s *new_hwe)
+{
+	STRBUF_ON_STACK(old_buf);
+	STRBUF_ON_STACK(new_buf);
+	const struct hwentry *hwe;
+	int i;
+
+	if (VECTOR_SIZE(old_hwe) != VECTOR_SIZE(new_hwe))
+		return true;
+	vector_foreach_slot(old_hwe, hwe, i)
+		if (snprint_hwentry(conf, &old_buf, hwe) < 0)
+			return true;
+	vector_foreach_slot(new_hwe, hwe, i)
+		if (snprint_hwentry(conf, &new_buf, hwe) < 0)
+			return true;
+	return strcmp(get_strbuf_str(&old_buf), get_strbuf_str(&new_buf));
+}
+
+bool mpes_differ(const struct config *conf, const struct mpentry *old_mpe,
+		 const struct mpentry *new_mpe)
+{
+	STRBUF_ON_STACK(old_buf);
+	STRBUF_ON_STACK(new_buf);
+
+	if (!old_mpe || !new_mpe)
+		return old_mpe != new_mpe;
+	if (snprint_mpentry(conf, &old_buf, old_mpe, NULL) < 0 ||
+	    snprint_mpentry(conf, &new_buf, new_mpe, NULL) < 0)
+		return true;
+	return strcmp(get_strbuf_str(&old_buf), get_strbuf_str(&new_buf));
+}
+
 int snprint_status(struct strbuf *buff, const struct vectors *vecs)
 {
 	int i, rc;
@@ -3,9 +3,11 @@
 #include "dm-generic.h"
 
 #define PRINT_PATH_CHECKER   "%i %d %D %p %t %T %o %C"
+#define PRINT_PATH_LATENCY   "%i %d %D %m %T %c %l %q %x"
 #define PRINT_MAP_STATUS     "%n %F %Q %N %t %r"
 #define PRINT_MAP_STATS      "%n %0 %1 %2 %3 %4"
 #define PRINT_MAP_NAMES      "%n %d %w"
+#define PRINT_PATH_INDENT    "%i %d %D %t %T %o"
 
 struct strbuf;
 
@@ -20,10 +22,33 @@ fieldwidth_t *alloc_path_layout(void);
 void get_path_layout__ (const struct vector_s *gpvec, enum layout_reset,
 		       fieldwidth_t *width);
 void get_path_layout (vector pathvec, int header, fieldwidth_t *width);
+/* Like the above, computing only the columns used in format */
+void get_path_layout_fmt__ (const struct vector_s *gpvec, enum layout_reset,
+			    const char *format, fieldwidth_t *width);
+void get_path_layout_fmt (vector pathvec, int header, const char *format,
+			  fieldwidth_t *width);
 fieldwidth_t *alloc_multipath_layout(void);
 void get_multipath_layout__ (const struct vector_s *gmvec, enum layout_reset,
 			    fieldwidth_t *width);
 void get_multipath_layout (vector mpvec, int header, fieldwidth_t *width);
+void get_multipath_layout_fmt__ (const struct vector_s *gmvec,
+				 enum layout_reset, const char *format,
+				 fieldwidth_t *width);
+void get_multipath_layout_fmt (vector mpvec, int header, const char *format,
+			       fieldwidth_t *width);
+
+/* Tables of paths or maps, with cells rendered only once */
+struct print_table;
+struct print_table *alloc_path_table(const struct vector_s *pathvec,
+				     const char *format, int header);
+struct print_table *alloc_multipath_table(const struct vector_s *mpvec,
+					  const char *format, int header);
+void free_print_table(struct print_table *t);
+unsigned int print_table_rows(const struct print_table *t);
+fieldwidth_t *print_table_width(struct print_table *t);
+int snprint_table_header(struct strbuf *, const struct print_table *t);
+int snprint_table_row(struct strbuf *, const struct print_table *t,
+		      unsigned int row);
 int snprint_path_header(struct strbuf *, const char *, const fieldwidth_t *);
 int snprint_multipath_header(struct strbuf *, const char *,
 			     const fieldwidth_t *);
@@ -40,8 +65,35 @@ int snprint_multipath_topology__ (const struct gen_multipath *, struct strbuf *,
 #define snprint_multipath_topology(buf, mpp, v, w)			\
 	snprint_multipath_topology__ (dm_multipath_to_gen(mpp), buf, v, w)
 int snprint_multipath_topology_json(struct strbuf *, const struct vectors *vecs);
+/* Print the JSON topology piecewise: start, each map, end */
+int snprint_multipath_topology_json_start(struct strbuf *);
+int snprint_multipath_topology_json_map(struct strbuf *,
+					const struct multipath *mpp, bool first);
+int snprint_multipath_topology_json_end(struct strbuf *, bool empty);
 int snprint_config__(const struct config *conf, struct strbuf *buff,
 		     const struct vector_s *hwtable, const struct vector_s *mpvec);
+
+/*
+ * Configuration sections as text, compared by multipathd to find out
+ * what changed when it's reconfigured. snapshot_config() must be called
+ * while @conf is the current configuration, because the defaults and
+ * overrides sections are printed from the current configuration.
+ */
+struct mpentry;
+struct config_snapshot {
+	/* defaults, blacklist and blacklist_exceptions */
+	char *global;
+	char *devices;
+	char *overrides;
+	char *mptable;
+};
+int snapshot_config(const struct config *conf, struct config_snapshot *snap);
+void free_config_snapshot(struct config_snapshot *snap);
+/* Compare hwtable entry lists or multipaths entries by their settings */
+bool hwes_differ(const struct config *conf, const struct vector_s *old_hwe,
+		 const struct vector_s *new_hwe);
+bool mpes_differ(const struct config *conf, const struct mpentry *old_mpe,
+		 const struct mpentry *new_mpe);
 char *snprint_config(const struct config *conf, int *len,
 		     const struct vector_s *hwtable,
 		     const struct vector_s *mpvec);
@@ -4,6 +4,7 @@
  * Copyright (c) 2005 Kiyoshi Ueda, NEC
  */
 #include <stdio.h>
+#include <pthread.h>
 
 #include "autoconfig.h"
 #include "nvme-lib.h"
@@ -172,6 +173,249 @@ do {									\
 	}								\
 } while (0)
 
+/*
+ * Most map settings are resolved from the multipaths entry, the
+ * overrides, the hwtable entries and the defaults, in this order, and
+ * nothing else. Most maps share the same multipaths entry (none) and
+ * hwtable entries, so these settings are resolved once per distinct
+ * (mpe, hwe) tuple and configuration, and cached in a profile.
+ * setup_map() sets mp->profile while it holds the configuration.
+ *
+ * MPE_PROFILE_ATTRS can be set in the multipaths section,
+ * HWE_PROFILE_ATTRS can't.
+ */
+#define MPE_PROFILE_ATTRS(X)						\
+	X(pgfailback, DEFAULT_FAILBACK)					\
+	X(pgpolicy, DEFAULT_PGPOLICY)					\
+	X(selector, DEFAULT_SELECTOR)					\
+	X(features, DEFAULT_FEATURES)					\
+	X(minio, DEFAULT_MINIO)						\
+	X(flush_on_last_del, DEFAULT_FLUSH)				\
+	X(deferred_remove, DEFAULT_DEFERRED_REMOVE)			\
+	X(san_path_err_threshold, DEFAULT_ERR_CHECKS)			\
+	X(san_path_err_forget_rate, DEFAULT_ERR_CHECKS)			\
+	X(san_path_err_recovery_time, DEFAULT_ERR_CHECKS)		\
+	X(marginal_path_err_sample_time, DEFAULT_ERR_CHECKS)		\
+	X(marginal_path_err_rate_threshold, DEFAULT_ERR_CHECKS)		\
+	X(marginal_path_err_recheck_gap_time, DEFAULT_ERR_CHECKS)	\
+	X(marginal_path_double_failed_time, DEFAULT_ERR_CHECKS)		\
+	X(skip_kpartx, DEFAULT_SKIP_KPARTX)				\
+	X(purge_disconnected, DEFAULT_PURGE_DISCONNECTED)		\
+	X(max_sectors_kb, DEFAULT_MAX_SECTORS_KB)			\
+	X(ghost_delay, DEFAULT_GHOST_DELAY)
+
+#define HWE_PROFILE_ATTRS(X)						\
+	X(detect_pgpolicy, DEFAULT_DETECT_PGPOLICY)			\
+	X(detect_pgpolicy_use_tpg, DEFAULT_DETECT_PGPOLICY_USE_TPG)	\
+	X(retain_hwhandler, DEFAULT_RETAIN_HWHANDLER)
+
+#define profile_type(var) typeof(((struct multipath *)0)->var)
+
+#define define_resolver(var, def, set_mpe)				\
+static const char *							\
+resolve_##var(const struct config *conf, const struct mpentry *mpe,	\
+	      const struct vector_s *hwe, profile_type(var) *val)	\
+{									\
+	const char *origin;						\
+									\
+	set_mpe;							\
+	do_set(var, conf->overrides, *val, overrides_origin);		\
+	if (hwe && do_set_from_vec__(struct hwentry, var, hwe, *val)) {	\
+		origin = hwe_origin;					\
+		goto out;						\
+	}								\
+	do_set(var, conf, *val, conf_origin);				\
+	do_default(*val, def);						\
+out:									\
+	return origin;							\
+}
+
+#define mpe_resolver(var, def)						\
+	define_resolver(var, def,					\
+			do_set(var, mpe, *val, multipaths_origin))
+#define hwe_resolver(var, def)						\
+	define_resolver(var, def, (void)mpe)
+
+MPE_PROFILE_ATTRS(mpe_resolver)
+HWE_PROFILE_ATTRS(hwe_resolver)
+
+#define profile_field(var, def)						\
+	profile_type(var) var;						\
+	const char *var##_origin;
+
+struct propsel_profile {
+	struct propsel_profile *next;
+	unsigned int hash;
+	const struct mpentry *mpe;
+	int n_hwe;
+	const struct hwentry **hwe;
+	MPE_PROFILE_ATTRS(profile_field)
+	HWE_PROFILE_ATTRS(profile_field)
+};
+
+struct propsel_cache {
+	unsigned int n_buckets;
+	unsigned int n_profiles;
+	struct propsel_profile **buckets;
+};
+
+/* Protects the caches of all configurations */
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Resolve setting @var for @mp, from the profile if possible */
+#define mp_resolve(var)							\
+	(mp->profile ?							\
+	 (mp->var = mp->profile->var, mp->profile->var##_origin) :	\
+	 resolve_##var(conf, mp->mpe, mp->hwe, &mp->var))
+
+static unsigned int profile_hash(const struct mpentry *mpe,
+				 const struct vector_s *hwe)
+{
+	unsigned int h = 2166136261U;
+	const struct hwentry *e;
+	int i;
+
+	h = (h ^ (unsigned int)((uintptr_t)mpe >> 4)) * 16777619U;
+	vector_foreach_slot(hwe, e, i)
+		h = (h ^ (unsigned int)((uintptr_t)e >> 4)) * 16777619U;
+	return h;
+}
+
+static bool profile_matches(const struct propsel_profile *prof,
+			    unsigned int hash, const struct mpentry *mpe,
+			    const struct vector_s *hwe)
+{
+	int i;
+
+	if (prof->hash != hash || prof->mpe != mpe ||
+	    prof->n_hwe != VECTOR_SIZE(hwe))
+		return false;
+	for (i = 0; i < prof->n_hwe; i++)
+		if (prof->hwe[i] != VECTOR_SLOT(hwe, i))
+			return false;
+	return true;
+}
+
+static struct propsel_profile *
+alloc_profile(const struct config *conf, unsigned int hash,
+	      const struct mpentry *mpe, const struct vector_s *hwe)
+{
+	struct propsel_profile *prof;
+	int i;
+
+	prof = calloc(1, sizeof(*prof));
+	if (!prof)
+		return NULL;
+	prof->n_hwe = VECTOR_SIZE(hwe);
+	if (prof->n_hwe > 0) {
+		prof->hwe = calloc(prof->n_hwe, sizeof(*prof->hwe));
+		if (!prof->hwe) {
+			free(prof);
+			return NULL;
+		}
+		for (i = 0; i < prof->n_hwe; i++)
+			prof->hwe[i] = VECTOR_SLOT(hwe, i);
+	}
+	prof->hash = hash;
+	prof->mpe = mpe;
+
+#define resolve_field(var, def)						\
+	prof->var##_origin = resolve_##var(conf, mpe, hwe, &prof->var);
+	MPE_PROFILE_ATTRS(resolve_field)
+	HWE_PROFILE_ATTRS(resolve_field)
+#undef resolve_field
+	return prof;
+}
+
+static void free_profile(struct propsel_profile *prof)
+{
+	free(prof->hwe);
+	free(prof);
+}
+
+void free_propsel_cache(struct propsel_cache *cache)
+{
+	struct propsel_profile *prof, *next;
+	unsigned int b;
+
+	if (!cache)
+		return;
+	for (b = 0; b < cache->n_buckets; b++)
+		for (prof = cache->buckets[b]; prof; prof = next) {
+			next = prof->next;
+			free_profile(prof);
+		}
+	free(cache->buckets);
+	free(cache);
+}
+
+static struct propsel_cache *alloc_propsel_cache(void)
+{
+	struct propsel_cache *cache = calloc(1, sizeof(*cache));
+
+	if (!cache)
+		return NULL;
+	cache->n_buckets = 64;
+	cache->buckets = calloc(cache->n_buckets, sizeof(*cache->buckets));
+	if (!cache->buckets) {
+		free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+/* Double the number of buckets. On allocation failure, just keep going */
+static void grow_propsel_cache(struct propsel_cache *cache)
+{
+	unsigned int n = 2 * cache->n_buckets, b;
+	struct propsel_profile **buckets, *prof, *next;
+
+	buckets = calloc(n, sizeof(*buckets));
+	if (!buckets)
+		return;
+	for (b = 0; b < cache->n_buckets; b++)
+		for (prof = cache->buckets[b]; prof; prof = next) {
+			next = prof->next;
+			prof->next = buckets[prof->hash & (n - 1)];
+			buckets[prof->hash & (n - 1)] = prof;
+		}
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->n_buckets = n;
+}
+
+const struct propsel_profile *
+get_propsel_profile(struct config *conf, const struct mpentry *mpe,
+		    const struct vector_s *hwe)
+{
+	struct propsel_profile *prof = NULL, **bucket;
+	struct propsel_cache *cache;
+	unsigned int hash = profile_hash(mpe, hwe);
+
+	pthread_mutex_lock(&profile_lock);
+	if (!conf->propsel_cache)
+		conf->propsel_cache = alloc_propsel_cache();
+	cache = conf->propsel_cache;
+	if (!cache)
+		goto out;
+
+	bucket = &cache->buckets[hash & (cache->n_buckets - 1)];
+	for (prof = *bucket; prof; prof = prof->next)
+		if (profile_matches(prof, hash, mpe, hwe))
+			goto out;
+
+	prof = alloc_profile(conf, hash, mpe, hwe);
+	if (!prof)
+		goto out;
+	prof->next = *bucket;
+	*bucket = prof;
+	if (++cache->n_profiles > cache->n_buckets)
+		grow_propsel_cache(cache);
+out:
+	pthread_mutex_unlock(&profile_lock);
+	return prof;
+}
+
 int select_mode(struct config *conf, struct multipath *mp)
 {
 	const char *origin;
@@ -216,12 +460,7 @@ int select_pgfailback(struct config *conf, struct multipath * mp)
 	const char *origin;
 	STRBUF_ON_STACK(buff);
 
-	mp_set_mpe(pgfailback);
-	mp_set_ovr(pgfailback);
-	mp_set_hwe(pgfailback);
-	mp_set_conf(pgfailback);
-	mp_set_default(pgfailback, DEFAULT_FAILBACK);
-out:
+	origin = mp_resolve(pgfailback);
 	print_pgfailback(&buff, mp->pgfailback);
 	condlog(3, "%s: failback = %s %s", mp->alias,
 		get_strbuf_str(&buff), origin);
@@ -251,11 +490,7 @@ int select_detect_pgpolicy(struct config *conf, struct multipath *mp)
 {
 	const char *origin;
 
-	mp_set_ovr(detect_pgpolicy);
-	mp_set_hwe(detect_pgpolicy);
-	mp_set_conf(detect_pgpolicy);
-	mp_set_default(detect_pgpolicy, DEFAULT_DETECT_PGPOLICY);
-out:
+	origin = mp_resolve(detect_pgpolicy);
 	condlog(3, "%s: detect_pgpolicy = %s %s", mp->alias,
 		(mp->detect_pgpolicy == DETECT_PGPOLICY_ON)? "yes" : "no",
 		 origin);
@@ -266,12 +501,7 @@ int select_detect_pgpolicy_use_tpg(struct config *conf, struct multipath *mp)
 {
 	const char *origin;
 
-	mp_set_ovr(detect_pgpolicy_use_tpg);
-	mp_set_hwe(detect_pgpolicy_use_tpg);
-	mp_set_conf(detect_pgpolicy_use_tpg);
-	mp_set_default(detect_pgpolicy_use_tpg,
-		       DEFAULT_DETECT_PGPOLICY_USE_TPG);
-out:
+	origin = mp_resolve(detect_pgpolicy_use_tpg);
 	condlog(3, "%s: detect_pgpolicy_use_tpg = %s %s", mp->alias,
 		(mp->detect_pgpolicy_use_tpg == DETECT_PGPOLICY_USE_TPG_ON)?
 		"yes" : "no", origin);
@@ -296,11 +526,7 @@ int select_pgpolicy(struct config *conf, struct multipath * mp)
 		origin = autodetect_origin;
 		goto out;
 	}
-	mp_set_mpe(pgpolicy);
-	mp_set_ovr(pgpolicy);
-	mp_set_hwe(pgpolicy);
-	mp_set_conf(pgpolicy);
-	mp_set_default(pgpolicy, DEFAULT_PGPOLICY);
+	origin = mp_resolve(pgpolicy);
 out:
 	if (mp->pgpolicy == GROUP_BY_TPG && origin != autodetect_origin &&
 	    !verify_alua_prio(mp)) {
@@ -318,12 +544,7 @@ int select_selector(struct config *conf, struct multipath * mp)
 {
 	const char *origin;
 
-	mp_set_mpe(selector);
-	mp_set_ovr(selector);
-	mp_set_hwe(selector);
-	mp_set_conf(selector);
-	mp_set_default(selector, DEFAULT_SELECTOR);
-out:
+	origin = mp_resolve(selector);
 	mp->selector = strdup(mp->selector);
 	condlog(3, "%s: path_selector = \"%s\" %s", mp->alias, mp->selector,
 		origin);
@@ -511,12 +732,7 @@ int select_features(struct config *conf, struct multipath *mp)
 {
 	const char *origin;
 
-	mp_set_mpe(features);
-	mp_set_ovr(features);
-	mp_set_hwe(features);
-	mp_set_conf(features);
-	mp_set_default(features, DEFAULT_FEATURES);
-out:
+	origin = mp_resolve(features);
 	mp->features = strdup(mp->features);
 
 	reconcile_features_with_options(mp->alias, &mp->features,
@@ -859,12 +1075,7 @@ select_minio_bio (struct config *conf, struct multipath * mp)
 {
 	const char *origin;
 
-	mp_set_mpe(minio);
-	mp_set_ovr(minio);
-	mp_set_hwe(minio);
-	mp_set_conf(minio);
-	mp_set_default(minio, DEFAULT_MINIO);
-out:
+	origin = mp_resolve(minio);
 	condlog(3, "%s: minio = %i %s", mp->alias, mp->minio, origin);
 	return 0;
 }
@@ -937,12 +1148,7 @@ int select_flush_on_last_del(struct config *conf, struct multipath *mp)
 	const char *origin;
 	STRBUF_ON_STACK(buff);
 
-	mp_set_mpe(flush_on_last_del);
-	mp_set_ovr(flush_on_last_del);
-	mp_set_hwe(flush_on_last_del);
-	mp_set_conf(flush_on_last_del);
-	mp_set_default(flush_on_last_del, DEFAULT_FLUSH);
-out:
+	origin = mp_resolve(flush_on_last_del);
 	print_flush_on_last_del(&buff, mp->flush_on_last_del);
 	condlog(3, "%s: flush_on_last_del = %s %s", mp->alias,
 		get_strbuf_str(&buff), origin);
@@ -993,10 +1199,7 @@ int select_retain_hwhandler(struct config *conf, struct multipath *mp)
 		origin = "(setting: implied in kernel >= 4.3.0)";
 		goto out;
 	}
-	mp_set_ovr(retain_hwhandler);
-	mp_set_hwe(retain_hwhandler);
-	mp_set_conf(retain_hwhandler);
-	mp_set_default(retain_hwhandler, DEFAULT_RETAIN_HWHANDLER);
+	origin = mp_resolve(retain_hwhandler);
 out:
 	condlog(3, "%s: retain_attached_hw_handler = %s %s", mp->alias,
 		(mp->retain_hwhandler == RETAIN_HWHANDLER_ON)? "yes" : "no",
@@ -1040,18 +1243,13 @@ int select_deferred_remove(struct config *conf, struct multipath *mp)
 #ifndef LIBDM_API_DEFERRED
 	mp->deferred_remove = DEFERRED_REMOVE_OFF;
 	origin = "(setting: WARNING, not compiled with support)";
-	goto out;
-#endif
+#else
 	if (mp->deferred_remove == DEFERRED_REMOVE_IN_PROGRESS) {
 		condlog(3, "%s: deferred remove in progress", mp->alias);
 		return 0;
 	}
-	mp_set_mpe(deferred_remove);
-	mp_set_ovr(deferred_remove);
-	mp_set_hwe(deferred_remove);
-	mp_set_conf(deferred_remove);
-	mp_set_default(deferred_remove, DEFAULT_DEFERRED_REMOVE);
-out:
+	origin = mp_resolve(deferred_remove);
+#endif
 	condlog(3, "%s: deferred_remove = %s %s", mp->alias,
 		(mp->deferred_remove == DEFERRED_REMOVE_ON)? "yes" : "no",
 		origin);
@@ -1159,11 +1357,7 @@ int select_san_path_err_threshold(struct config *conf, struct multipath *mp)
 			origin = marginal_path_origin;
 		goto out;
 	}
-	mp_set_mpe(san_path_err_threshold);
-	mp_set_ovr(san_path_err_threshold);
-	mp_set_hwe(san_path_err_threshold);
-	mp_set_conf(san_path_err_threshold);
-	mp_set_default(san_path_err_threshold, DEFAULT_ERR_CHECKS);
+	origin = mp_resolve(san_path_err_threshold);
 out:
 	if (print_off_int_undef(&buff, mp->san_path_err_threshold) > 0)
 		condlog(3, "%s: san_path_err_threshold = %s %s",
@@ -1185,11 +1379,7 @@ int select_san_path_err_forget_rate(struct config *conf, struct multipath *mp)
 			origin = marginal_path_origin;
 		goto out;
 	}
-	mp_set_mpe(san_path_err_forget_rate);
-	mp_set_ovr(san_path_err_forget_rate);
-	mp_set_hwe(san_path_err_forget_rate);
-	mp_set_conf(san_path_err_forget_rate);
-	mp_set_default(san_path_err_forget_rate, DEFAULT_ERR_CHECKS);
+	origin = mp_resolve(san_path_err_forget_rate);
 out:
 	if (print_off_int_undef(&buff, mp->san_path_err_forget_rate) > 0)
 		condlog(3, "%s: san_path_err_forget_rate = %s %s",
@@ -1212,11 +1402,7 @@ int select_san_path_err_recovery_time(struct config *conf, struct multipath *mp)
 			origin = marginal_path_origin;
 		goto out;
 	}
-	mp_set_mpe(san_path_err_recovery_time);
-	mp_set_ovr(san_path_err_recovery_time);
-	mp_set_hwe(san_path_err_recovery_time);
-	mp_set_conf(san_path_err_recovery_time);
-	mp_set_default(san_path_err_recovery_time, DEFAULT_ERR_CHECKS);
+	origin = mp_resolve(san_path_err_recovery_time);
 out:
 	if (print_off_int_undef(&buff, mp->san_path_err_recovery_time) != 0)
 		condlog(3, "%s: san_path_err_recovery_time = %s %s", mp->alias,
@@ -1237,11 +1423,7 @@ int select_marginal_path_err_sample_time(struct config *conf, struct multipath *
 		goto out;
 	}
 
-	mp_set_mpe(marginal_path_err_sample_time);
-	mp_set_ovr(marginal_path_err_sample_time);
-	mp_set_hwe(marginal_path_err_sample_time);
-	mp_set_conf(marginal_path_err_sample_time);
-	mp_set_default(marginal_path_err_sample_time, DEFAULT_ERR_CHECKS);
+	origin = mp_resolve(marginal_path_err_sample_time);
 out:
 	if (mp->marginal_path_err_sample_time > 0 &&
 	    mp->marginal_path_err_sample_time < 2 * IOTIMEOUT_SEC) {
@@ -1266,11 +1448,7 @@ int select_marginal_path_err_rate_threshold(struct config *conf, struct multipat
 		goto out;
 	}
 
-	mp_set_mpe(marginal_path_err_rate_threshold);
-	mp_set_ovr(marginal_path_err_rate_threshold);
-	mp_set_hwe(marginal_path_err_rate_threshold);
-	mp_set_conf(marginal_path_err_rate_threshold);
-	mp_set_default(marginal_path_err_rate_threshold, DEFAULT_ERR_CHECKS);
+	origin = mp_resolve(marginal_path_err_rate_threshold);
 out:
 	if (print_off_int_undef(&buff, mp->marginal_path_err_rate_threshold) > 0)
 		condlog(3, "%s: marginal_path_err_rate_threshold = %s %s",
@@ -1289,11 +1467,7 @@ int select_marginal_path_err_recheck_gap_time(struct config *conf, struct multip
 		goto out;
 	}
 
-	mp_set_mpe(marginal_path_err_recheck_gap_time);
-	mp_set_ovr(marginal_path_err_recheck_gap_time);
-	mp_set_hwe(marginal_path_err_recheck_gap_time);
-	mp_set_conf(marginal_path_err_recheck_gap_time);
-	mp_set_default(marginal_path_err_recheck_gap_time, DEFAULT_ERR_CHECKS);
+	origin = mp_resolve(marginal_path_err_recheck_gap_time);
 out:
 	if (print_off_int_undef(&buff,
 				mp->marginal_path_err_recheck_gap_time) > 0)
@@ -1313,11 +1487,7 @@ int select_marginal_path_double_failed_time(struct config *conf, struct multipat
 		goto out;
 	}
 
-	mp_set_mpe(marginal_path_double_failed_time);
-	mp_set_ovr(marginal_path_double_failed_time);
-	mp_set_hwe(marginal_path_double_failed_time);
-	mp_set_conf(marginal_path_double_failed_time);
-	mp_set_default(marginal_path_double_failed_time, DEFAULT_ERR_CHECKS);
+	origin = mp_resolve(marginal_path_double_failed_time);
 out:
 	if (print_off_int_undef(&buff, mp->marginal_path_double_failed_time) > 0)
 		condlog(3, "%s: marginal_path_double_failed_time = %s %s",
@@ -1329,12 +1499,7 @@ int select_skip_kpartx (struct config *conf, struct multipath * mp)
 {
 	const char *origin;
 
-	mp_set_mpe(skip_kpartx);
-	mp_set_ovr(skip_kpartx);
-	mp_set_hwe(skip_kpartx);
-	mp_set_conf(skip_kpartx);
-	mp_set_default(skip_kpartx, DEFAULT_SKIP_KPARTX);
-out:
+	origin = mp_resolve(skip_kpartx);
 	condlog(3, "%s: skip_kpartx = %s %s", mp->alias,
 		(mp->skip_kpartx == SKIP_KPARTX_ON)? "yes" : "no",
 		origin);
@@ -1345,12 +1510,7 @@ int select_purge_disconnected(struct config *conf, struct multipath *mp)
 {
 	const char *origin;
 
-	mp_set_mpe(purge_disconnected);
-	mp_set_ovr(purge_disconnected);
-	mp_set_hwe(purge_disconnected);
-	mp_set_conf(purge_disconnected);
-	mp_set_default(purge_disconnected, DEFAULT_PURGE_DISCONNECTED);
-out:
+	origin = mp_resolve(purge_disconnected);
 	condlog(3, "%s: purge_disconnected = %s %s", mp->alias,
 		(mp->purge_disconnected == PURGE_DISCONNECTED_ON) ? "yes" : "no",
 		origin);
@@ -1361,18 +1521,14 @@ int select_max_sectors_kb(struct config *conf, struct multipath * mp)
 {
 	const char *origin;
 
-	mp_set_mpe(max_sectors_kb);
-	mp_set_ovr(max_sectors_kb);
-	mp_set_hwe(max_sectors_kb);
-	mp_set_conf(max_sectors_kb);
-	mp_set_default(max_sectors_kb, DEFAULT_MAX_SECTORS_KB);
+	origin = mp_resolve(max_sectors_kb);
 	/*
 	 * In the default case, we will not modify max_sectors_kb in sysfs
 	 * (see sysfs_set_max_sectors_kb()).
 	 * Don't print a log message here to avoid user confusion.
 	 */
-	return 0;
-out:
+	if (origin == default_origin)
+		return 0;
 	condlog(3, "%s: max_sectors_kb = %i %s", mp->alias, mp->max_sectors_kb,
 		origin);
 	return 0;
@@ -1383,12 +1539,7 @@ int select_ghost_delay (struct config *conf, struct multipath * mp)
 	const char *origin;
 	STRBUF_ON_STACK(buff);
 
-	mp_set_mpe(ghost_delay);
-	mp_set_ovr(ghost_delay);
-	mp_set_hwe(ghost_delay);
-	mp_set_conf(ghost_delay);
-	mp_set_default(ghost_delay, DEFAULT_GHOST_DELAY);
-out:
+	origin = mp_resolve(ghost_delay);
 	if (print_off_int_undef(&buff, mp->ghost_delay) != 0)
 		condlog(3, "%s: ghost_delay = %s %s", mp->alias,
 			get_strbuf_str(&buff), origin);
@@ -1,5 +1,16 @@
 #ifndef PROPSEL_H_INCLUDED
 #define PROPSEL_H_INCLUDED
+struct propsel_profile;
+struct propsel_cache;
+/*
+ * get_propsel_profile(): settings resolved for @mpe and @hwe, cached in
+ * @conf. Returns NULL on allocation failure. The profile is valid as
+ * long as @conf is.
+ */
+const struct propsel_profile *
+get_propsel_profile(struct config *conf, const struct mpentry *mpe,
+		    const struct vector_s *hwe);
+void free_propsel_cache(struct propsel_cache *cache);
 int select_pgfailback (struct config *conf, struct multipath * mp);
 int select_detect_pgpolicy (struct config *conf, struct multipath * mp);
 int select_detect_pgpolicy_use_tpg (struct config *conf, struct multipath * mp);
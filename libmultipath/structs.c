@@ -7,10 +7,13 @@
 #include <libdevmapper.h>
 #include "mt-udev-wrap.h"
 #include <ctype.h>
+#include <urcu/uatomic.h>
 
 #include "checkers.h"
 #include "vector.h"
 #include "util.h"
+#include "mempool.h"
+#include "strpool.h"
 #include "structs.h"
 #include "config.h"
 #include "debug.h"
@@ -45,6 +48,24 @@ const char * const protocol_name[LAST_BUS_PROTOCOL_ID + 1] = {
 	[SYSFS_BUS_NVME + NVME_PROTOCOL_UNSPEC] = "nvme:unspec",
 };
 
+/*
+ * Paths, path groups and maps are freed and reallocated in bulk during
+ * rescans and fabric events. Allocate them from type-specific slab caches.
+ */
+static struct mempool path_pool =
+	MEMPOOL_INIT("path", struct path, 1024);
+static struct mempool pathgroup_pool =
+	MEMPOOL_INIT("pathgroup", struct pathgroup, 1024);
+static struct mempool multipath_pool =
+	MEMPOOL_INIT("multipath", struct multipath, 256);
+
+static unsigned long obj_seqno;
+
+static unsigned long next_seqno(void)
+{
+	return uatomic_add_return(&obj_seqno, 1);
+}
+
 struct adapter_group *
 alloc_adaptergroup(void)
 {
@@ -114,9 +135,10 @@ alloc_path (void)
 {
 	struct path * pp;
 
-	pp = (struct path *)calloc(1, sizeof(struct path));
+	pp = mempool_alloc(&path_pool);
 
 	if (pp) {
+		pp->seqno = next_seqno();
 		pp->initialized = INIT_NEW;
 		pp->sg_id.host_no = -1;
 		pp->sg_id.channel = -1;
@@ -128,11 +150,15 @@ alloc_path (void)
 		pp->tpg_id = GROUP_ID_UNDEF;
 		pp->priority = PRIO_UNDEF;
 		pp->checkint = CHECKINT_UNDEF;
+		pp->vendor_id = get_interned_str(NULL);
+		pp->product_id = get_interned_str(NULL);
+		pp->rev = get_interned_str(NULL);
+		pp->tgt_node_name = get_interned_str(NULL);
 		checker_clear(&pp->checker);
 		dm_path_to_gen(pp)->ops = &dm_gen_path_ops;
 		pp->hwe = vector_alloc();
 		if (pp->hwe == NULL) {
-			free(pp);
+			mempool_free(&path_pool, pp);
 			return NULL;
 		}
 	}
@@ -181,10 +207,15 @@ free_path (struct path * pp)
 	}
 	if (pp->vpd_data)
 		free(pp->vpd_data);
+	free(pp->sysfs_state_path);
+	put_interned_str(pp->vendor_id);
+	put_interned_str(pp->product_id);
+	put_interned_str(pp->rev);
+	put_interned_str(pp->tgt_node_name);
 
 	vector_free(pp->hwe);
 
-	free(pp);
+	mempool_free(&path_pool, pp);
 }
 
 void
@@ -213,7 +244,7 @@ alloc_pathgroup (void)
 {
 	struct pathgroup * pgp;
 
-	pgp = (struct pathgroup *)calloc(1, sizeof(struct pathgroup));
+	pgp = mempool_alloc(&pathgroup_pool);
 
 	if (!pgp)
 		return NULL;
@@ -221,7 +252,7 @@ alloc_pathgroup (void)
 	pgp->paths = vector_alloc();
 
 	if (!pgp->paths) {
-		free(pgp);
+		mempool_free(&pathgroup_pool, pgp);
 		return NULL;
 	}
 
@@ -235,7 +266,7 @@ void free_pathgroup(struct pathgroup *pgp)
 		return;
 
 	free_pathvec(pgp->paths, KEEP_PATHS);
-	free(pgp);
+	mempool_free(&pathgroup_pool, pgp);
 }
 
 void free_pgvec(vector pgvec)
@@ -257,9 +288,10 @@ alloc_multipath (void)
 {
 	struct multipath * mpp;
 
-	mpp = (struct multipath *)calloc(1, sizeof(struct multipath));
+	mpp = mempool_alloc(&multipath_pool);
 
 	if (mpp) {
+		mpp->seqno = next_seqno();
 		mpp->bestpg = 1;
 		SET_INVALID_MPCONTEXT(mpp->mpcontext);
 		mpp->no_path_retry = NO_PATH_RETRY_UNDEF;
@@ -330,7 +362,7 @@ void free_multipath(struct multipath *mpp)
 		vector_free(mpp->hwe);
 		mpp->hwe = NULL;
 	}
-	free(mpp);
+	mempool_free(&multipath_pool, mpp);
 }
 
 void cleanup_multipath(struct multipath **pmpp)
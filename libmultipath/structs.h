@@ -2,6 +2,7 @@
 #define STRUCTS_H_INCLUDED
 
 #include <sys/types.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <libdevmapper.h>
@@ -9,6 +10,7 @@
 #include "prio.h"
 #include "byteorder.h"
 #include "generic.h"
+#include "histogram.h"
 
 #define WWID_SIZE		128
 #define SERIAL_SIZE		128
@@ -340,6 +342,13 @@ enum check_path_states {
 	CHECK_PATH_REMOVED,
 };
 
+/* fail/reinstate message for a path, deferred by the path checker */
+enum path_msg {
+	PATH_MSG_NONE,
+	PATH_MSG_FAIL,
+	PATH_MSG_REINSTATE,
+};
+
 struct vpd_vendor_page {
 	int pg;
 	const char *name;
@@ -377,28 +386,45 @@ enum ioctl_info_states {
 };
 
 struct path {
+	/*
+	 * Checker state. The checker loop accesses these members for every
+	 * path in every tick. Keep them together at the start of the
+	 * struct, which is cache line aligned, so that they fit in the
+	 * first two cache lines. Identity and configuration data follow
+	 * below.
+	 */
+	enum check_path_states is_checked;
+	int initialized;
+	unsigned int tick;
+	unsigned int checkint;
+	unsigned int pending_ticks;
+	int state;
+	struct multipath * mpp;
+	int fd;
+	int dmstate;
+	enum path_msg pending_msg;
+	int chkrstate;
+	int oldstate;
+	bool add_when_online;
+	struct checker checker;
+
 	char dev[FILE_NAME_SIZE];
 	char dev_t[BLK_DEV_SIZE];
 	struct udev_device *udev;
 	struct sg_id sg_id;
 	struct hd_geometry geom;
 	char wwid[WWID_SIZE];
-	char vendor_id[SCSI_VENDOR_SIZE];
-	char product_id[PATH_PRODUCT_SIZE];
-	char rev[PATH_REV_SIZE];
+	/* interned strings, see strpool.h */
+	const char *vendor_id;
+	const char *product_id;
+	const char *rev;
+	const char *tgt_node_name;
 	char serial[SERIAL_SIZE];
-	char tgt_node_name[NODE_NAME_SIZE];
 	char *vpd_data;
 	unsigned long long size;
-	unsigned int checkint;
-	unsigned int tick;
-	unsigned int pending_ticks;
 	int bus;
 	int sysfs_state;
-	int state;
-	int dmstate;
-	int chkrstate;
-	int oldstate;
+	char *sysfs_state_path;
 	enum path_disconnected_state disconnected; /* Marked for purge due to
 						      disconnection */
 	int failcount;
@@ -409,10 +435,6 @@ struct path {
 	int tpgs;
 	const char *uid_attribute;
 	struct prio prio;
-	struct checker checker;
-	struct multipath * mpp;
-	int fd;
-	int initialized;
 	int retriggers;
 	int partial_retrigger_delay;
 	unsigned int path_failures;
@@ -430,16 +452,22 @@ struct path {
 	int fast_io_fail;
 	unsigned int dev_loss;
 	int eh_deadline;
-	enum check_path_states is_checked;
 	bool can_use_env_uid;
-	bool add_when_online;
 	unsigned int checker_timeout;
+	/* checker round trip times, see update_path() in multipathd */
+	struct lat_hist chk_latency;
 	/* configlet pointers */
 	vector hwe;
 	struct gen_path generic_path;
 	int tpg_id;
+	/* allocation order, never reused */
+	unsigned long seqno;
 	enum ioctl_info_states ioctl_info;
-};
+} __attribute__((aligned(64)));
+
+/* See the comment at the start of struct path */
+_Static_assert(offsetof(struct path, checker) + sizeof(struct checker) <= 128,
+	       "checker state of struct path exceeds two cache lines");
 
 typedef int (pgpolicyfn) (struct multipath *, vector);
 
@@ -462,6 +490,8 @@ enum udev_wait_states {
 	UDEV_WAIT_RELOAD,
 };
 
+struct propsel_profile;
+
 struct multipath {
 	char wwid[WWID_SIZE];
 	char alias_old[WWID_SIZE];
@@ -473,6 +503,8 @@ struct multipath {
 	int bestpg;
 	int queuedio;
 	int action;
+	/* static string, why the map is reloaded, for the history */
+	const char *reload_reason;
 	enum udev_wait_states wait_for_udev;
 	int uev_wait_tick;
 	int pgfailback;
@@ -504,6 +536,8 @@ struct multipath {
 	int purge_disconnected;
 	unsigned int sync_tick;
 	int checker_count;
+	/* paths of this map with a pending_msg */
+	unsigned int pending_msgs;
 	enum prio_update_type prio_update;
 	uid_t uid;
 	gid_t gid;
@@ -512,6 +546,8 @@ struct multipath {
 	vector paths;
 	vector pg;
 	struct dm_info dmi;
+	/* allocation order, never reused */
+	unsigned long seqno;
 
 	/* configlet pointers */
 	char * alias;
@@ -521,6 +557,8 @@ struct multipath {
 	char * hwhandler;
 	struct mpentry * mpe;
 	vector hwe;
+	/* settings resolved from mpe and hwe, only set in setup_map() */
+	const struct propsel_profile *profile;
 
 	/* threads */
 	pthread_t waiter;
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include "mt-udev-wrap.h"
@@ -294,83 +295,182 @@ static bool set_path_max_sectors_kb(const struct path *pp, int max_sectors_kb)
 	return rc;
 }
 
-int adopt_paths(vector pathvec, struct multipath *mpp,
-		const struct multipath *current_mpp)
+struct wwid_index {
+	const struct vector_s *pathvec;
+	unsigned int n_buckets;
+	/* first slot in every bucket, -1 if empty */
+	int *head;
+	/* per slot: next slot in the same bucket, and hash of the WWID */
+	int *next;
+	unsigned int *hash;
+};
+
+void free_wwid_index(struct wwid_index *idx)
 {
-	int i, ret;
-	struct path * pp;
-	struct config *conf;
+	if (!idx)
+		return;
+	free(idx->head);
+	free(idx->next);
+	free(idx->hash);
+	free(idx);
+}
 
-	if (!mpp)
-		return 0;
+struct wwid_index *alloc_wwid_index(const struct vector_s *pathvec)
+{
+	struct wwid_index *idx;
+	unsigned int n = VECTOR_SIZE(pathvec), b;
+	struct path *pp;
+	int i;
 
-	if (update_mpp_paths(mpp, pathvec))
-		return 1;
+	idx = calloc(1, sizeof(*idx));
+	if (!idx)
+		return NULL;
+	idx->pathvec = pathvec;
+	for (idx->n_buckets = 16; idx->n_buckets < 2 * n; idx->n_buckets <<= 1)
+		;
+	idx->head = malloc(idx->n_buckets * sizeof(*idx->head));
+	idx->next = malloc((n ? n : 1) * sizeof(*idx->next));
+	idx->hash = malloc((n ? n : 1) * sizeof(*idx->hash));
+	if (!idx->head || !idx->next || !idx->hash) {
+		free_wwid_index(idx);
+		return NULL;
+	}
+	memset(idx->head, 0xff, idx->n_buckets * sizeof(*idx->head));
+
+	/* Insert backwards, so that every chain is in vector order */
+	for (i = n - 1; i >= 0; i--) {
+		pp = VECTOR_SLOT(pathvec, i);
+		idx->hash[i] = str_hash(pp->wwid);
+		b = idx->hash[i] & (idx->n_buckets - 1);
+		idx->next[i] = idx->head[b];
+		idx->head[b] = i;
+	}
+	return idx;
+}
 
-	vector_foreach_slot (pathvec, pp, i) {
-		if (!strncmp(mpp->wwid, pp->wwid, WWID_SIZE)) {
-			if (pp->size != 0 && mpp->size != 0 &&
-			    pp->size != mpp->size) {
-				condlog(3, "%s: size mismatch for %s, not adding path",
-					pp->dev, mpp->alias);
-				continue;
-			}
-			if (pp->initialized == INIT_REMOVED)
-				continue;
-			if (mpp->queue_mode == QUEUE_MODE_RQ &&
-			    pp->bus == SYSFS_BUS_NVME &&
-			    pp->sg_id.proto_id == NVME_PROTOCOL_TCP) {
-				condlog(2, "%s: multipath device %s created with request queue_mode. Unable to add nvme:tcp paths",
-					pp->dev, mpp->alias);
-				continue;
-			}
-			if (!mpp->paths && !(mpp->paths = vector_alloc()))
-				goto err;
-
-			conf = get_multipath_config();
-			pthread_cleanup_push(put_multipath_config, conf);
-			ret = pathinfo(pp, conf,
-				       DI_PRIO | DI_CHECKER);
-			pthread_cleanup_pop(1);
-			if (ret) {
-				condlog(3, "%s: pathinfo failed for %s",
-					__func__, pp->dev);
-				continue;
-			}
+int wwid_index_next(const struct wwid_index *idx,
+		    const struct vector_s *pathvec, const char *wwid, int prev)
+{
+	const struct path *pp;
+	unsigned int h;
+	int i;
 
-			if (!find_path_by_devt(mpp->paths, pp->dev_t)) {
+	if (!idx || idx->pathvec != pathvec) {
+		for (i = prev + 1; i < VECTOR_SIZE(pathvec); i++) {
+			pp = VECTOR_SLOT(pathvec, i);
+			if (!strncmp(pp->wwid, wwid, WWID_SIZE))
+				return i;
+		}
+		return -1;
+	}
 
-				if (store_path(mpp->paths, pp))
-					goto err;
-				/*
-				 * Setting max_sectors_kb on live paths is dangerous.
-				 * But we can do it here on a path that isn't yet part
-				 * of the map. If this value is lower than the current
-				 * max_sectors_kb and the map is reloaded, the map's
-				 * max_sectors_kb will be safely adjusted by the kernel.
-				 *
-				 * We must make sure that the path is not part of the
-				 * map yet. Normally we can check this in mpp->paths.
-				 * But if adopt_paths is called from coalesce_paths,
-				 * we need to check the separate struct multipath that
-				 * has been obtained from map_discovery().
-				 */
-				if (!current_mpp ||
-				    !mp_find_path_by_devt(current_mpp, pp->dev_t))
-					set_path_max_sectors_kb(pp, mpp->max_sectors_kb);
-			}
+	if (prev < 0) {
+		h = str_hash(wwid);
+		i = idx->head[h & (idx->n_buckets - 1)];
+	} else {
+		h = idx->hash[prev];
+		i = idx->next[prev];
+	}
+	for (; i >= 0; i = idx->next[i]) {
+		pp = VECTOR_SLOT(pathvec, i);
+		if (idx->hash[i] == h && !strncmp(pp->wwid, wwid, WWID_SIZE))
+			return i;
+	}
+	return -1;
+}
 
-			pp->mpp = mpp;
-			condlog(3, "%s: ownership set to %s",
-				pp->dev, mpp->alias);
-		}
+/* Returns 1 on fatal error, 0 otherwise, also if the path was skipped */
+static int adopt_path(struct multipath *mpp, struct path *pp,
+		      const struct multipath *current_mpp)
+{
+	struct config *conf;
+	int ret;
+
+	if (pp->size != 0 && mpp->size != 0 &&
+	    pp->size != mpp->size) {
+		condlog(3, "%s: size mismatch for %s, not adding path",
+			pp->dev, mpp->alias);
+		return 0;
 	}
+	if (pp->initialized == INIT_REMOVED)
+		return 0;
+	if (mpp->queue_mode == QUEUE_MODE_RQ &&
+	    pp->bus == SYSFS_BUS_NVME &&
+	    pp->sg_id.proto_id == NVME_PROTOCOL_TCP) {
+		condlog(2, "%s: multipath device %s created with request queue_mode. Unable to add nvme:tcp paths",
+			pp->dev, mpp->alias);
+		return 0;
+	}
+	if (!mpp->paths && !(mpp->paths = vector_alloc()))
+		goto err;
+
+	conf = get_multipath_config();
+	pthread_cleanup_push(put_multipath_config, conf);
+	ret = pathinfo(pp, conf,
+		       DI_PRIO | DI_CHECKER);
+	pthread_cleanup_pop(1);
+	if (ret) {
+		condlog(3, "%s: pathinfo failed for %s",
+			__func__, pp->dev);
+		return 0;
+	}
+
+	if (!find_path_by_devt(mpp->paths, pp->dev_t)) {
+
+		if (store_path(mpp->paths, pp))
+			goto err;
+		/*
+		 * Setting max_sectors_kb on live paths is dangerous.
+		 * But we can do it here on a path that isn't yet part
+		 * of the map. If this value is lower than the current
+		 * max_sectors_kb and the map is reloaded, the map's
+		 * max_sectors_kb will be safely adjusted by the kernel.
+		 *
+		 * We must make sure that the path is not part of the
+		 * map yet. Normally we can check this in mpp->paths.
+		 * But if adopt_paths is called from coalesce_paths,
+		 * we need to check the separate struct multipath that
+		 * has been obtained from map_discovery().
+		 */
+		if (!current_mpp ||
+		    !mp_find_path_by_devt(current_mpp, pp->dev_t))
+			set_path_max_sectors_kb(pp, mpp->max_sectors_kb);
+	}
+
+	pp->mpp = mpp;
+	condlog(3, "%s: ownership set to %s",
+		pp->dev, mpp->alias);
 	return 0;
 err:
 	condlog(1, "error setting ownership of %s to %s", pp->dev, mpp->alias);
 	return 1;
 }
 
+int adopt_paths__(vector pathvec, struct multipath *mpp,
+		  const struct multipath *current_mpp,
+		  const struct wwid_index *idx)
+{
+	int i;
+
+	if (!mpp)
+		return 0;
+
+	if (update_mpp_paths(mpp, pathvec))
+		return 1;
+
+	for (i = wwid_index_next(idx, pathvec, mpp->wwid, -1); i >= 0;
+	     i = wwid_index_next(idx, pathvec, mpp->wwid, i))
+		if (adopt_path(mpp, VECTOR_SLOT(pathvec, i), current_mpp))
+			return 1;
+	return 0;
+}
+
+int adopt_paths(vector pathvec, struct multipath *mpp,
+		const struct multipath *current_mpp)
+{
+	return adopt_paths__(pathvec, mpp, current_mpp, NULL);
+}
+
 static void orphan_path__(struct path *pp, const char *reason)
 {
 	condlog(3, "%s: orphan path, %s", pp->dev, reason);
@@ -658,13 +758,17 @@ int update_multipath_strings(struct multipath *mpp, vector pathvec)
 	update_mpp_paths(mpp, pathvec);
 	condlog(4, "%s: %s", mpp->alias, __FUNCTION__);
 
-	free_multipath_attributes(mpp);
-	free_pgvec(mpp->pg);
-	mpp->pg = NULL;
-
+	/*
+	 * mpp->pg is kept, disassemble_map() only rebuilds it if the
+	 * table has changed.
+	 */
 	r = update_multipath_table(mpp, pathvec, 0);
-	if (r != DMP_OK)
+	if (r != DMP_OK) {
+		free_multipath_attributes(mpp);
+		free_pgvec(mpp->pg);
+		mpp->pg = NULL;
 		return r;
+	}
 
 	sync_paths(mpp, pathvec);
 
@@ -814,8 +918,10 @@ find_existing_alias (struct multipath * mpp,
 		}
 }
 
-struct multipath *add_map_with_path(struct vectors *vecs, struct path *pp,
-				    int add_vec, const struct multipath *current_mpp)
+struct multipath *add_map_with_path__(struct vectors *vecs, struct path *pp,
+				      int add_vec,
+				      const struct multipath *current_mpp,
+				      const struct wwid_index *idx)
 {
 	struct multipath * mpp;
 	struct config *conf = NULL;
@@ -843,8 +949,8 @@ struct multipath *add_map_with_path(struct vectors *vecs, struct path *pp,
 		goto out;
 	mpp->size = pp->size;
 
-	if (adopt_paths(vecs->pathvec, mpp, current_mpp) || pp->mpp != mpp ||
-	    find_slot(mpp->paths, pp) == -1)
+	if (adopt_paths__(vecs->pathvec, mpp, current_mpp, idx) ||
+	    pp->mpp != mpp || find_slot(mpp->paths, pp) == -1)
 		goto out;
 
 	if (add_vec) {
@@ -862,6 +968,12 @@ out:
 	return NULL;
 }
 
+struct multipath *add_map_with_path(struct vectors *vecs, struct path *pp,
+				    int add_vec, const struct multipath *current_mpp)
+{
+	return add_map_with_path__(vecs, pp, add_vec, current_mpp, NULL);
+}
+
 int verify_paths(struct multipath *mpp)
 {
 	struct path * pp;
@@ -13,6 +13,27 @@ struct vectors {
 
 void set_no_path_retry(struct multipath *mpp);
 
+/*
+ * Index of the paths in a path vector by WWID, for assembling maps
+ * without scanning the whole path vector for every map. It refers to
+ * vector slots, and must not be used after the vector has been
+ * modified.
+ */
+struct wwid_index;
+
+struct wwid_index *alloc_wwid_index(const struct vector_s *pathvec);
+void free_wwid_index(struct wwid_index *idx);
+/*
+ * Returns the next slot after @prev (-1 to start) with a path with the
+ * given WWID, in vector order, or -1. If @idx is NULL or doesn't belong
+ * to @pathvec, the vector is scanned.
+ */
+int wwid_index_next(const struct wwid_index *idx,
+		    const struct vector_s *pathvec, const char *wwid, int prev);
+
+int adopt_paths__(vector pathvec, struct multipath *mpp,
+		  const struct multipath *current_mpp,
+		  const struct wwid_index *idx);
 int adopt_paths (vector pathvec, struct multipath *mpp,
 		 const struct multipath *current_mpp);
 void orphan_path (struct path * pp, const char *reason);
@@ -29,6 +50,10 @@ void remove_map_by_alias(const char *alias, struct vectors * vecs);
 void remove_maps (struct vectors * vecs);
 
 void sync_map_state (struct multipath *mpp, bool reinstate_only);
+struct multipath *add_map_with_path__(struct vectors *vecs, struct path *pp,
+				      int add_vec,
+				      const struct multipath *current_mpp,
+				      const struct wwid_index *idx);
 struct multipath * add_map_with_path (struct vectors * vecs,
 				      struct path * pp, int add_vec,
 				      const struct multipath *current_mpp);
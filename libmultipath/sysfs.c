@@ -98,6 +98,47 @@ ssize_t sysfs_bin_attr_get_value(struct udev_device *dev, const char *attr_name,
 				      value_len, true);
 }
 
+/*
+ * Read a text attribute by its full sysfs path, without going through
+ * libudev. For hot attributes whose location has been looked up before.
+ */
+ssize_t sysfs_file_get_value(const char *path, char *value, size_t value_len)
+{
+	int fd = -1;
+	ssize_t size;
+
+	if (!path || !value || !value_len) {
+		condlog(1, "%s: invalid parameters", __func__);
+		return -EINVAL;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		condlog(3, "%s: attribute '%s' cannot be opened: %s",
+			__func__, path, strerror(errno));
+		return -errno;
+	}
+	pthread_cleanup_push(cleanup_fd_ptr, &fd);
+
+	size = read(fd, value, value_len);
+	if (size < 0) {
+		size = -errno;
+		condlog(3, "%s: read from %s failed: %s", __func__, path,
+			strerror(errno));
+		value[0] = '\0';
+	} else if (size == (ssize_t)value_len) {
+		condlog(3, "%s: overflow reading from %s (required len: %zu)",
+			__func__, path, size);
+		value[size - 1] = '\0';
+	} else {
+		value[size] = '\0';
+		size = strchop(value);
+	}
+
+	pthread_cleanup_pop(1);
+	return size;
+}
+
 ssize_t sysfs_attr_set_value(struct udev_device *dev, const char *attr_name,
 			     const char * value, size_t value_len)
 {
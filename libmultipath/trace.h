@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+#include "autoconfig.h"
+
+/*
+ * USDT probes, for tracing with bpftrace, perf or systemtap without
+ * recompiling, e.g.
+ *
+ *   bpftrace -e 'usdt:/sbin/multipathd:multipath:checker_done
+ *     { printf("%s %d %dus\n", str(arg0), arg1, arg2); }'
+ *
+ * Probes (arguments):
+ *   checker_start (dev, checker), checker_done (dev, state, last latency)
+ *   fail_path (dev, map, del_active), reinstate_path (dev, map)
+ *   map_reload_start (map, reason, flush), map_reload_done (map, result)
+ *   uevent_start (kernel name, action), uevent_done (kernel name, result)
+ *   cli_start (fd, command), cli_done (fd, error)
+ *   lock_acquired (lock, site, wait), lock_released (lock, site, hold)
+ *
+ * Strings are passed as char pointers. Durations are in microseconds.
+ * Probes in libmultipath are found in libmultipath.so, not in the
+ * multipathd binary.
+ *
+ * The probes compile to nothing if sys/sdt.h wasn't found at build
+ * time. Arguments must not have side effects.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define TRACE_PROBE(name, ...) STAP_PROBEV(multipath, name, ## __VA_ARGS__)
+#else
+#define TRACE_PROBE(name, ...) do {} while (0)
+#endif
+
+#endif
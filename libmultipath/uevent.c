@@ -37,6 +37,8 @@
 #include "vector.h"
 #include "structs.h"
 #include "util.h"
+#include "mempool.h"
+#include "metrics.h"
 #include "config.h"
 #include "blacklist.h"
 #include "devmapper.h"
@@ -53,6 +55,7 @@ static uev_trigger *my_uev_trigger;
 static void *my_trigger_data;
 static int servicing_uev;
 static int adding_uev; /* uatomic access only */
+static unsigned long uevent_overruns; /* uatomic access only */
 
 struct uevent_filter_state {
 	struct list_head uevq;
@@ -81,9 +84,12 @@ int is_uevent_busy(void)
 	return (!empty || servicing || adding);
 }
 
+/* uevents arrive in storms, allocate them from a slab cache */
+static struct mempool uevent_pool = MEMPOOL_INIT("uevent", struct uevent, 512);
+
 struct uevent * alloc_uevent (void)
 {
-	struct uevent *uev = calloc(1, sizeof(struct uevent));
+	struct uevent *uev = mempool_alloc(&uevent_pool);
 
 	if (uev) {
 		INIT_LIST_HEAD(&uev->node);
@@ -102,7 +108,7 @@ static void cleanup_uev(void *arg)
 	uevq_cleanup(&uev->merge_node);
 	if (uev->udev)
 		udev_device_unref(uev->udev);
-	free(uev);
+	mempool_free(&uevent_pool, uev);
 }
 
 static void uevq_cleanup(struct list_head *tmpq)
@@ -321,7 +327,7 @@ static void uevent_delete_from_list(struct uevent *to_delete,
 	if (to_delete->udev)
 		udev_device_unref(to_delete->udev);
 
-	free(to_delete);
+	mempool_free(&uevent_pool, to_delete);
 }
 
 /*
@@ -336,7 +342,7 @@ static void uevent_delete_simple(struct uevent *to_delete)
 	if (to_delete->udev)
 		udev_device_unref(to_delete->udev);
 
-	free(to_delete);
+	mempool_free(&uevent_pool, to_delete);
 }
 
 static void uevent_prepare(struct uevent_filter_state *st)
@@ -476,6 +482,7 @@ service_uevq(struct list_head *tmpq)
 	if (uev == NULL)
 		return;
 	condlog(4, "servicing uevent '%s %s'", uev->action, uev->kernel);
+	metric_inc(MP_METRIC_UEVENTS, NULL);
 	pthread_cleanup_push(cleanup_uev, uev);
 	if (my_uev_trigger && my_uev_trigger(uev, my_trigger_data))
 		condlog(0, "uevent trigger error");
@@ -567,6 +574,9 @@ int uevent_dispatch(int (*uev_trigger)(struct uevent *, void * trigger_data),
 		merge_uevq(&filter_state);
 		pthread_cleanup_pop(1);
 		log_filter_state(&filter_state);
+		if (filter_state.merged)
+			metric_add(MP_METRIC_UEVENTS_MERGED, NULL,
+				   filter_state.merged);
 
 		print_uevq("merge", &filter_state.uevq);
 		service_uevq(&filter_state.uevq);
@@ -621,7 +631,7 @@ static struct uevent *uevent_from_udev_device(struct udev_device *dev)
 	if (!uev->devpath || ! uev->action) {
 		udev_device_unref(dev);
 		condlog(1, "uevent missing necessary fields");
-		free(uev);
+		mempool_free(&uevent_pool, uev);
 		return NULL;
 	}
 	uev->udev = dev;
@@ -638,11 +648,40 @@ static struct uevent *uevent_from_udev_device(struct udev_device *dev)
 	return uev;
 }
 
+/*
+ * Called from the listener thread if the kernel had to drop uevents
+ * because the monitor socket's receive buffer was full. The events are
+ * lost for good, so the caller's view of the system may be stale.
+ * Overridden by multipathd, which schedules a full resync.
+ */
+void uevent_overrun_callback(void)
+{
+}
+
+unsigned long uevent_get_overruns(void)
+{
+	return uatomic_read(&uevent_overruns);
+}
+
+/*
+ * Userspace fallback for the kernel socket filter installed in
+ * uevent_listen(). Only used if installing the filter failed.
+ */
+static bool uevent_is_block_disk(struct udev_device *dev)
+{
+	const char *subsys = udev_device_get_subsystem(dev);
+	const char *devtype = udev_device_get_devtype(dev);
+
+	return subsys && !strcmp(subsys, "block") &&
+		devtype && !strcmp(devtype, "disk");
+}
+
 #define MAX_UEVENTS 1000
 static int uevent_receive_events(int fd, struct list_head *tmpq,
-				 struct udev_monitor *monitor)
+				 struct udev_monitor *monitor,
+				 bool kernel_filter)
 {
-	struct pollfd ev_poll;
+	struct pollfd ev_poll = { .fd = fd, .events = POLLIN, };
 	int n = 0;
 
 	do {
@@ -651,9 +690,18 @@ static int uevent_receive_events(int fd, struct list_head *tmpq,
 
 		dev = udev_monitor_receive_device(monitor);
 		if (!dev) {
-			condlog(0, "failed getting udev device");
+			if (errno == ENOBUFS) {
+				uatomic_inc(&uevent_overruns);
+				condlog(1, "uevent socket overrun, events were lost. Requesting resync");
+				uevent_overrun_callback();
+			} else
+				condlog(0, "failed getting udev device");
 			break;
 		}
+		if (!kernel_filter && !uevent_is_block_disk(dev)) {
+			udev_device_unref(dev);
+			continue;
+		}
 		uev = uevent_from_udev_device(dev);
 		if (!uev)
 			break;
@@ -662,9 +710,6 @@ static int uevent_receive_events(int fd, struct list_head *tmpq,
 		n++;
 		condlog(4, "received uevent \"%s %s\"", uev->action, uev->kernel);
 
-		ev_poll.fd = fd;
-		ev_poll.events = POLLIN;
-
 	} while (n < MAX_UEVENTS && poll(&ev_poll, 1, 0) > 0);
 
 	return n;
@@ -675,6 +720,7 @@ int uevent_listen(struct udev *udev)
 	int err = 2;
 	struct udev_monitor *monitor = NULL;
 	int fd, socket_flags;
+	bool kernel_filter = true;
 	LIST_HEAD(uevlisten_tmp);
 
 	/*
@@ -716,15 +762,25 @@ int uevent_listen(struct udev *udev)
 			strerror(errno));
 		goto out;
 	}
+	/*
+	 * libudev compiles the match into a BPF program and attaches it
+	 * to the monitor socket in udev_monitor_enable_receiving(), so that
+	 * events from other subsystems never wake us up. If that fails,
+	 * filter in userspace instead.
+	 */
 	err = udev_monitor_filter_add_match_subsystem_devtype(monitor, "block",
 							      "disk");
-	if (err)
+	if (err) {
 		condlog(2, "failed to create filter : %s", strerror(-err));
+		kernel_filter = false;
+	}
 	err = udev_monitor_enable_receiving(monitor);
 	if (err) {
 		condlog(2, "failed to enable receiving : %s", strerror(-err));
 		goto out;
 	}
+	if (!kernel_filter)
+		condlog(2, "uevent socket filter unavailable, filtering in userspace");
 
 	pthread_cleanup_push(cleanup_global_uevq, NULL);
 	pthread_cleanup_push(cleanup_uevq, &uevlisten_tmp);
@@ -744,7 +800,8 @@ int uevent_listen(struct udev *udev)
 		}
 		uatomic_set(&adding_uev, 1);
 
-		events = uevent_receive_events(fd, &uevlisten_tmp, monitor);
+		events = uevent_receive_events(fd, &uevlisten_tmp, monitor,
+					       kernel_filter);
 		if (events <= 0)
 			continue;
 
@@ -1,13 +1,27 @@
 void init_handler_callbacks(void)
 {
-	set_handler_callback(VRB_LIST | Q1_PATHS, HANDLER(cli_list_paths));
-	set_handler_callback(VRB_LIST | Q1_PATHS | Q2_FMT, HANDLER(cli_list_paths_fmt));
-	set_handler_callback(VRB_LIST | Q1_PATHS | Q2_RAW | Q3_FMT,
-			     HANDLER(cli_list_paths_raw));
+	set_stream_handler_callback(VRB_LIST | Q1_PATHS, HANDLER(cli_list_paths));
+	set_stream_handler_callback(VRB_LIST | Q1_PATHS | Q2_FMT,
+				    HANDLER(cli_list_paths_fmt));
+	set_stream_handler_callback(VRB_LIST | Q1_PATHS | Q2_RAW | Q3_FMT,
+				    HANDLER(cli_list_paths_raw));
+	set_handler_callback(VRB_LIST | Q1_PATHS | Q2_SLOWEST,
+			     HANDLER(cli_list_paths_slowest));
 	set_handler_callback(VRB_LIST | Q1_PATH, HANDLER(cli_list_path));
 	set_handler_callback(VRB_LIST | Q1_MAPS, HANDLER(cli_list_maps));
 	set_handler_callback(VRB_LIST | Q1_STATUS, HANDLER(cli_list_status));
 	set_unlocked_handler_callback(VRB_LIST | Q1_DAEMON, HANDLER(cli_list_daemon));
+	set_handler_callback(VRB_LIST | Q1_DAEMON | Q2_TIMING,
+			     HANDLER(cli_list_daemon_timing));
+	set_handler_callback(VRB_LIST | Q1_METRICS, HANDLER(cli_list_metrics));
+	set_unlocked_handler_callback(VRB_LIST | Q1_HISTORY,
+				      HANDLER(cli_list_history));
+	set_unlocked_handler_callback(VRB_LIST | Q1_HISTORY | Q2_MAP,
+				      HANDLER(cli_list_history_map));
+	set_unlocked_handler_callback(VRB_LIST | Q1_HISTORY | Q2_PATH,
+				      HANDLER(cli_list_history_path));
+	set_unlocked_handler_callback(VRB_SUBSCRIBE | Q1_EVENTS,
+				      HANDLER(cli_subscribe_events));
 	set_handler_callback(VRB_LIST | Q1_MAPS | Q2_STATUS,
 			     HANDLER(cli_list_maps_status));
 	set_handler_callback(VRB_LIST | Q1_MAPS | Q2_STATS,
@@ -15,10 +29,12 @@ void init_handler_callbacks(void)
 	set_handler_callback(VRB_LIST | Q1_MAPS | Q2_FMT, HANDLER(cli_list_maps_fmt));
 	set_handler_callback(VRB_LIST | Q1_MAPS | Q2_RAW | Q3_FMT,
 			     HANDLER(cli_list_maps_raw));
-	set_handler_callback(VRB_LIST | Q1_MAPS | Q2_TOPOLOGY,
-			     HANDLER(cli_list_maps_topology));
-	set_handler_callback(VRB_LIST | Q1_TOPOLOGY, HANDLER(cli_list_maps_topology));
-	set_handler_callback(VRB_LIST | Q1_MAPS | Q2_JSON, HANDLER(cli_list_maps_json));
+	set_stream_handler_callback(VRB_LIST | Q1_MAPS | Q2_TOPOLOGY,
+				    HANDLER(cli_list_maps_topology));
+	set_stream_handler_callback(VRB_LIST | Q1_TOPOLOGY,
+				    HANDLER(cli_list_maps_topology));
+	set_stream_handler_callback(VRB_LIST | Q1_MAPS | Q2_JSON,
+				    HANDLER(cli_list_maps_json));
 	set_handler_callback(VRB_LIST | Q1_MAP | Q2_TOPOLOGY,
 			     HANDLER(cli_list_map_topology));
 	set_handler_callback(VRB_LIST | Q1_MAP | Q2_FMT, HANDLER(cli_list_map_fmt));
@@ -129,6 +129,31 @@ set_handler_callback__ (uint32_t fp, cli_handler *fn, bool locked)
 	return 0;
 }
 
+/* Stream handlers always run with vecs->lock held */
+int
+set_stream_handler_callback (uint32_t fp, cli_stream_handler *fn)
+{
+	struct handler *h;
+
+	assert(fp != INVALID_FINGERPRINT);
+	assert(find_handler(fp) == NULL);
+	h = add_handler(fp, NULL, true);
+	if (!h) {
+		condlog(0, "%s: failed to set handler for code %"PRIu32,
+			__func__, fp);
+		return 1;
+	}
+	h->stream_fn = fn;
+	return 0;
+}
+
+void cli_stream_reset (struct cli_stream *st)
+{
+	if (st->ctx && st->free_ctx)
+		st->free_ctx(st->ctx);
+	memset(st, 0, sizeof(*st));
+}
+
 void free_key (struct key * kw)
 {
 	if (kw->str)
@@ -228,6 +253,12 @@ load_keys (void)
 	r += add_key(keys, "setprhold", VRB_SETPRHOLD, 0);
 	r += add_key(keys, "unsetprhold", VRB_UNSETPRHOLD, 0);
 	r += add_key(keys, "pathlist", KEY_PATHLIST, 1);
+	r += add_key(keys, "subscribe", VRB_SUBSCRIBE, 0);
+	r += add_key(keys, "events", KEY_EVENTS, 0);
+	r += add_key(keys, "metrics", KEY_METRICS, 0);
+	r += add_key(keys, "slowest", KEY_SLOWEST, 1);
+	r += add_key(keys, "timing", KEY_TIMING, 0);
+	r += add_key(keys, "history", KEY_HISTORY, 0);
 
 	if (r) {
 		free_keys(keys);
@@ -360,6 +391,29 @@ struct handler *find_handler_for_cmdvec(const struct vector_s *v)
 	return find_handler(fingerprint(v));
 }
 
+/*
+ * parse_cli_cmd() - parse input and look up its handler
+ *
+ * returns 0 if a handler that can execute the command was found,
+ * -EINVAL if there is none, or the negated error from get_cmdvec().
+ * A handler may be a plain one (fn) or a stream handler (stream_fn).
+ */
+int parse_cli_cmd(char *cmd, vector *v, struct handler **h)
+{
+	int r;
+
+	*h = NULL;
+	r = get_cmdvec(cmd, v, false);
+	if (r)
+		return -r;
+
+	*h = find_handler_for_cmdvec(*v);
+	if (!*h || (!(*h)->fn && !(*h)->stream_fn))
+		return -EINVAL;
+
+	return 0;
+}
+
 int
 alloc_handlers (void)
 {
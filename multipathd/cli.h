@@ -41,6 +41,7 @@ enum {
 	VRB_GETPRHOLD		= 26,
 	VRB_SETPRHOLD		= 27,
 	VRB_UNSETPRHOLD		= 28,
+	VRB_SUBSCRIBE		= 29,
 
 	/* Qualifiers, values must be different from verbs */
 	KEY_PATH		= 65,
@@ -63,6 +64,11 @@ enum {
 	KEY_GROUP		= 82,
 	KEY_KEY			= 83,
 	KEY_PATHLIST		= 84,
+	KEY_EVENTS		= 85,
+	KEY_METRICS		= 86,
+	KEY_SLOWEST		= 87,
+	KEY_TIMING		= 88,
+	KEY_HISTORY		= 89,
 };
 
 /*
@@ -84,8 +90,13 @@ enum {
 	Q1_ALL			= KEY_ALL << 8,
 	Q1_DAEMON		= KEY_DAEMON << 8,
 	Q1_STATUS		= KEY_STATUS << 8,
+	Q1_EVENTS		= KEY_EVENTS << 8,
+	Q1_METRICS		= KEY_METRICS << 8,
+	Q1_HISTORY		= KEY_HISTORY << 8,
 
 	/* byte 2: qualifier 2 */
+	Q2_PATH			= KEY_PATH << 16,
+	Q2_MAP			= KEY_MAP << 16,
 	Q2_FMT			= KEY_FMT << 16,
 	Q2_RAW			= KEY_RAW << 16,
 	Q2_STATUS		= KEY_STATUS << 16,
@@ -96,6 +107,8 @@ enum {
 	Q2_GROUP		= KEY_GROUP << 16,
 	Q2_KEY			= KEY_KEY << 16,
 	Q2_PATHLIST		= KEY_PATHLIST << 16,
+	Q2_SLOWEST		= KEY_SLOWEST << 16,
+	Q2_TIMING		= KEY_TIMING << 16,
 
 	/* byte 3: qualifier 3 */
 	Q3_FMT			= KEY_FMT << 24,
@@ -135,19 +148,49 @@ struct strbuf;
 
 typedef int (cli_handler)(void *keywords, struct strbuf *reply, void *data);
 
+/*
+ * Approximate amount of output a stream handler should produce per call.
+ */
+#define CLI_STREAM_CHUNK (64 * 1024)
+
+/*
+ * State of a command whose reply is produced in pieces.
+ * A stream handler is called repeatedly with the same keywords, until it
+ * sets "done". cursor is 0 in the first call, its meaning is up to the
+ * handler. ctx, if set, is freed with free_ctx() when the reply is complete.
+ * vecs->lock may be dropped between calls, so ctx must not point to
+ * paths or maps. Handlers that walk pathvec or mpvec record the position
+ * after, and the seqno of, the last item they printed in pos and last.
+ */
+struct cli_stream {
+	unsigned int cursor;
+	unsigned int pos;
+	unsigned long last;
+	bool done;
+	void *ctx;
+	void (*free_ctx)(void *);
+};
+
+typedef int (cli_stream_handler)(void *keywords, struct strbuf *reply,
+				 void *data, struct cli_stream *st);
+
 struct handler {
 	uint32_t fingerprint;
 	int locked;
 	cli_handler *fn;
+	cli_stream_handler *stream_fn;
 };
 
 int alloc_handlers (void);
 int set_handler_callback__ (uint32_t fp, cli_handler *fn, bool locked);
 #define set_handler_callback(fp, fn) set_handler_callback__(fp, fn, true)
 #define set_unlocked_handler_callback(fp, fn) set_handler_callback__(fp, fn, false)
+int set_stream_handler_callback (uint32_t fp, cli_stream_handler *fn);
+void cli_stream_reset (struct cli_stream *st);
 
 int get_cmdvec (char *cmd, vector *v, bool allow_incomplete);
 struct handler *find_handler_for_cmdvec(const struct vector_s *v);
+int parse_cli_cmd(char *cmd, vector *v, struct handler **h);
 void genhelp_handler (const char *cmd, int error, struct strbuf *reply);
 
 int load_keys (void);
@@ -30,8 +30,13 @@
 #include "uevent.h"
 #include "foreign.h"
 #include "strbuf.h"
+#include "msort.h"
+#include "mempool.h"
+#include "metrics.h"
+#include "history.h"
 #include "cli_handlers.h"
 #include <ctype.h>
+#include <limits.h>
 
 static struct path *
 find_path_by_str(const struct vector_s *pathvec, const char *str,
@@ -47,34 +52,140 @@ find_path_by_str(const struct vector_s *pathvec, const char *str,
 	return pp;
 }
 
+static void cleanup_print_table(struct print_table **table)
+{
+	free_print_table(*table);
+}
+
+static unsigned long path_seqno(const void *p)
+{
+	return ((const struct path *)p)->seqno;
+}
+
+static unsigned long map_seqno(const void *p)
+{
+	return ((const struct multipath *)p)->seqno;
+}
+
+/*
+ * Find the slot of vec at which a stream handler continues.
+ * vecs->lock is dropped between the calls, so items may have been added
+ * or removed in the meantime. pathvec and mpvec are only appended to,
+ * and deletions keep them in order, so they are sorted by seqno. Resume
+ * after the last printed item, which is at or before st->pos - 1.
+ */
+static unsigned int
+stream_resume_pos(const struct cli_stream *st, const struct vector_s *vec,
+		  unsigned long (*seqno)(const void *))
+{
+	unsigned int pos = st->pos;
+
+	if (st->cursor == 0)
+		return 0;
+	if (pos > (unsigned int)VECTOR_SIZE(vec))
+		pos = VECTOR_SIZE(vec);
+	while (pos > 0 && seqno(VECTOR_SLOT(vec, pos - 1)) > st->last)
+		pos--;
+	return pos;
+}
+
+/*
+ * With pretty printing, the column widths are computed from all paths in
+ * the first call, without keeping the rendered cells. The rows are
+ * printed while streaming. Paths added later may not fit the columns.
+ */
 static int
-show_paths (struct strbuf *reply, struct vectors *vecs, char *style, int pretty)
+show_paths (struct strbuf *reply, struct vectors *vecs, char *style,
+	    int pretty, struct cli_stream *st)
 {
-	int i;
 	struct path * pp;
 	int hdr_len = 0;
-	fieldwidth_t *width __attribute__((cleanup(cleanup_ucharp))) = NULL;
+	fieldwidth_t *width = st->ctx;
+	size_t initial_len = get_strbuf_len(reply);
+	unsigned int pos;
 
-	if (pretty) {
+	if (pretty && st->cursor == 0) {
 		if ((width = alloc_path_layout()) == NULL)
 			return 1;
-		get_path_layout(vecs->pathvec, 1, width);
+		st->ctx = width;
+		st->free_ctx = free;
+		get_path_layout_fmt(vecs->pathvec, 1, style, width);
 		foreign_path_layout(width);
+		if ((hdr_len = snprint_path_header(reply, style, width)) < 0)
+			return 1;
 	}
-	if (pretty && (hdr_len = snprint_path_header(reply, style, width)) < 0)
-		return 1;
 
-	vector_foreach_slot(vecs->pathvec, pp, i) {
+	pos = stream_resume_pos(st, vecs->pathvec, path_seqno);
+	while (pos < (unsigned int)VECTOR_SIZE(vecs->pathvec)) {
+		if (get_strbuf_len(reply) - initial_len >= CLI_STREAM_CHUNK)
+			return 0;
+		pp = VECTOR_SLOT(vecs->pathvec, pos++);
+		st->cursor++;
+		st->pos = pos;
+		st->last = pp->seqno;
 		if (snprint_path(reply, style, pp, width) < 0)
 			return 1;
 	}
 	if (snprint_foreign_paths(reply, style, width) < 0)
 		return 1;
+	st->done = true;
 
-	if (pretty && get_strbuf_len(reply) == (size_t)hdr_len)
+	if (hdr_len > 0 && get_strbuf_len(reply) == initial_len + hdr_len)
 		/* No output - clear header */
-		truncate_strbuf(reply, 0);
+		truncate_strbuf(reply, initial_len);
+
+	return 0;
+}
+
+/* Sort by p99 checker round trip time, then by maximum, descending */
+static int
+cmp_chk_latency(const void *a, const void *b)
+{
+	const struct path *pa = *(const struct path * const *)a;
+	const struct path *pb = *(const struct path * const *)b;
+	unsigned int la = lat_hist_percentile(&pa->chk_latency, 99);
+	unsigned int lb = lat_hist_percentile(&pb->chk_latency, 99);
+
+	if (la != lb)
+		return la > lb ? -1 : 1;
+	if (pa->chk_latency.max_us != pb->chk_latency.max_us)
+		return pa->chk_latency.max_us > pb->chk_latency.max_us ? -1 : 1;
+	return 0;
+}
+
+static int
+show_slowest_paths (struct strbuf *reply, struct vectors *vecs,
+		    unsigned int n)
+{
+	vector paths __attribute__((cleanup(cleanup_vector))) = NULL;
+	struct print_table *table __attribute__((cleanup(cleanup_print_table))) = NULL;
+	struct path *pp;
+	unsigned int row;
+	int i;
+
+	if (!(paths = vector_alloc()) ||
+	    !vector_reserve(paths, VECTOR_SIZE(vecs->pathvec)))
+		return 1;
+	vector_foreach_slot(vecs->pathvec, pp, i) {
+		if (lat_hist_count(&pp->chk_latency) == 0)
+			continue;
+		vector_alloc_slot(paths);
+		vector_set_slot(paths, pp);
+	}
+	msort(paths->slot, VECTOR_SIZE(paths), sizeof(paths->slot[0]),
+	      cmp_chk_latency);
+	while ((unsigned int)VECTOR_SIZE(paths) > n)
+		vector_del_slot(paths, VECTOR_SIZE(paths) - 1);
 
+	if ((table = alloc_path_table(paths, PRINT_PATH_LATENCY, 1)) == NULL)
+		return 1;
+	if (print_table_rows(table) == 0)
+		return 0;
+	if (snprint_table_header(reply, table) < 0)
+		return 1;
+	for (row = 0; row < print_table_rows(table); row++)
+		if (snprint_table_row(reply, table, row) < 0)
+			return 1;
 	return 0;
 }
 
@@ -101,45 +212,85 @@ show_map_topology (struct strbuf *reply, struct multipath *mpp,
 }
 
 static int
-show_maps_topology (struct strbuf *reply, struct vectors * vecs)
+show_maps_topology (struct strbuf *reply, struct vectors * vecs,
+		    struct cli_stream *st)
 {
-	int i;
 	struct multipath * mpp;
-	fieldwidth_t *p_width __attribute__((cleanup(cleanup_ucharp))) = NULL;
+	fieldwidth_t *p_width = st->ctx;
+	size_t initial_len = get_strbuf_len(reply);
+	unsigned int pos;
 
-	if ((p_width = alloc_path_layout()) == NULL)
-		return 1;
-	get_path_layout(vecs->pathvec, 0, p_width);
-	foreign_path_layout(p_width);
+	if (st->cursor == 0) {
+		if ((p_width = alloc_path_layout()) == NULL)
+			return 1;
+		st->ctx = p_width;
+		st->free_ctx = free;
+		get_path_layout_fmt(vecs->pathvec, 0, PRINT_PATH_INDENT,
+				    p_width);
+		foreign_path_layout(p_width);
+	}
 
-	vector_foreach_slot(vecs->mpvec, mpp, i) {
-		if (refresh_multipath(vecs, mpp)) {
-			i--;
+	pos = stream_resume_pos(st, vecs->mpvec, map_seqno);
+	while (pos < (unsigned int)VECTOR_SIZE(vecs->mpvec)) {
+		if (get_strbuf_len(reply) - initial_len >= CLI_STREAM_CHUNK)
+			return 0;
+		mpp = VECTOR_SLOT(vecs->mpvec, pos);
+		/* on failure, mpp is removed from mpvec */
+		if (refresh_multipath(vecs, mpp))
 			continue;
-		}
+		pos++;
+		st->cursor++;
+		st->pos = pos;
+		st->last = mpp->seqno;
 		if (snprint_multipath_topology(reply, mpp, 2, p_width) < 0)
 			return 1;
 	}
 	if (snprint_foreign_topology(reply, 2, p_width) < 0)
 		return 1;
+	st->done = true;
 
 	return 0;
 }
 
+/*
+ * All maps are refreshed in the first call. Maps added while the reply
+ * is being streamed are refreshed with the next checker run.
+ */
 static int
-show_maps_json (struct strbuf *reply, struct vectors * vecs)
+show_maps_json (struct strbuf *reply, struct vectors * vecs,
+		struct cli_stream *st)
 {
 	int i;
 	struct multipath * mpp;
+	size_t initial_len = get_strbuf_len(reply);
+	unsigned int pos;
 
-	vector_foreach_slot(vecs->mpvec, mpp, i) {
-		if (refresh_multipath(vecs, mpp)) {
-			return 1;
+	if (st->cursor == 0) {
+		vector_foreach_slot(vecs->mpvec, mpp, i) {
+			if (refresh_multipath(vecs, mpp)) {
+				return 1;
+			}
 		}
+		if (snprint_multipath_topology_json_start(reply) < 0)
+			return 1;
 	}
 
-	if (snprint_multipath_topology_json(reply, vecs) < 0)
+	pos = stream_resume_pos(st, vecs->mpvec, map_seqno);
+	while (pos < (unsigned int)VECTOR_SIZE(vecs->mpvec)) {
+		if (get_strbuf_len(reply) - initial_len >= CLI_STREAM_CHUNK)
+			return 0;
+		mpp = VECTOR_SLOT(vecs->mpvec, pos++);
+		if (snprint_multipath_topology_json_map(reply, mpp,
+							st->cursor == 0) < 0)
+			return 1;
+		st->cursor++;
+		st->pos = pos;
+		st->last = mpp->seqno;
+	}
+
+	if (snprint_multipath_topology_json_end(reply, st->cursor == 0) < 0)
 		return 1;
+	st->done = true;
 
 	return 0;
 }
@@ -214,35 +365,58 @@ cli_list_config_local (void *v, struct strbuf *reply, void *data)
 }
 
 static int
-cli_list_paths (void *v, struct strbuf *reply, void *data)
+cli_list_paths (void *v, struct strbuf *reply, void *data,
+		struct cli_stream *st)
 {
 	struct vectors * vecs = (struct vectors *)data;
 
-	condlog(3, "list paths (operator)");
+	if (st->cursor == 0)
+		condlog(3, "list paths (operator)");
 
-	return show_paths(reply, vecs, PRINT_PATH_CHECKER, 1);
+	return show_paths(reply, vecs, PRINT_PATH_CHECKER, 1, st);
 }
 
 static int
-cli_list_paths_fmt (void *v, struct strbuf *reply, void *data)
+cli_list_paths_fmt (void *v, struct strbuf *reply, void *data,
+		    struct cli_stream *st)
 {
 	struct vectors * vecs = (struct vectors *)data;
 	char * fmt = get_keyparam(v, KEY_FMT);
 
-	condlog(3, "list paths (operator)");
+	if (st->cursor == 0)
+		condlog(3, "list paths (operator)");
 
-	return show_paths(reply, vecs, fmt, 1);
+	return show_paths(reply, vecs, fmt, 1, st);
 }
 
 static int
-cli_list_paths_raw (void *v, struct strbuf *reply, void * data)
+cli_list_paths_raw (void *v, struct strbuf *reply, void *data,
+		    struct cli_stream *st)
 {
 	struct vectors * vecs = (struct vectors *)data;
 	char * fmt = get_keyparam(v, KEY_FMT);
 
-	condlog(3, "list paths (operator)");
+	if (st->cursor == 0)
+		condlog(3, "list paths (operator)");
 
-	return show_paths(reply, vecs, fmt, 0);
+	return show_paths(reply, vecs, fmt, 0, st);
+}
+
+static int
+cli_list_paths_slowest (void *v, struct strbuf *reply, void *data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	char * param = get_keyparam(v, KEY_SLOWEST);
+	char *eptr;
+	unsigned long n;
+
+	condlog(3, "list paths slowest %s (operator)", param);
+
+	n = strtoul(param, &eptr, 10);
+	if (*param == '\0' || *eptr != '\0' || n == 0 || n > UINT_MAX)
+		return -EINVAL;
+
+	return show_slowest_paths(reply, vecs, n);
 }
 
 static int
@@ -272,7 +446,7 @@ cli_list_map_topology (void *v, struct strbuf *reply, void *data)
 
 	if ((p_width = alloc_path_layout()) == NULL)
 		return 1;
-	get_path_layout(vecs->pathvec, 0, p_width);
+	get_path_layout_fmt(vecs->pathvec, 0, PRINT_PATH_INDENT, p_width);
 	param = convert_dev(param, 0);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 
@@ -285,13 +459,15 @@ cli_list_map_topology (void *v, struct strbuf *reply, void *data)
 }
 
 static int
-cli_list_maps_topology (void *v, struct strbuf *reply, void *data)
+cli_list_maps_topology (void *v, struct strbuf *reply, void *data,
+			struct cli_stream *st)
 {
 	struct vectors * vecs = (struct vectors *)data;
 
-	condlog(3, "list multipaths (operator)");
+	if (st->cursor == 0)
+		condlog(3, "list multipaths (operator)");
 
-	return show_maps_topology(reply, vecs);
+	return show_maps_topology(reply, vecs, st);
 }
 
 static int
@@ -313,13 +489,15 @@ cli_list_map_json (void *v, struct strbuf *reply, void *data)
 }
 
 static int
-cli_list_maps_json (void *v, struct strbuf *reply, void *data)
+cli_list_maps_json (void *v, struct strbuf *reply, void *data,
+		    struct cli_stream *st)
 {
 	struct vectors * vecs = (struct vectors *)data;
 
-	condlog(3, "list multipaths json (operator)");
+	if (st->cursor == 0)
+		condlog(3, "list multipaths json (operator)");
 
-	return show_maps_json(reply, vecs);
+	return show_maps_json(reply, vecs, st);
 }
 
 static int
@@ -345,6 +523,8 @@ show_daemon (struct strbuf *reply)
 {
 	const char *status;
 	bool pending_reconfig;
+	unsigned long overruns;
+	struct mt_udev_lock_stats udev_stats;
 
 	status = daemon_status(&pending_reconfig);
 	if (status == NULL)
@@ -353,6 +533,38 @@ show_daemon (struct strbuf *reply)
 			 daemon_pid, status,
 			 pending_reconfig ? " (pending reconfigure)" : "") < 0)
 		return 1;
+	overruns = uevent_get_overruns();
+	if (overruns > 0 &&
+	    print_strbuf(reply, "uevent overruns %lu\n", overruns) < 0)
+		return 1;
+	mt_udev_get_lock_stats(&udev_stats);
+	if (print_strbuf(reply, "libudev lock: %llu calls, %llu contended, %llu us waited\n",
+			 udev_stats.calls, udev_stats.contended,
+			 udev_stats.wait_us) < 0)
+		return 1;
+	if (print_mempool_stats(reply) < 0)
+		return 1;
+
+	return 0;
+}
+
+static int
+show_metrics (struct strbuf *reply, struct vectors *vecs)
+{
+	unsigned int count[PATH_MAX_STATE] = { 0, };
+	struct path *pp;
+	int i;
+
+	/* The gauges are sampled here, they needn't be tracked all the time */
+	vector_foreach_slot(vecs->pathvec, pp, i)
+		if (pp->state >= 0 && pp->state < PATH_MAX_STATE)
+			count[pp->state]++;
+	for (i = 0; i < PATH_MAX_STATE; i++)
+		metric_set(MP_METRIC_PATHS, checker_state_name(i), count[i]);
+	metric_set(MP_METRIC_MAPS, NULL, VECTOR_SIZE(vecs->mpvec));
+
+	if (print_metrics(reply) < 0)
+		return 1;
 
 	return 0;
 }
@@ -372,29 +584,33 @@ show_maps (struct strbuf *reply, struct vectors *vecs, char *style,
 	   int pretty)
 {
 	int i;
+	unsigned int row;
 	struct multipath * mpp;
 	int hdr_len = 0;
-	fieldwidth_t *width __attribute__((cleanup(cleanup_ucharp))) = NULL;
-
-	if (pretty) {
-		if ((width = alloc_multipath_layout()) == NULL)
-			return 1;
-		get_multipath_layout(vecs->mpvec, 1, width);
-		foreign_multipath_layout(width);
-	}
-
-	if (pretty && (hdr_len = snprint_multipath_header(reply, style, width)) < 0)
-		return 1;
+	struct print_table *table __attribute__((cleanup(cleanup_print_table))) = NULL;
 
 	vector_foreach_slot(vecs->mpvec, mpp, i) {
 		if (refresh_multipath(vecs, mpp)) {
 			i--;
 			continue;
 		}
-		if (snprint_multipath(reply, style, mpp, width) < 0)
+		if (!pretty && snprint_multipath(reply, style, mpp, NULL) < 0)
+			return 1;
+	}
+
+	if (pretty) {
+		/* The maps must be refreshed before rendering the table */
+		if ((table = alloc_multipath_table(vecs->mpvec, style, 1)) == NULL)
+			return 1;
+		foreign_multipath_layout(print_table_width(table));
+		if ((hdr_len = snprint_table_header(reply, table)) < 0)
 			return 1;
+		for (row = 0; row < print_table_rows(table); row++)
+			if (snprint_table_row(reply, table, row) < 0)
+				return 1;
 	}
-	if (snprint_foreign_multipaths(reply, style, width) < 0)
+	if (snprint_foreign_multipaths(reply, style,
+				       table ? print_table_width(table) : NULL) < 0)
 		return 1;
 
 	if (pretty && get_strbuf_len(reply) == (size_t)hdr_len)
@@ -437,7 +653,7 @@ cli_list_map_fmt (void *v, struct strbuf *reply, void *data)
 
 	if ((width = alloc_multipath_layout()) == NULL)
 		return 1;
-	get_multipath_layout(vecs->mpvec, 1, width);
+	get_multipath_layout_fmt(vecs->mpvec, 1, fmt, width);
 	param = convert_dev(param, 0);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 	if (!mpp)
@@ -496,6 +712,76 @@ cli_list_daemon (void *v, struct strbuf *reply, void *data)
 	return show_daemon(reply);
 }
 
+static int
+cli_list_daemon_timing (void *v, struct strbuf *reply, void *data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+
+	condlog(3, "list daemon timing (operator)");
+
+	if (print_tick_timing(reply) < 0 ||
+	    append_strbuf_str(reply, "\n") < 0 ||
+	    print_lock_timing(reply, &vecs->lock) < 0)
+		return 1;
+	return 0;
+}
+
+/*
+ * The history has its own synchronization. Not taking vecs->lock
+ * allows looking at it even if the daemon is stuck.
+ */
+static int
+cli_list_history (void *v, struct strbuf *reply, void *data)
+{
+	condlog(3, "list history (operator)");
+
+	return print_history(reply, NULL, NULL) < 0 ? 1 : 0;
+}
+
+static int
+cli_list_history_map (void *v, struct strbuf *reply, void *data)
+{
+	char * param = get_keyparam(v, KEY_MAP);
+
+	param = convert_dev(param, 0);
+	condlog(3, "list history map %s (operator)", param);
+
+	return print_history(reply, param, NULL) < 0 ? 1 : 0;
+}
+
+static int
+cli_list_history_path (void *v, struct strbuf *reply, void *data)
+{
+	char * param = get_keyparam(v, KEY_PATH);
+
+	param = convert_dev(param, 1);
+	condlog(3, "list history path %s (operator)", param);
+
+	return print_history(reply, NULL, param) < 0 ? 1 : 0;
+}
+
+static int
+cli_list_metrics (void *v, struct strbuf *reply, void *data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+
+	condlog(3, "list metrics (operator)");
+
+	return show_metrics(reply, vecs);
+}
+
+/*
+ * Nothing to do here. After sending the "ok" reply, the listener
+ * turns the connection into an event subscription, see publish_event().
+ */
+static int
+cli_subscribe_events (void *v, struct strbuf *reply, void *data)
+{
+	condlog(3, "subscribe events (operator)");
+
+	return 0;
+}
+
 static int
 cli_reset_maps_stats (void *v, struct strbuf *reply, void *data)
 {
@@ -773,23 +1059,54 @@ cli_del_map (void * v, struct strbuf *reply, void * data)
 	return 1;
 }
 
+static int del_maps_result(int r, int ret)
+{
+	if (ret == DM_FLUSH_OK)
+		return r;
+	else if (ret == DM_FLUSH_BUSY && r != 1)
+		return -EBUSY;
+	return 1;
+}
+
 static int
 cli_del_maps (void *v, struct strbuf *reply, void *data)
 {
 	struct vectors * vecs = (struct vectors *)data;
 	struct multipath *mpp;
-	int i, ret, r = 0;
+	const char **names = NULL;
+	int *results = NULL;
+	int i, n, ret, r = 0;
 
 	condlog(2, "remove maps (operator)");
-	vector_foreach_slot(vecs->mpvec, mpp, i) {
-		ret = flush_map(mpp, vecs);
-		if (ret == DM_FLUSH_OK)
-			i--;
-		else if (ret == DM_FLUSH_BUSY && r != 1)
-			r = -EBUSY;
-		else
-			r = 1;
+	n = VECTOR_SIZE(vecs->mpvec);
+	if (n > 0) {
+		names = calloc(n, sizeof(*names));
+		results = calloc(n, sizeof(*results));
 	}
+	pthread_cleanup_push(cleanup_free_ptr, &names);
+	pthread_cleanup_push(cleanup_free_ptr, &results);
+	if (names && results) {
+		/* remove the maps in batches, see dm_flush_map_list() */
+		vector_foreach_slot(vecs->mpvec, mpp, i)
+			names[i] = mpp->alias;
+		dm_flush_map_list(names, n, DMFL_NEED_SYNC|DMFL_SUSPEND, 0,
+				  results);
+		/* removing a map doesn't move the maps before it */
+		for (i = n - 1; i >= 0; i--) {
+			mpp = VECTOR_SLOT(vecs->mpvec, i);
+			ret = finish_flush_map(mpp, vecs, results[i]);
+			r = del_maps_result(r, ret);
+		}
+	} else {
+		vector_foreach_slot(vecs->mpvec, mpp, i) {
+			ret = flush_map(mpp, vecs);
+			if (ret == DM_FLUSH_OK)
+				i--;
+			r = del_maps_result(r, ret);
+		}
+	}
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
 	/* flush any multipath maps that aren't currently known by multipathd */
 	ret = dm_flush_maps(0);
 	if (ret == DM_FLUSH_BUSY && r != 1)
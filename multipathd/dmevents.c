@@ -13,6 +13,7 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
 #include <linux/dm-ioctl.h>
 #include <errno.h>
@@ -39,9 +40,23 @@ enum event_actions {
 struct dev_event {
 	char name[WWID_SIZE];
 	uint32_t evt_nr;
+	unsigned int minor;
 	enum event_actions action;
 };
 
+/*
+ * The last event number seen for each watched map, indexed by DM minor
+ * number, so that the checker can look it up without searching
+ * waiter->events. It's filled in by dm_get_events(), which lists all
+ * maps on every event. Protected by waiter->events_lock.
+ */
+struct minor_event {
+	uint32_t evt_nr;
+	bool valid;
+};
+
+#define MAX_MINOR_EVENTS (1U << 20)
+
 struct dmevent_waiter {
 	int fd;
 	struct vectors *vecs;
@@ -50,6 +65,8 @@ struct dmevent_waiter {
 };
 
 static struct dmevent_waiter *waiter;
+static struct minor_event *minor_events;
+static unsigned int n_minor_events;
 /*
  * DM_VERSION_MINOR hasn't been updated when DM_DEV_ARM_POLL
  * was added in kernel 4.13. 4.37.0 (4.14) has it, safely.
@@ -118,6 +135,52 @@ void cleanup_dmevent_waiter(void)
 	vector_free(waiter->events);
 	free(waiter);
 	waiter = NULL;
+	free(minor_events);
+	minor_events = NULL;
+	n_minor_events = 0;
+}
+
+/* Call with waiter->events_lock held */
+static void set_minor_event(unsigned int minor, uint32_t evt_nr)
+{
+	if (minor >= n_minor_events) {
+		unsigned int n = n_minor_events ? n_minor_events : 64;
+		struct minor_event *tmp;
+
+		if (minor >= MAX_MINOR_EVENTS)
+			return;
+		while (n <= minor)
+			n *= 2;
+		tmp = realloc(minor_events, n * sizeof(*tmp));
+		if (!tmp)
+			return;
+		memset(tmp + n_minor_events, 0,
+		       (n - n_minor_events) * sizeof(*tmp));
+		minor_events = tmp;
+		n_minor_events = n;
+	}
+	minor_events[minor].evt_nr = evt_nr;
+	minor_events[minor].valid = true;
+}
+
+/* Call with waiter->events_lock held */
+static void clear_minor_event(unsigned int minor)
+{
+	if (minor < n_minor_events)
+		minor_events[minor].valid = false;
+}
+
+bool dmevent_map_unchanged(unsigned int minor, uint32_t evt_nr)
+{
+	bool unchanged;
+
+	if (!waiter)
+		return false;
+	pthread_mutex_lock(&waiter->events_lock);
+	unchanged = minor < n_minor_events && minor_events[minor].valid &&
+		minor_events[minor].evt_nr == evt_nr;
+	pthread_mutex_unlock(&waiter->events_lock);
+	return unchanged;
 }
 
 static int arm_dm_event_poll(int fd)
@@ -185,6 +248,10 @@ static int dm_get_events(void)
 					dev_evt->action = EVENT_UPDATE;
 				} else
 					dev_evt->action = EVENT_NOTHING;
+				if (dev_evt->minor != minor(names->dev))
+					clear_minor_event(dev_evt->minor);
+				dev_evt->minor = minor(names->dev);
+				set_minor_event(dev_evt->minor, event_nr);
 				break;
 			}
 		}
@@ -232,6 +299,7 @@ int watch_dmevents(char *name)
 
 	strlcpy(dev_evt->name, name, WWID_SIZE);
 	dev_evt->evt_nr = event_nr;
+	dev_evt->minor = MAX_MINOR_EVENTS;
 	dev_evt->action = EVENT_NOTHING;
 
 	pthread_mutex_lock(&waiter->events_lock);
@@ -268,6 +336,8 @@ void unwatch_all_dmevents(void)
 	vector_foreach_slot(waiter->events, dev_evt, i)
 		free(dev_evt);
 	vector_reset(waiter->events);
+	if (minor_events)
+		memset(minor_events, 0, n_minor_events * sizeof(*minor_events));
 	pthread_mutex_unlock(&waiter->events_lock);
 }
 
@@ -279,6 +349,7 @@ static void unwatch_dmevents(char *name)
 	pthread_mutex_lock(&waiter->events_lock);
 	vector_foreach_slot(waiter->events, dev_evt, i) {
 		if (!strcmp(dev_evt->name, name)) {
+			clear_minor_event(dev_evt->minor);
 			vector_del_slot(waiter->events, i);
 			free(dev_evt);
 			break;
@@ -333,6 +404,7 @@ static int dmevent_loop (void)
 			if (dev_evt->action != EVENT_NOTHING) {
 				curr_dev = *dev_evt;
 				if (dev_evt->action == EVENT_REMOVE) {
+					clear_minor_event(dev_evt->minor);
 					vector_del_slot(waiter->events, i);
 					free(dev_evt);
 				} else
@@ -360,7 +432,7 @@ static int dmevent_loop (void)
 		 * 5) a switch group : nothing to do
 		 */
 		pthread_cleanup_push(cleanup_lock, &waiter->vecs->lock);
-		lock(&waiter->vecs->lock);
+		lock(&waiter->vecs->lock, __func__);
 		pthread_testcancel();
 		r = 0;
 		if (curr_dev.action == EVENT_REMOVE)
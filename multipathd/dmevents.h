@@ -1,6 +1,8 @@
 #ifndef DMEVENTS_H_INCLUDED
 #define DMEVENTS_H_INCLUDED
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "structs_vec.h"
 
 int dmevent_poll_supported(void);
@@ -8,6 +10,12 @@ int init_dmevent_waiter(struct vectors *vecs);
 void cleanup_dmevent_waiter(void);
 int watch_dmevents(char *name);
 void unwatch_all_dmevents(void);
+/*
+ * True if the last event number the dmevents thread has seen for the
+ * map with DM minor @minor is @evt_nr. False if it's different or
+ * unknown, e.g. if dmevent polling isn't used.
+ */
+bool dmevent_map_unchanged(unsigned int minor, uint32_t evt_nr);
 void *wait_dmevents (void *unused);
 
 #endif /* DMEVENTS_H_INCLUDED */
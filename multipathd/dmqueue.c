@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <urcu.h>
+
+#include "structs.h"
+#include "devmapper.h"
+#include "debug.h"
+#include "util.h"
+#include "lock.h"
+#include "time-util.h"
+#include "metrics.h"
+#include "list.h"
+#include "dmqueue.h"
+
+static pthread_mutex_t dmq_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dmq_cond = PTHREAD_COND_INITIALIZER;
+/* signaled whenever an operation is done */
+static pthread_cond_t dmq_done_cond = PTHREAD_COND_INITIALIZER;
+static LIST_HEAD(dmq);
+/* The operation that is being sent, protected by dmq_mutex */
+static struct dm_op *dmq_running;
+static pthread_t dmq_self;
+static bool dmq_self_set;
+
+static void free_dm_op(struct dm_op *op)
+{
+	if (!op)
+		return;
+	free(op->map);
+	free(op);
+}
+
+struct dm_op *alloc_path_op(enum dm_op_type type, const struct path *pp,
+			    dm_op_done_fn *done)
+{
+	struct dm_op *op;
+
+	if (!pp->mpp || !pp->mpp->alias)
+		return NULL;
+	op = calloc(1, sizeof(*op));
+	if (!op)
+		return NULL;
+	op->map = strdup(pp->mpp->alias);
+	if (!op->map) {
+		free(op);
+		return NULL;
+	}
+	INIT_LIST_HEAD(&op->node);
+	op->type = type;
+	op->done = done;
+	strlcpy(op->dev, pp->dev, sizeof(op->dev));
+	strlcpy(op->dev_t, pp->dev_t, sizeof(op->dev_t));
+	get_monotonic_time(&op->queued);
+	return op;
+}
+
+void dmqueue_submit(struct list_head *ops)
+{
+	if (list_empty(ops))
+		return;
+	pthread_mutex_lock(&dmq_mutex);
+	list_splice_tail_init(ops, &dmq);
+	pthread_cond_signal(&dmq_cond);
+	pthread_mutex_unlock(&dmq_mutex);
+}
+
+static void run_dm_op(struct dm_op *op)
+{
+	struct timespec now, wait;
+	int rc;
+
+	get_monotonic_time(&now);
+	timespecsub(&now, &op->queued, &wait);
+	metric_observe(MP_METRIC_DM_QUEUE_WAIT, NULL, &wait);
+
+	switch (op->type) {
+	case DM_OP_FAIL_PATH:
+		rc = dm_fail_path(op->map, op->dev_t);
+		break;
+	case DM_OP_REINSTATE_PATH:
+		rc = dm_reinstate_path(op->map, op->dev_t);
+		break;
+	default:
+		condlog(0, "%s: invalid operation %d", op->map, op->type);
+		rc = 1;
+		break;
+	}
+	if (op->done)
+		op->done(op, rc);
+}
+
+static void cleanup_running_op(void *arg)
+{
+	pthread_mutex_lock(&dmq_mutex);
+	dmq_running = NULL;
+	pthread_cond_broadcast(&dmq_done_cond);
+	pthread_mutex_unlock(&dmq_mutex);
+	free_dm_op(arg);
+}
+
+void cleanup_dm_ops(void *arg)
+{
+	struct list_head *ops = arg;
+	struct dm_op *op;
+
+	while ((op = list_pop_entry(ops, typeof(*op), node)))
+		free_dm_op(op);
+}
+
+static void cleanup_global_dmq(void *arg __attribute__((unused)))
+{
+	pthread_mutex_lock(&dmq_mutex);
+	cleanup_dm_ops(&dmq);
+	dmq_self_set = false;
+	pthread_cond_broadcast(&dmq_done_cond);
+	pthread_mutex_unlock(&dmq_mutex);
+}
+
+static bool map_has_ops(const char *mapname)
+{
+	struct dm_op *op;
+
+	if (dmq_running && !strcmp(dmq_running->map, mapname))
+		return true;
+	list_for_each_entry(op, &dmq, node)
+		if (!strcmp(op->map, mapname))
+			return true;
+	return false;
+}
+
+bool dmqueue_map_busy(const char *mapname)
+{
+	bool busy;
+
+	pthread_mutex_lock(&dmq_mutex);
+	busy = dmq_self_set && map_has_ops(mapname);
+	pthread_mutex_unlock(&dmq_mutex);
+	return busy;
+}
+
+/*
+ * Overrides libmultipath's symbol by the same name. Called before
+ * synchronous DM operations on @mapname, usually with vecs->lock held.
+ * Messages that were queued earlier must be sent first, otherwise they
+ * would undo the operation. This doesn't deadlock, because the dmqueue
+ * thread never takes vecs->lock.
+ */
+void dm_sync_map_callback(const char *mapname)
+{
+	pthread_mutex_lock(&dmq_mutex);
+	pthread_cleanup_push(cleanup_mutex, &dmq_mutex);
+	/* The dmqueue thread itself sends the queued messages */
+	if (!dmq_self_set || !pthread_equal(pthread_self(), dmq_self)) {
+		while (dmq_self_set && map_has_ops(mapname))
+			pthread_cond_wait(&dmq_done_cond, &dmq_mutex);
+	}
+	pthread_cleanup_pop(1);
+}
+
+static void rcu_unregister(__attribute__((unused)) void *param)
+{
+	rcu_unregister_thread();
+}
+
+/*
+ * There is only one dmqueue thread. libmultipath serializes all
+ * device-mapper ioctls with libmp_dm_lock, so more threads wouldn't send
+ * messages any faster, and a single thread keeps the messages of every
+ * map in order for free.
+ */
+void *dmqueueloop(void *ap __attribute__((unused)))
+{
+	pthread_cleanup_push(rcu_unregister, NULL);
+	rcu_register_thread();
+	mlockall(MCL_CURRENT | MCL_FUTURE);
+	pthread_cleanup_push(cleanup_global_dmq, NULL);
+	pthread_mutex_lock(&dmq_mutex);
+	dmq_self = pthread_self();
+	dmq_self_set = true;
+	pthread_mutex_unlock(&dmq_mutex);
+
+	while (1) {
+		struct dm_op *op;
+
+		pthread_cleanup_push(cleanup_mutex, &dmq_mutex);
+		pthread_mutex_lock(&dmq_mutex);
+		pthread_testcancel();
+		while (list_empty(&dmq))
+			pthread_cond_wait(&dmq_cond, &dmq_mutex);
+		op = list_pop_entry(&dmq, typeof(*op), node);
+		dmq_running = op;
+		pthread_cleanup_pop(1);
+
+		pthread_cleanup_push(cleanup_running_op, op);
+		run_dm_op(op);
+		pthread_cleanup_pop(1);
+	}
+
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef DMQUEUE_H_INCLUDED
+#define DMQUEUE_H_INCLUDED
+
+#include <time.h>
+#include "list.h"
+#include "structs.h"
+
+/*
+ * Queue of device-mapper path messages. The checker queues the fail
+ * and reinstate messages of a tick while holding vecs->lock, and the
+ * dmqueue thread sends them without holding it. Messages are sent in
+ * the order they were queued. Other DM operations on a map wait until
+ * the queued messages for the map have been sent, see
+ * dm_sync_map_callback(). Thus the messages of a map are never
+ * reordered.
+ */
+enum dm_op_type {
+	DM_OP_FAIL_PATH,
+	DM_OP_REINSTATE_PATH,
+};
+
+struct dm_op;
+
+/*
+ * Completion callback, called by the dmqueue thread after the message
+ * has been sent, with the return value of dm_message(). vecs->lock is
+ * NOT held, the callback must not touch paths or maps.
+ */
+typedef void (dm_op_done_fn)(const struct dm_op *op, int rc);
+
+struct dm_op {
+	struct list_head node;
+	enum dm_op_type type;
+	dm_op_done_fn *done;
+	struct timespec queued;
+	char *map;
+	char dev[FILE_NAME_SIZE];
+	char dev_t[BLK_DEV_SIZE];
+};
+
+/*
+ * Allocate an operation for path @pp in its map. Call with vecs->lock
+ * held. Returns NULL on failure.
+ */
+struct dm_op *alloc_path_op(enum dm_op_type type, const struct path *pp,
+			    dm_op_done_fn *done);
+
+/*
+ * Move the operations in @ops to the queue, and wake up the dmqueue
+ * thread. @ops is empty afterwards.
+ */
+void dmqueue_submit(struct list_head *ops);
+
+/*
+ * True if messages for map @mapname are queued or being sent. The
+ * kernel state of the map may not reflect them yet.
+ */
+bool dmqueue_map_busy(const char *mapname);
+
+/*
+ * Free all operations in the list @arg. Can be used as a pthread
+ * cleanup handler.
+ */
+void cleanup_dm_ops(void *arg);
+
+/*
+ * Main dmqueue thread loop
+ */
+void *dmqueueloop(void *ap);
+
+#endif /* DMQUEUE_H_INCLUDED */
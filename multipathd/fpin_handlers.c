@@ -101,7 +101,7 @@ fpin_unset_marginal_dev(uint32_t host_num, struct vectors *vecs)
 	int i;
 
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
-	lock(&vecs->lock);
+	lock(&vecs->lock, __func__);
 	pthread_testcancel();
 
 	pthread_mutex_lock(&fpin_li_marginal_dev_mutex);
@@ -405,7 +405,7 @@ static int  fpin_chk_wwn_setpath_marginal(uint16_t host_num,  struct vectors *ve
 	bool found_nvme = false;
 
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
-	lock(&vecs->lock);
+	lock(&vecs->lock, __func__);
 	pthread_testcancel();
 
 	vector_foreach_slot(vecs->pathvec, pp, k) {
@@ -64,6 +64,10 @@
 #include "pgpolicies.h"
 #include "log.h"
 #include "uxsock.h"
+#include "mempool.h"
+#include "metrics.h"
+#include "history.h"
+#include "trace.h"
 #include "alias.h"
 
 #include "mpath_cmd.h"
@@ -84,11 +88,14 @@
 #include "io_err_stat.h"
 #include "foreign.h"
 #include "purge.h"
+#include "dmqueue.h"
 #include "../third-party/valgrind/drd.h"
 #include "init_unwinder.h"
 
 #define CMDSIZE 160
 #define MSG_SIZE 32
+/* release empty slabs after this many seconds without frees */
+#define MEMPOOL_IDLE_SECS 60
 
 static unsigned int
 mpath_pr_event_handle(struct path *pp, unsigned int nr_keys_needed,
@@ -138,9 +145,10 @@ static enum force_reload_types reconfigure_pending = FORCE_RELOAD_NONE;
 pid_t daemon_pid;
 static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t config_cond;
-static pthread_t check_thr, purge_thr, uevent_thr, uxlsnr_thr, uevq_thr,
+static pthread_t check_thr, purge_thr, dmq_thr, uevent_thr, uxlsnr_thr, uevq_thr,
 	dmevent_thr, fpin_thr, fpin_consumer_thr;
-static bool check_thr_started, purge_thr_started, uevent_thr_started,
+static bool check_thr_started, purge_thr_started, dmq_thr_started,
+	uevent_thr_started,
 	uxlsnr_thr_started, uevq_thr_started, dmevent_thr_started,
 	fpin_thr_started, fpin_consumer_thr_started;
 static int pid_fd = -1;
@@ -173,6 +181,7 @@ struct config *multipath_conf;
 static volatile sig_atomic_t exit_sig;
 static volatile sig_atomic_t reconfig_sig;
 static volatile sig_atomic_t log_reset_sig;
+static volatile sig_atomic_t history_dump_sig;
 
 static const char *daemon_status_msg[DAEMON_STATUS_SIZE] = {
 	[DAEMON_INIT] = "init",
@@ -336,6 +345,16 @@ void remove_map_callback(struct multipath *mpp)
 		unblock_reconfigure();
 }
 
+/*
+ * The uevent listener lost events, so our state may be out of sync
+ * with the system. Resync by reconfiguring.
+ * Overrides libmultipath's weak symbol by the same name
+ */
+void uevent_overrun_callback(void)
+{
+	schedule_reconfigure(FORCE_RELOAD_YES);
+}
+
 void schedule_reconfigure(enum force_reload_types requested_type)
 {
 	pthread_mutex_lock(&config_lock);
@@ -461,6 +480,7 @@ switch_pathgroup (struct multipath * mpp)
 	dm_switchgroup(mpp->alias, mpp->bestpg);
 	condlog(2, "%s: switch to path group #%i",
 		 mpp->alias, mpp->bestpg);
+	publish_event("pg_switch map=%s pg=%d", mpp->alias, mpp->bestpg);
 }
 
 static int
@@ -731,6 +751,7 @@ retry:
 		return 1;
 
 	mpp->action = ACT_RELOAD;
+	mpp->reload_reason = "update";
 
 	if (setup_map(mpp, &params, vecs)) {
 		condlog(0, "%s: failed to setup new map in update", mpp->alias);
@@ -896,10 +917,10 @@ sync_maps_state(vector mpvec)
 		sync_map_state(mpp, false);
 }
 
+/* Update multipathd's state after dm_flush_map__() returned @r */
 int
-flush_map(struct multipath * mpp, struct vectors * vecs)
+finish_flush_map(struct multipath *mpp, struct vectors *vecs, int r)
 {
-	int r = dm_suspend_and_flush_map(mpp->alias, 0);
 	if (r != DM_FLUSH_OK) {
 		if (r == DM_FLUSH_FAIL_CANT_RESTORE)
 			remove_feature(&mpp->features, "queue_if_no_path");
@@ -913,6 +934,13 @@ flush_map(struct multipath * mpp, struct vectors * vecs)
 	return 0;
 }
 
+int
+flush_map(struct multipath * mpp, struct vectors * vecs)
+{
+	return finish_flush_map(mpp, vecs,
+				dm_suspend_and_flush_map(mpp->alias, 0));
+}
+
 static int
 uev_add_map (struct uevent * uev, struct vectors * vecs)
 {
@@ -933,7 +961,7 @@ uev_add_map (struct uevent * uev, struct vectors * vecs)
 		}
 	}
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
-	lock(&vecs->lock);
+	lock(&vecs->lock, __func__);
 	pthread_testcancel();
 	rc = ev_add_map(uev->kernel, alias, vecs);
 	lock_cleanup_pop(vecs->lock);
@@ -1018,7 +1046,7 @@ uev_remove_map (struct uevent * uev, struct vectors * vecs)
 	minor = uevent_get_minor(uev);
 
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
-	lock(&vecs->lock);
+	lock(&vecs->lock, __func__);
 	pthread_testcancel();
 	mpp = find_mp_by_minor(vecs->mpvec, minor);
 
@@ -1145,7 +1173,7 @@ uev_add_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
 	}
 
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
-	lock(&vecs->lock);
+	lock(&vecs->lock, __func__);
 	pthread_testcancel();
 	pp = find_path_by_dev(vecs->pathvec, uev->kernel);
 	if (pp) {
@@ -1350,6 +1378,7 @@ rescan:
 
 		verify_paths(mpp);
 		mpp->action = ACT_RELOAD;
+		mpp->reload_reason = "path added";
 		prflag = mpp->prflag;
 		mpath_pr_event_handle(pp, 0, 0);
 	} else {
@@ -1459,7 +1488,7 @@ uev_remove_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
 	delete_foreign(uev->udev);
 
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
-	lock(&vecs->lock);
+	lock(&vecs->lock, __func__);
 	pthread_testcancel();
 	pp = find_path_by_dev(vecs->pathvec, uev->kernel);
 	if (pp)
@@ -1536,6 +1565,7 @@ ev_remove_path (struct path *pp, struct vectors * vecs, int need_do_map)
 		 * reload the map
 		 */
 		mpp->action = ACT_RELOAD;
+		mpp->reload_reason = "path removed";
 		if (domap(mpp, params, 1) == DOMAP_FAIL) {
 			condlog(0, "%s: failed in domap for "
 				"removal of path %s",
@@ -1673,7 +1703,7 @@ uev_update_path (struct uevent *uev, struct vectors * vecs)
 	}
 
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
-	lock(&vecs->lock);
+	lock(&vecs->lock, __func__);
 	pthread_testcancel();
 
 	pp = find_path_by_dev(vecs->pathvec, uev->kernel);
@@ -1812,7 +1842,7 @@ uev_pathfail_check(struct uevent *uev, struct vectors *vecs)
 	}
 
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
-	lock(&vecs->lock);
+	lock(&vecs->lock, __func__);
 	pthread_testcancel();
 	pp = find_path_by_devt(vecs->pathvec, devt);
 	if (!pp)
@@ -1871,6 +1901,7 @@ uev_trigger (struct uevent * uev, void * trigger_data)
 	if (state == DAEMON_SHUTDOWN)
 		return 0;
 
+	TRACE_PROBE(uevent_start, uev->kernel, uev->action);
 	/*
 	 * device map event
 	 * Add events are ignored here as the tables
@@ -1918,6 +1949,7 @@ uev_trigger (struct uevent * uev, void * trigger_data)
 		r += uev_update_path(uev, vecs);
 
 out:
+	TRACE_PROBE(uevent_done, uev->kernel, r);
 	return r;
 }
 
@@ -2037,16 +2069,143 @@ exit_daemon (void)
 	post_config_state(DAEMON_SHUTDOWN);
 }
 
+/*
+ * While update_paths() runs, the fail and reinstate messages of the path
+ * checker are only recorded in pp->pending_msg. flush_path_msgs() hands
+ * them to the dmqueue thread map by map before the checker drops the
+ * lock, so that the checker doesn't wait for device-mapper. If a path
+ * gets more than one message, only the last one is sent.
+ */
+static bool defer_path_msgs;
+static unsigned int n_pending_msgs;
+
+static void queue_path_msg(struct path *pp, enum path_msg msg)
+{
+	if (pp->pending_msg == PATH_MSG_NONE) {
+		pp->mpp->pending_msgs++;
+		n_pending_msgs++;
+	} else
+		metric_inc(MP_METRIC_PATH_MSGS_SAVED, NULL);
+	pp->pending_msg = msg;
+}
+
+static void send_fail_path(struct path *pp)
+{
+	metric_inc(MP_METRIC_PATH_MSGS, "fail");
+	if (dm_fail_path(pp->mpp->alias, pp->dev_t) == 0)
+		publish_event("path_down map=%s path=%s dev_t=%s",
+			      pp->mpp->alias, pp->dev, pp->dev_t);
+}
+
+static void send_reinstate_path(struct path *pp)
+{
+	metric_inc(MP_METRIC_PATH_MSGS, "reinstate");
+	if (dm_reinstate_path(pp->mpp->alias, pp->dev_t))
+		condlog(0, "%s: reinstate failed", pp->dev_t);
+	else {
+		condlog(2, "%s: reinstated", pp->dev_t);
+		publish_event("path_up map=%s path=%s dev_t=%s",
+			      pp->mpp->alias, pp->dev, pp->dev_t);
+		update_queue_mode_add_path(pp->mpp);
+	}
+}
+
+/* Called by the dmqueue thread, without vecs->lock */
+static void path_msg_done(const struct dm_op *op, int rc)
+{
+	if (op->type == DM_OP_FAIL_PATH) {
+		metric_inc(MP_METRIC_PATH_MSGS, "fail");
+		if (rc == 0)
+			publish_event("path_down map=%s path=%s dev_t=%s",
+				      op->map, op->dev, op->dev_t);
+		return;
+	}
+	metric_inc(MP_METRIC_PATH_MSGS, "reinstate");
+	if (rc)
+		condlog(0, "%s: reinstate failed", op->dev_t);
+	else {
+		condlog(2, "%s: reinstated", op->dev_t);
+		publish_event("path_up map=%s path=%s dev_t=%s",
+			      op->map, op->dev, op->dev_t);
+	}
+}
+
+static void queue_path_op(struct path *pp, struct list_head *ops)
+{
+	bool fail = pp->pending_msg == PATH_MSG_FAIL;
+	struct dm_op *op;
+
+	op = alloc_path_op(fail ? DM_OP_FAIL_PATH : DM_OP_REINSTATE_PATH,
+			   pp, path_msg_done);
+	if (!op) {
+		if (fail)
+			send_fail_path(pp);
+		else
+			send_reinstate_path(pp);
+		return;
+	}
+	list_add_tail(&op->node, ops);
+	/*
+	 * The queueing mode only depends on the checker state of the
+	 * paths. Update it now, rather than when the message has been
+	 * sent, so that retry_count_tick() can't disable queueing in
+	 * the meantime.
+	 */
+	if (!fail)
+		update_queue_mode_add_path(pp->mpp);
+}
+
+static void flush_map_path_msgs(struct multipath *mpp, struct list_head *ops)
+{
+	struct path *pp;
+	int i;
+
+	vector_foreach_slot(mpp->paths, pp, i) {
+		if (pp->pending_msg == PATH_MSG_NONE || pp->mpp != mpp)
+			continue;
+		queue_path_op(pp, ops);
+		pp->pending_msg = PATH_MSG_NONE;
+		n_pending_msgs--;
+	}
+	mpp->pending_msgs = 0;
+}
+
+static void flush_path_msgs(struct vectors *vecs)
+{
+	LIST_HEAD(ops);
+	struct multipath *mpp;
+	struct path *pp;
+	int i;
+
+	defer_path_msgs = false;
+	if (!n_pending_msgs)
+		return;
+	vector_foreach_slot(vecs->mpvec, mpp, i)
+		if (mpp->pending_msgs)
+			flush_map_path_msgs(mpp, &ops);
+	if (n_pending_msgs) {
+		/* Paths that were orphaned after their message was queued */
+		vector_foreach_slot(vecs->pathvec, pp, i)
+			pp->pending_msg = PATH_MSG_NONE;
+		n_pending_msgs = 0;
+	}
+	dmqueue_submit(&ops);
+}
+
 static void
 fail_path (struct path * pp, int del_active)
 {
 	if (!pp->mpp)
 		return;
 
+	TRACE_PROBE(fail_path, pp->dev, pp->mpp->alias, del_active);
 	condlog(2, "checker failed path %s in map %s",
 		 pp->dev_t, pp->mpp->alias);
 
-	dm_fail_path(pp->mpp->alias, pp->dev_t);
+	if (defer_path_msgs)
+		queue_path_msg(pp, PATH_MSG_FAIL);
+	else
+		send_fail_path(pp);
 	if (del_active)
 		update_queue_mode_del_path(pp->mpp);
 }
@@ -2060,12 +2219,11 @@ reinstate_path (struct path * pp)
 	if (!pp->mpp)
 		return;
 
-	if (dm_reinstate_path(pp->mpp->alias, pp->dev_t))
-		condlog(0, "%s: reinstate failed", pp->dev_t);
-	else {
-		condlog(2, "%s: reinstated", pp->dev_t);
-		update_queue_mode_add_path(pp->mpp);
-	}
+	TRACE_PROBE(reinstate_path, pp->dev, pp->mpp->alias);
+	if (defer_path_msgs)
+		queue_path_msg(pp, PATH_MSG_REINSTATE);
+	else
+		send_reinstate_path(pp);
 }
 
 static void
@@ -2329,8 +2487,8 @@ static bool update_prio(struct multipath *mpp, bool refresh_all)
 	return true;
 }
 
-static int reload_map(struct vectors *vecs, struct multipath *mpp,
-		      int is_daemon)
+static int reload_map__(struct vectors *vecs, struct multipath *mpp,
+			int is_daemon, enum actions action, const char *reason)
 {
 	char *params __attribute__((cleanup(cleanup_charp))) = NULL;
 	int r;
@@ -2340,7 +2498,8 @@ static int reload_map(struct vectors *vecs, struct multipath *mpp,
 		condlog(0, "%s: failed to setup map", mpp->alias);
 		return 1;
 	}
-	mpp->action = ACT_RELOAD;
+	mpp->action = action;
+	mpp->reload_reason = reason;
 
 	r = domap(mpp, params, is_daemon);
 	if (r == DOMAP_FAIL || r == DOMAP_RETRY) {
@@ -2348,10 +2507,72 @@ static int reload_map(struct vectors *vecs, struct multipath *mpp,
 			"for reload map", mpp->alias, r);
 		return 1;
 	}
+	publish_event("map_reload map=%s", mpp->alias);
 
 	return 0;
 }
 
+static int reload_map(struct vectors *vecs, struct multipath *mpp,
+		      int is_daemon)
+{
+	return reload_map__(vecs, mpp, is_daemon, ACT_RELOAD, "reload");
+}
+
+/*
+ * Set up @mpp again after a configuration change. The map is set up
+ * on a copy first, and only reloaded if select_action() finds that
+ * the table would change.
+ */
+static int reconfigure_map(struct vectors *vecs, struct multipath *mpp)
+{
+	struct multipath *nmpp __attribute__((cleanup(cleanup_multipath))) = NULL;
+	char *params __attribute__((cleanup(cleanup_charp))) = NULL;
+	enum actions action = ACT_RELOAD;
+	const char *reason = "reconfigure";
+	struct path *pp;
+	int i, ret = 0;
+
+	update_mpp_paths(mpp, vecs->pathvec);
+	nmpp = alloc_multipath();
+	if (!nmpp || !(nmpp->alias = strdup(mpp->alias)) ||
+	    !(nmpp->paths = vector_alloc()))
+		goto reload;
+	strlcpy(nmpp->wwid, mpp->wwid, sizeof(nmpp->wwid));
+	nmpp->size = mpp->size;
+	nmpp->mpe = mpp->mpe;
+	vector_foreach_slot(mpp->paths, pp, i) {
+		if (!vector_alloc_slot(nmpp->paths))
+			goto reload;
+		vector_set_slot(nmpp->paths, pp);
+	}
+	if (setup_map(nmpp, &params, vecs) != 0)
+		goto reload;
+
+	select_action(nmpp, vecs->mpvec, 0);
+	if (nmpp->action == ACT_NOTHING) {
+		condlog(3, "%s: no reload needed", mpp->alias);
+		free(params);
+		params = NULL;
+		if (setup_map(mpp, &params, vecs) != 0)
+			ret = 1;
+		if (setup_multipath(vecs, mpp) != 0)
+			return 2;
+		return ret;
+	}
+	/* Renames and resizes aren't a matter of configuration */
+	if (nmpp->action == ACT_SWITCHPG)
+		action = ACT_SWITCHPG;
+	if (nmpp->reload_reason)
+		reason = nmpp->reload_reason;
+reload:
+	if (reload_map__(vecs, mpp, 1, action, reason))
+		ret = 1;
+	if (setup_multipath(vecs, mpp) != 0)
+		return 2;
+	sync_map_state(mpp, false);
+	return ret;
+}
+
 int reload_and_sync_map(struct multipath *mpp, struct vectors *vecs)
 {
 	int ret = 0;
@@ -2480,6 +2701,8 @@ start_path_check(struct path *pp)
 	struct config *conf;
 
 	if (path_sysfs_state(pp) ==  PATH_UP) {
+		TRACE_PROBE(checker_start, pp->dev,
+			    checker_name(&pp->checker));
 		conf = get_multipath_config();
 		pthread_cleanup_push(put_multipath_config, conf);
 		start_checker(pp, conf, 1, PATH_UNCHECKED);
@@ -2540,6 +2763,9 @@ get_new_state(struct path *pp)
 		pathinfo(pp, conf, 0);
 		pthread_cleanup_pop(1);
 	}
+	/* latency is only updated when the checker has completed */
+	TRACE_PROBE(checker_done, pp->dev, newstate,
+		    pp->chk_latency.last_us);
 	return newstate;
 }
 
@@ -2570,6 +2796,30 @@ static int sync_mpp(struct vectors *vecs, struct multipath *mpp, unsigned int ti
 				  mpp->sync_tick;
 	if (mpp->sync_tick && !mpp->checker_count)
 		return DMP_OK;
+	/*
+	 * Paths of this map were checked, but if device-mapper hasn't
+	 * reported an event for the map since we last read its table and
+	 * status, there's nothing new to read. If there's an event, the
+	 * dmevents thread updates the map anyway. A full resync is still
+	 * done when sync_tick expires.
+	 */
+	if (mpp->sync_tick && has_dm_info(mpp) &&
+	    dmevent_map_unchanged(mpp->dmi.minor, mpp->dmi.event_nr)) {
+		metric_inc(MP_METRIC_MAP_SYNCS_SKIPPED, NULL);
+		return DMP_OK;
+	}
+	/*
+	 * flush_path_msgs() may just have queued fail or reinstate
+	 * messages for this map. Until the dmqueue thread has sent them,
+	 * the kernel reports the old path states, and reading them would
+	 * make the next check send the messages again. Clearing
+	 * sync_tick makes sure the map is synced in one of the next ticks.
+	 */
+	if (dmqueue_map_busy(mpp->alias)) {
+		mpp->sync_tick = 0;
+		metric_inc(MP_METRIC_MAP_SYNCS_SKIPPED, NULL);
+		return DMP_OK;
+	}
 
 	return do_sync_mpp(vecs, mpp);
 }
@@ -2666,8 +2916,11 @@ update_path_state (struct vectors * vecs, struct path * pp)
 	    (san_path_check_enabled(pp->mpp) ||
 	     marginal_path_check_enabled(pp->mpp))) {
 		if (should_skip_path(pp)) {
-			if (!pp->marginal && pp->state != PATH_DELAYED)
+			if (!pp->marginal && pp->state != PATH_DELAYED) {
 				condlog(2, "%s: path is now marginal", pp->dev);
+				publish_event("path_marginal map=%s path=%s marginal=1",
+					      pp->mpp->alias, pp->dev);
+			}
 			if (!marginal_pathgroups) {
 				if (marginal_path_check_enabled(pp->mpp))
 					/* to reschedule as soon as possible,
@@ -2682,9 +2935,12 @@ update_path_state (struct vectors * vecs, struct path * pp)
 				pp->mpp->prio_update = PRIO_UPDATE_MARGINAL;
 			}
 		} else {
-			if (pp->marginal || pp->state == PATH_DELAYED)
+			if (pp->marginal || pp->state == PATH_DELAYED) {
 				condlog(2, "%s: path is no longer marginal",
 					pp->dev);
+				publish_event("path_marginal map=%s path=%s marginal=0",
+					      pp->mpp->alias, pp->dev);
+			}
 			if (marginal_pathgroups && pp->marginal) {
 				pp->marginal = 0;
 				pp->mpp->prio_update = PRIO_UPDATE_MARGINAL;
@@ -2708,6 +2964,9 @@ update_path_state (struct vectors * vecs, struct path * pp)
 		pp->state = newstate;
 
 		LOG_MSG(1, pp);
+		metric_inc(MP_METRIC_PATH_STATE_CHANGES,
+			   checker_state_name(newstate));
+		history_path_state(pp, oldstate, newstate);
 
 		/*
 		 * upon state change, reset the checkint
@@ -3093,6 +3352,7 @@ update_paths(struct vectors *vecs, int *num_paths_p, time_t start_secs)
 	int i, rc;
 
 	get_monotonic_time(&start_time);
+	defer_path_msgs = true;
 
 	vector_foreach_slot(vecs->pathvec, pp, i) {
 		if (pp->is_checked != CHECK_PATH_STARTED)
@@ -3112,10 +3372,13 @@ update_paths(struct vectors *vecs, int *num_paths_p, time_t start_secs)
 		    (lock_has_waiters(&vecs->lock) || waiting_clients())) {
 			get_monotonic_time(&end_time);
 			timespecsub(&end_time, &start_time, &diff_time);
-			if (diff_time.tv_sec > 0)
+			if (diff_time.tv_sec > 0) {
+				flush_path_msgs(vecs);
 				return CHECKER_UPDATING_PATHS;
+			}
 		}
 	}
+	flush_path_msgs(vecs);
 	return CHECKER_FINISHED;
 }
 
@@ -3224,6 +3487,67 @@ static void checker_finished(struct vectors *vecs, unsigned int ticks,
 	build_purge_list(vecs, purge_list);
 }
 
+/* Time spent in the phases of the checker loop, see checkerloop() */
+enum tick_phase {
+	TICK_CHECK,
+	TICK_WAIT,
+	TICK_UPDATE,
+	TICK_FINISH,
+	TICK_TOTAL,
+	TICK_PHASES__,
+};
+
+static const char * const tick_phase_name[TICK_PHASES__] = {
+	[TICK_CHECK] = "check paths",
+	[TICK_WAIT] = "wait for checkers",
+	[TICK_UPDATE] = "update paths",
+	[TICK_FINISH] = "checker finished",
+	[TICK_TOTAL] = "tick",
+};
+
+static pthread_mutex_t tick_timing_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timing_stats tick_timing[TICK_PHASES__];
+
+/* Add the time since @mark to @phase_us, and move @mark forward */
+static void tick_phase_done(unsigned long long *phase_us,
+			    struct timespec *mark)
+{
+	struct timespec now, diff;
+
+	get_monotonic_time(&now);
+	timespecsub(&now, mark, &diff);
+	*phase_us += timespec_us(&diff);
+	*mark = now;
+}
+
+static void record_tick_timing(const unsigned long long *phase_us)
+{
+	int i;
+
+	pthread_mutex_lock(&tick_timing_lock);
+	for (i = 0; i < TICK_PHASES__; i++)
+		timing_add(&tick_timing[i], phase_us[i]);
+	pthread_mutex_unlock(&tick_timing_lock);
+}
+
+int print_tick_timing(struct strbuf *buf)
+{
+	size_t initial_len = get_strbuf_len(buf);
+	int i, rc = 0;
+
+	pthread_mutex_lock(&tick_timing_lock);
+	pthread_cleanup_push(cleanup_mutex, &tick_timing_lock);
+	if ((rc = print_timing_header(buf, "checker loop")) < 0)
+		goto out;
+	for (i = 0; i < TICK_PHASES__; i++)
+		if ((rc = print_timing(buf, tick_phase_name[i],
+				       &tick_timing[i])) < 0)
+			goto out;
+out:
+	pthread_cleanup_pop(1);
+	return rc < 0 ? rc : (int)(get_strbuf_len(buf) - initial_len);
+}
+
 static void *
 checkerloop (void *ap)
 {
@@ -3243,7 +3567,8 @@ checkerloop (void *ap)
 	last_time.tv_sec -= 1;
 
 	while (1) {
-		struct timespec diff_time, start_time, end_time;
+		struct timespec diff_time, start_time, end_time, mark;
+		unsigned long long phase_us[TICK_PHASES__] = { 0 };
 		int num_paths = 0, strict_timing;
 		unsigned int ticks = 0;
 		enum checker_state checker_state = CHECKER_STARTING;
@@ -3266,6 +3591,7 @@ checkerloop (void *ap)
 		last_time = start_time;
 		ticks = diff_time.tv_sec;
 		watchdog_tick(&start_time);
+		mark = start_time;
 		while (checker_state != CHECKER_FINISHED) {
 			struct multipath *mpp;
 			int i;
@@ -3281,8 +3607,10 @@ checkerloop (void *ap)
 			}
 
 			pthread_cleanup_push(cleanup_lock, &vecs->lock);
-			lock(&vecs->lock);
+			lock(&vecs->lock, __func__);
 			pthread_testcancel();
+			/* includes waiting for vecs->lock */
+			tick_phase_done(&phase_us[TICK_WAIT], &mark);
 			if (checker_state == CHECKER_STARTING) {
 				vector_foreach_slot(vecs->mpvec, mpp, i) {
 					mpp->prio_update = PRIO_UPDATE_NONE;
@@ -3292,13 +3620,19 @@ checkerloop (void *ap)
 					pp->is_checked = CHECK_PATH_UNCHECKED;
 				checker_state = CHECKER_CHECKING_PATHS;
 			}
-			if (checker_state == CHECKER_CHECKING_PATHS)
+			if (checker_state == CHECKER_CHECKING_PATHS) {
 				checker_state = check_paths(vecs, ticks);
-			if (checker_state == CHECKER_UPDATING_PATHS)
+				tick_phase_done(&phase_us[TICK_CHECK], &mark);
+			}
+			if (checker_state == CHECKER_UPDATING_PATHS) {
 				checker_state = update_paths(vecs, &num_paths,
 							     start_time.tv_sec);
-			if (checker_state == CHECKER_FINISHED)
+				tick_phase_done(&phase_us[TICK_UPDATE], &mark);
+			}
+			if (checker_state == CHECKER_FINISHED) {
 				checker_finished(vecs, ticks, &purge_list);
+				tick_phase_done(&phase_us[TICK_FINISH], &mark);
+			}
 			lock_cleanup_pop(vecs->lock);
 		}
 
@@ -3318,6 +3652,9 @@ checkerloop (void *ap)
 
 		get_monotonic_time(&end_time);
 		timespecsub(&end_time, &start_time, &diff_time);
+		metric_observe(MP_METRIC_TICK_DURATION, NULL, &diff_time);
+		phase_us[TICK_TOTAL] = timespec_us(&diff_time);
+		record_tick_timing(phase_us);
 		if (num_paths) {
 			unsigned int max_checkint;
 
@@ -3343,6 +3680,12 @@ checkerloop (void *ap)
 		if (--foreign_tick == 0)
 			check_foreign();
 
+		/*
+		 * Give memory cached during an event storm back to the
+		 * system once things have calmed down.
+		 */
+		mempool_release_idle(MEMPOOL_IDLE_SECS);
+
 		post_config_state(DAEMON_IDLE);
 		conf = get_multipath_config();
 		strict_timing = conf->strict_timing;
@@ -3554,14 +3897,119 @@ static void reconfigure_check(struct config *old, struct config *new)
 
 		/* avoid uid_attrs being freed in rcu_free_config() */
 		old->uid_attrs.allocated = 0;
+		old->uid_attrs.capacity = 0;
 		old->uid_attrs.slot = NULL;
 	}
 }
 
+/*
+ * Apply @conf, which has just replaced @old, without discovering paths
+ * and maps again. This is possible if only the devices, overrides and
+ * multipaths sections changed. Only the maps affected by the changes
+ * are set up again. Returns 0 if the configuration has been applied,
+ * 1 if a full reconfigure is necessary.
+ *
+ * If nothing changed, a full reconfigure is done as well, because the
+ * reconfigure was requested to pick up new devices, or changes in the
+ * bindings and wwids files.
+ */
+static int reconfigure_incremental(struct vectors *vecs, struct config *old,
+				   struct config *conf,
+				   const struct config_snapshot *old_snap)
+{
+	struct config_snapshot snap;
+	union bitfield *changed = NULL;
+	vector affected = NULL;
+	bool devices_changed, overrides_changed, mptable_changed;
+	struct multipath *mpp;
+	struct path *pp;
+	int i, rc, ret = 1;
+
+	if (snapshot_config(conf, &snap) != 0)
+		return 1;
+	if (strcmp(old_snap->global, snap.global)) {
+		condlog(3, "%s: defaults or blacklist changed", __func__);
+		goto out;
+	}
+	devices_changed = strcmp(old_snap->devices, snap.devices);
+	overrides_changed = strcmp(old_snap->overrides, snap.overrides);
+	mptable_changed = strcmp(old_snap->mptable, snap.mptable);
+	if (!devices_changed && !overrides_changed && !mptable_changed) {
+		condlog(3, "%s: configuration unchanged", __func__);
+		goto out;
+	}
+
+	/* A new multipaths entry may create a map from orphaned paths */
+	if (mptable_changed) {
+		vector_foreach_slot(vecs->pathvec, pp, i) {
+			if (!pp->mpp && *pp->wwid &&
+			    find_mpe(conf->mptable, pp->wwid) &&
+			    !find_mpe(old->mptable, pp->wwid)) {
+				condlog(3, "%s: new multipaths entry for orphan path %s",
+					__func__, pp->dev);
+				goto out;
+			}
+		}
+	}
+
+	changed = alloc_bitfield(VECTOR_SIZE(vecs->pathvec));
+	affected = vector_alloc();
+	if (!changed || !affected)
+		goto out;
+
+	rc = reconfigure_paths(vecs->pathvec, old, conf, overrides_changed,
+			       mptable_changed, changed);
+	if (rc != 0) {
+		condlog(3, "%s: %s", __func__, rc == 1 ?
+			"uid_attribute changed" : "failed to update paths");
+		goto out;
+	}
+	vector_foreach_slot(vecs->pathvec, pp, i)
+		if (pp->mpp && is_bit_set_in_bitfield(i, changed) &&
+		    vector_find_or_add_slot(affected, pp->mpp) < 0)
+			goto out;
+
+	/* Check all maps for alias changes before touching any of them */
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		rc = mptable_changed ?
+			mpentry_changed(old, conf, mpp->wwid) : MPE_UNCHANGED;
+		if (rc == MPE_ALIAS_CHANGED) {
+			condlog(3, "%s: alias of %s changed", __func__,
+				mpp->alias);
+			goto out;
+		}
+		if ((overrides_changed || rc == MPE_CHANGED) &&
+		    vector_find_or_add_slot(affected, mpp) < 0)
+			goto out;
+	}
+
+	/* Drop all references to the old configuration */
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		mpp->mpe = find_mpe(conf->mptable, mpp->wwid);
+		mpp->alias_prefix = NULL;
+		vector_free(mpp->hwe);
+		mpp->hwe = NULL;
+		extract_hwe_from_path(mpp);
+	}
+
+	condlog(2, "%s: %d of %d maps affected by configuration changes",
+		__func__, VECTOR_SIZE(affected), VECTOR_SIZE(vecs->mpvec));
+	vector_foreach_slot(affected, mpp, i)
+		reconfigure_map(vecs, mpp);
+	ret = 0;
+out:
+	vector_free(affected);
+	free(changed);
+	free_config_snapshot(&snap);
+	return ret;
+}
+
 static int
 reconfigure (struct vectors *vecs, enum force_reload_types reload_type)
 {
 	struct config * old, *conf;
+	struct config_snapshot old_snap = { NULL };
+	bool incremental;
 
 	conf = load_config(DEFAULT_CONFIGFILE);
 	if (!conf)
@@ -3570,19 +4018,7 @@ reconfigure (struct vectors *vecs, enum force_reload_types reload_type)
 	if (verbosity)
 		libmp_verbosity = verbosity;
 	setlogmask(LOG_UPTO(libmp_verbosity + 3));
-	condlog(2, "%s: setting up paths and maps", __func__);
-
-	/*
-	 * free old map and path vectors ... they use old conf state
-	 */
-	if (VECTOR_SIZE(vecs->mpvec))
-		remove_maps_and_stop_waiters(vecs);
-
-	free_pathvec(vecs->pathvec, FREE_PATHS);
-	vecs->pathvec = NULL;
-	delete_all_foreign();
 
-	reset_checker_classes();
 	if (bindings_read_only)
 		conf->bindings_read_only = bindings_read_only;
 
@@ -3594,9 +4030,36 @@ reconfigure (struct vectors *vecs, enum force_reload_types reload_type)
 	old = rcu_dereference(multipath_conf);
 	reconfigure_check(old, conf);
 
+	/* The old snapshot must be taken while old is still current */
+	incremental = reload_type != FORCE_RELOAD_YES &&
+		VECTOR_SIZE(vecs->pathvec) > 0 &&
+		snapshot_config(old, &old_snap) == 0;
+
 	conf->sequence_nr = old->sequence_nr + 1;
 	rcu_assign_pointer(multipath_conf, conf);
+
+	if (incremental &&
+	    reconfigure_incremental(vecs, old, conf, &old_snap) != 0)
+		incremental = false;
+	free_config_snapshot(&old_snap);
+
+	if (!incremental) {
+		condlog(2, "%s: setting up paths and maps", __func__);
+		/*
+		 * free old map and path vectors ... they use old conf state
+		 */
+		if (VECTOR_SIZE(vecs->mpvec))
+			remove_maps_and_stop_waiters(vecs);
+
+		free_pathvec(vecs->pathvec, FREE_PATHS);
+		vecs->pathvec = NULL;
+		delete_all_foreign();
+
+		reset_checker_classes();
+	}
 	call_rcu(&old->rcu, rcu_free_config);
+	if (incremental)
+		return 0;
 #ifdef FPIN_EVENT_HANDLER
 	fpin_clean_marginal_dev_list(NULL);
 #endif
@@ -3658,8 +4121,13 @@ handle_signals(bool nonfatal)
 		if (logsink == LOGSINK_SYSLOG)
 			log_thread_reset();
 	}
+	if (history_dump_sig) {
+		condlog(3, "dump history (signal)");
+		dump_history(DEFAULT_HISTORY_FILE);
+	}
 	reconfig_sig = 0;
 	log_reset_sig = 0;
+	history_dump_sig = 0;
 }
 
 static void
@@ -3683,7 +4151,13 @@ sigusr1(__attribute__((unused)) int sig)
 static void
 sigusr2(__attribute__((unused)) int sig)
 {
-	condlog(3, "SIGUSR2 received");
+	history_dump_sig = 1;
+}
+
+/* Only interrupts blocking calls, see stop_waiter_thread() */
+static void
+sigwakeup(__attribute__((unused)) int sig)
+{
 }
 
 static void
@@ -3701,6 +4175,7 @@ signal_init(void)
 	signal_set(SIGHUP, sighup);
 	signal_set(SIGUSR1, sigusr1);
 	signal_set(SIGUSR2, sigusr2);
+	signal_set(WAITER_WAKEUP_SIG, sigwakeup);
 	signal_set(SIGINT, sigend);
 	signal_set(SIGTERM, sigend);
 	signal_set(SIGPIPE, sigend);
@@ -3820,6 +4295,8 @@ static void cleanup_threads(void)
 		pthread_cancel(check_thr);
 	if (purge_thr_started)
 		pthread_cancel(purge_thr);
+	if (dmq_thr_started)
+		pthread_cancel(dmq_thr);
 	if (uevent_thr_started)
 		pthread_cancel(uevent_thr);
 	if (uxlsnr_thr_started)
@@ -3838,6 +4315,8 @@ static void cleanup_threads(void)
 		pthread_join(check_thr, NULL);
 	if (purge_thr_started)
 		pthread_join(purge_thr, NULL);
+	if (dmq_thr_started)
+		pthread_join(dmq_thr, NULL);
 	if (uevent_thr_started)
 		pthread_join(uevent_thr, NULL);
 	if (uxlsnr_thr_started)
@@ -3925,6 +4404,7 @@ static void cleanup_child(void)
 		log_thread_stop();
 
 	cleanup_conf();
+	reset_metrics();
 }
 
 static int sd_notify_exit(int err)
@@ -4000,6 +4480,7 @@ child (__attribute__((unused)) void *param)
 		conf->bindings_read_only = bindings_read_only;
 	uxsock_timeout = conf->uxsock_timeout;
 	rcu_assign_pointer(multipath_conf, conf);
+	history_enable();
 	if (init_checkers()) {
 		condlog(0, "failed to initialize checkers");
 		goto failed;
@@ -4098,6 +4579,11 @@ child (__attribute__((unused)) void *param)
 		goto failed;
 	} else
 		purge_thr_started = true;
+	if ((rc = pthread_create(&dmq_thr, &misc_attr, dmqueueloop, NULL))) {
+		condlog(0, "failed to create dm queue thread: %d", rc);
+		goto failed;
+	} else
+		dmq_thr_started = true;
 	if ((rc = pthread_create(&uevq_thr, &misc_attr, uevqloop, vecs))) {
 		condlog(0, "failed to create uevent dispatcher: %d", rc);
 		goto failed;
@@ -4149,7 +4635,7 @@ child (__attribute__((unused)) void *param)
 
 		/* handle DAEMON_CONFIGURE */
 		pthread_cleanup_push(cleanup_lock, &vecs->lock);
-		lock(&vecs->lock);
+		lock(&vecs->lock, __func__);
 		pthread_testcancel();
 		if (!need_to_delay_reconfig(vecs)) {
 			enum force_reload_types reload_type;
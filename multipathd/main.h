@@ -3,6 +3,8 @@
 
 #define MAPGCINT 5
 
+struct strbuf;
+
 enum daemon_status {
 	DAEMON_INIT = 0,
 	DAEMON_START,
@@ -40,6 +42,7 @@ int ev_add_path (struct path *, struct vectors *, int);
 int ev_remove_path (struct path *, struct vectors *, int);
 int ev_add_map (char *, const char *, struct vectors *);
 int flush_map(struct multipath *, struct vectors *);
+int finish_flush_map(struct multipath *, struct vectors *, int);
 
 void handle_signals(bool);
 int refresh_multipath(struct vectors * vecs, struct multipath * mpp);
@@ -57,4 +60,5 @@ void unset_pr(struct multipath *mpp);
 void pr_register_active_paths(struct multipath *mpp,
 			      const struct vector_s *registered_paths);
 void cleanup_reset_vec(struct vector_s **v);
+int print_tick_timing(struct strbuf *buf);
 #endif /* MAIN_H_INCLUDED */
@@ -10,36 +10,64 @@
 #include <errno.h>
 
 #include "mpath_cmd.h"
-#include "uxsock.h"
 #include "uxclnt.h"
 
+/*
+ * ret is -1 before the first piece of the reply, which tells us
+ * whether the command failed.
+ */
+static int print_reply(const char *data, size_t len, void *arg)
+{
+	int *ret = arg;
+
+	if (*ret == -1) {
+		*ret = (strncmp(data, "fail\n", 5) == 0);
+		/* If there is additional failure information, skip the
+		 * initial 'fail' */
+		if (*ret && len > 5) {
+			data += 5;
+			len -= 5;
+		}
+	}
+	fwrite(data, 1, len, stdout);
+	return 0;
+}
+
 static int process_req(int fd, char * inbuf, unsigned int timeout)
 {
-	char *reply;
-	int ret;
+	int ret = -1;
 
-	if (send_packet(fd, inbuf) != 0) {
+	if (mpath_send_cmd_chunked(fd, inbuf) != 0) {
 		printf("cannot send packet\n");
 		return 1;
 	}
-	ret = recv_packet(fd, &reply, timeout);
-	if (ret < 0) {
-		if (ret == -ETIMEDOUT)
+	/* large replies are printed as they arrive */
+	if (mpath_recv_reply_chunked(fd, print_reply, &ret, timeout) != 0) {
+		if (errno == ETIMEDOUT)
 			printf("timeout receiving packet\n");
 		else
-			printf("error %d receiving packet\n", ret);
+			printf("error %d receiving packet\n", -errno);
 		return 1;
-	} else {
-		ret = (strncmp(reply, "fail\n", 5) == 0);
-		/* If there is additional failure information, skip the
-		 * initial 'fail' */
-		if (ret && strlen(reply) > 5)
-			printf("%s", reply + 5);
-		else
-			printf("%s", reply);
-		free(reply);
-		return ret;
 	}
+	return ret == 1;
+}
+
+/*
+ * After "subscribe events", multipathd sends one reply per event,
+ * until we disconnect.
+ */
+static int print_events(int fd)
+{
+	char *event;
+
+	/* no timeout, events may be rare. (unsigned int)-1 means -1 for poll() */
+	while (mpath_recv_reply(fd, &event, (unsigned int)-1) == 0 && event) {
+		printf("%s\n", event);
+		fflush(stdout);
+		free(event);
+	}
+	printf("error %d receiving event\n", -errno);
+	return 1;
 }
 
 /*
@@ -58,6 +86,8 @@ int uxclnt(char * inbuf, unsigned int timeout)
 	}
 
 	ret = process_req(fd, inbuf, timeout);
+	if (ret == 0 && !strncmp(inbuf, "subscribe", 9))
+		ret = print_events(fd);
 
 	mpath_disconnect(fd);
 	return ret;
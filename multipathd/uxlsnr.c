@@ -25,6 +25,7 @@
 #include <stdbool.h>
 #include <sys/inotify.h>
 #include <sys/eventfd.h>
+#include <sys/epoll.h>
 #include "checkers.h"
 #include "debug.h"
 #include "vector.h"
@@ -42,21 +43,29 @@
 #include "uxlsnr.h"
 #include "strbuf.h"
 #include "alias.h"
+#include "trace.h"
 
 /* state of client connection */
 enum {
 	CLT_RECV,
 	CLT_PARSE,
-	CLT_LOCKED_WORK,
 	CLT_WORK,
 	CLT_SEND,
+	CLT_SUBSCRIBED,
 };
 
+/*
+ * Clients in CLT_WORK state are owned by the worker threads, and
+ * aren't watched by the listener. All other states are handled by
+ * the listener thread only.
+ */
 struct client {
 	struct list_head node;
+	struct list_head work_node;
 	struct timespec expires;
 	int state;
 	int fd;
+	uint32_t events;
 	vector cmdvec;
 	/* NUL byte at end */
 	char cmd[MAX_CMD_LEN + 1];
@@ -65,35 +74,79 @@ struct client {
 	size_t cmd_len, len;
 	int error;
 	bool is_root;
+	/* in dead_clients, to be freed by reap_dead_clients() */
+	bool dead;
+	/* client accepts chunked replies */
+	bool chunked;
+	/* reply is being sent in chunks */
+	bool streaming;
+	bool announced;
+	struct cli_stream stream;
+	/* event subscribers only, see publish_event() */
+	struct list_head sub_node;
+	/* protected by sub_lock */
+	struct list_head event_queue;
+	unsigned int n_events;
+	unsigned long dropped;
+};
+
+struct event_record {
+	struct list_head node;
+	char msg[];
 };
 
-/* Indices for array of poll fds */
+/*
+ * epoll data for the listener's own fds. Client fds use a pointer
+ * to struct client instead, which can't take any of these values.
+ */
 enum {
 	POLLFD_UX1 = 0,
 	POLLFD_UX2,
 	POLLFD_NOTIFY,
-	POLLFD_IDLE,
+	POLLFD_DONE,
 	POLLFDS_BASE,
 };
 
-#define POLLFD_CHUNK (4096 / sizeof(struct pollfd))
-/* Minimum number of pollfds to reserve for clients */
-#define MIN_POLLS (POLLFD_CHUNK - POLLFDS_BASE)
 /*
  * Max number of client connections allowed
  * During coldplug, there may be a large number of "multipath -u"
  * processes connecting.
  */
 #define MAX_CLIENTS (16384 - POLLFDS_BASE)
+#define MAX_EVENTS 64
 
-/* Compile-time error if POLLFD_CHUNK is too small */
-static __attribute__((unused)) char ___a[-(MIN_POLLS <= 0)];
+/*
+ * Command handlers are executed by a small pool of worker threads,
+ * so that a slow command doesn't hold up I/O with other clients.
+ * Handlers that need vecs->lock are still serialized by it.
+ */
+#define UXSOCK_WORKERS 4
+/* Interval for checking cancellation while waiting for vecs->lock */
+#define LOCK_WAIT_SLICE_MS 100
 
 static LIST_HEAD(clients);
-static struct pollfd *polls;
+static LIST_HEAD(dead_clients);
+static int num_clients;
 static int notify_fd = -1;
-static int idle_fd = -1;
-static bool clients_need_lock = false;
+static int done_fd = -1;
+static int epoll_fd = -1;
+
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+/* Both lists are protected by work_lock */
+static LIST_HEAD(work_queue);
+static LIST_HEAD(work_done);
+static pthread_t workers[UXSOCK_WORKERS];
+static int n_workers;
+static int lock_waiters; /* uatomic access only */
+
+/* Max number of events queued per subscriber */
+#define MAX_QUEUED_EVENTS 256
+#define MAX_EVENT_LEN 512
+static pthread_mutex_t sub_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Only the listener adds or removes subscribers, with sub_lock held */
+static LIST_HEAD(subscribers);
+static int n_subscribers; /* uatomic access only */
 
 static bool _socket_client_is_root(int fd)
 {
@@ -110,6 +163,70 @@ static bool _socket_client_is_root(int fd)
 	return false;
 }
 
+static bool has_events(struct client *c)
+{
+	bool ret;
+
+	pthread_mutex_lock(&sub_lock);
+	ret = !list_empty(&c->event_queue) || c->dropped > 0;
+	pthread_mutex_unlock(&sub_lock);
+	return ret;
+}
+
+static void watch_fd(int fd, uint32_t events, uint64_t data)
+{
+	struct epoll_event ev = { .events = events, .data.u64 = data, };
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+		condlog(1, "%s: failed to watch fd %d: %m", __func__, fd);
+}
+
+/*
+ * Make sure the client's fd is watched for the events its state
+ * requires. Clients that are being worked on aren't watched at all,
+ * not even for errors, because the listener mustn't touch them.
+ */
+static void update_client_events(struct client *c)
+{
+	struct epoll_event ev = { .data.ptr = c, };
+	int op;
+
+	switch (c->state) {
+	case CLT_RECV:
+		ev.events = EPOLLIN;
+		break;
+	case CLT_SEND:
+		ev.events = EPOLLOUT;
+		break;
+	case CLT_SUBSCRIBED:
+		/* EPOLLIN only to notice the client going away */
+		ev.events = EPOLLIN;
+		if (c->cmd_len > 0 || has_events(c))
+			ev.events |= EPOLLOUT;
+		break;
+	default:
+		ev.events = 0;
+		break;
+	}
+	if (ev.events == c->events)
+		return;
+
+	if (ev.events == 0)
+		op = EPOLL_CTL_DEL;
+	else if (c->events == 0)
+		op = EPOLL_CTL_ADD;
+	else
+		op = EPOLL_CTL_MOD;
+
+	if (epoll_ctl(epoll_fd, op, c->fd, &ev) == -1) {
+		condlog(1, "%s: cli[%d]: epoll_ctl failed: %m",
+			__func__, c->fd);
+		c->error = -ECONNRESET;
+		return;
+	}
+	c->events = ev.events;
+}
+
 /*
  * handle a new client joining
  */
@@ -131,34 +248,104 @@ static void new_client(int ux_sock)
 		return;
 	}
 	INIT_LIST_HEAD(&c->node);
+	INIT_LIST_HEAD(&c->work_node);
+	INIT_LIST_HEAD(&c->sub_node);
+	INIT_LIST_HEAD(&c->event_queue);
 	c->fd = fd;
 	c->state = CLT_RECV;
 	c->is_root = _socket_client_is_root(c->fd);
 
+	update_client_events(c);
+	if (c->error) {
+		close(fd);
+		free(c);
+		return;
+	}
 	/* put it in our linked list */
 	list_add_tail(&c->node, &clients);
+	num_clients++;
 }
 
 /*
  * kill off a dead client
  */
-static void dead_client(struct client *c)
+static void free_events(struct list_head *events)
+{
+	struct event_record *ev;
+
+	while ((ev = list_pop_entry(events, struct event_record, node)))
+		free(ev);
+}
+
+static void add_subscriber(struct client *c)
+{
+	pthread_mutex_lock(&sub_lock);
+	list_add_tail(&c->sub_node, &subscribers);
+	pthread_mutex_unlock(&sub_lock);
+	uatomic_inc(&n_subscribers);
+	condlog(3, "cli[%d]: subscribed to events", c->fd);
+}
+
+static void remove_subscriber(struct client *c)
+{
+	LIST_HEAD(events);
+
+	pthread_mutex_lock(&sub_lock);
+	list_del_init(&c->sub_node);
+	list_splice_init(&c->event_queue, &events);
+	c->n_events = 0;
+	pthread_mutex_unlock(&sub_lock);
+	uatomic_dec(&n_subscribers);
+	free_events(&events);
+}
+
+static void free_client(struct client *c)
 {
 	int fd = c->fd;
+
+	if (c->state == CLT_SUBSCRIBED)
+		remove_subscriber(c);
 	list_del_init(&c->node);
+	num_clients--;
 	c->fd = -1;
 	reset_strbuf(&c->reply);
 	if (c->cmdvec)
 		free_keys(c->cmdvec);
+	cli_stream_reset(&c->stream);
 	free(c);
 	close(fd);
 }
 
-static void free_polls (void)
+/*
+ * Later events of an epoll batch may still point to a client that has
+ * died while handling the batch. Move it to dead_clients, it is freed
+ * in reap_dead_clients() after the batch.
+ */
+static void dead_client(struct client *c)
+{
+	if (c->dead)
+		return;
+	c->dead = true;
+	list_move_tail(&c->node, &dead_clients);
+}
+
+static void reap_dead_clients(void)
+{
+	struct client *c, *tmp;
+
+	list_for_each_entry_safe(c, tmp, &dead_clients, node)
+		free_client(c);
+}
+
+static void stop_workers(void)
 {
-	if (polls)
-		free(polls);
-	polls = NULL;
+	int i;
+
+	for (i = 0; i < n_workers; i++)
+		pthread_cancel(workers[i]);
+	for (i = 0; i < n_workers; i++)
+		pthread_join(workers[i], NULL);
+	n_workers = 0;
 }
 
 void uxsock_cleanup(void *arg)
@@ -167,27 +354,29 @@ void uxsock_cleanup(void *arg)
 	struct client *client_tmp;
 	long *ux_sock = (long *)arg;
 
+	/* Workers may still reference clients and handlers */
+	stop_workers();
+
 	close(ux_sock[0]);
 	close(ux_sock[1]);
 	close(notify_fd);
 
+	/* Clients in the work lists are also in the clients list */
+	INIT_LIST_HEAD(&work_queue);
+	INIT_LIST_HEAD(&work_done);
 	list_for_each_entry_safe(client_loop, client_tmp, &clients, node) {
-		dead_client(client_loop);
+		free_client(client_loop);
 	}
+	reap_dead_clients();
 
-	cli_exit();
-	free_polls();
-}
-
-void wakeup_cleanup(void *arg)
-{
-	struct mutex_lock *lck = arg;
-	int fd = idle_fd;
+	if (done_fd != -1)
+		close(done_fd);
+	done_fd = -1;
+	if (epoll_fd != -1)
+		close(epoll_fd);
+	epoll_fd = -1;
 
-	idle_fd = -1;
-	set_wakeup_fn(lck, NULL);
-	if (fd != -1)
-		close(fd);
+	cli_exit();
 }
 
 struct watch_descriptors {
@@ -303,14 +492,17 @@ static void handle_inotify(int fd, struct watch_descriptors *wds)
 static const struct timespec ts_zero = { .tv_sec = 0, };
 static const struct timespec ts_max = { .tv_sec = LONG_MAX, .tv_nsec = 999999999 };
 
-static struct timespec *get_soonest_timeout(struct timespec *ts)
+/* Returns the epoll timeout in ms until the next client expires */
+static int get_soonest_timeout(void)
 {
-	struct timespec ts_min = ts_max, now;
+	struct timespec ts_min = ts_max, now, ts;
 	bool any = false;
 	struct client *c;
+	long long ms;
 
 	list_for_each_entry(c, &clients, node) {
-		if (timespeccmp(&c->expires, &ts_zero) != 0 &&
+		if (c->state != CLT_WORK &&
+		    timespeccmp(&c->expires, &ts_zero) != 0 &&
 		    timespeccmp(&c->expires, &ts_min) < 0) {
 			ts_min = c->expires;
 			any = true;
@@ -318,72 +510,64 @@ static struct timespec *get_soonest_timeout(struct timespec *ts)
 	}
 
 	if (!any)
-		return NULL;
+		return -1;
 
 	get_monotonic_time(&now);
-	timespecsub(&ts_min, &now, ts);
-	if (timespeccmp(ts, &ts_zero) < 0)
-		*ts = ts_zero;
+	timespecsub(&ts_min, &now, &ts);
+	if (timespeccmp(&ts, &ts_zero) < 0)
+		ts = ts_zero;
 
 	condlog(4, "%s: next client expires in %ld.%03lds", __func__,
-		(long)ts->tv_sec, ts->tv_nsec / 1000000);
-	return ts;
+		(long)ts.tv_sec, ts.tv_nsec / 1000000);
+	/* round up, lest we wake up too early */
+	ms = ts.tv_sec * 1000LL + (ts.tv_nsec + 999999) / 1000000;
+	return ms > INT_MAX ? INT_MAX : (int)ms;
 }
 
 bool waiting_clients(void)
 {
-	return clients_need_lock;
-}
-
-static void check_for_locked_work(struct client *skip)
-{
-	struct client *c;
-
-	list_for_each_entry(c, &clients, node) {
-		if (c != skip && c->state == CLT_LOCKED_WORK) {
-			clients_need_lock = true;
-			return;
-		}
-	}
-	clients_need_lock = false;
+	return uatomic_read(&lock_waiters) > 0;
 }
 
 static int parse_cmd(struct client *c)
 {
-	int r;
-
-	r = get_cmdvec(c->cmd, &c->cmdvec, false);
-
-	if (r)
-		return -r;
-
-	c->handler = find_handler_for_cmdvec(c->cmdvec);
-
-	if (!c->handler || !c->handler->fn)
-		return -EINVAL;
-
-	return r;
+	return parse_cli_cmd(c->cmd, &c->cmdvec, &c->handler);
 }
 
 static int execute_handler(struct client *c, struct vectors *vecs)
 {
+	struct handler *h = c->handler;
+	int rc;
 
-	if (!c->handler || !c->handler->fn)
+	if (!h || (!h->fn && !h->stream_fn))
 		return -EINVAL;
 
-	return c->handler->fn(c->cmdvec, &c->reply, vecs);
+	if (h->fn)
+		return h->fn(c->cmdvec, &c->reply, vecs);
+
+	/*
+	 * Clients accepting chunked replies get one chunk per call,
+	 * with vecs->lock dropped in between. Others get all at once.
+	 * If everything fits in the first chunk, it's sent in one piece.
+	 */
+	do {
+		rc = h->stream_fn(c->cmdvec, &c->reply, vecs, &c->stream);
+	} while (rc == 0 && !c->stream.done && !c->chunked);
+	if (rc == 0 && !c->stream.done)
+		c->streaming = true;
+	return rc;
 }
 
 static void wakeup_listener(void)
 {
 	uint64_t one = 1;
 
-	if (idle_fd != -1 &&
-	    write(idle_fd, &one, sizeof(one)) != sizeof(one))
+	if (done_fd != -1 &&
+	    write(done_fd, &one, sizeof(one)) != sizeof(one))
 		condlog(1, "%s: failed", __func__);
 }
 
-static void drain_idle_fd(int fd)
+static void drain_done_fd(int fd)
 {
 	uint64_t val;
 	int rc;
@@ -392,6 +576,264 @@ static void drain_idle_fd(int fd)
 	condlog(4, "%s: %d, %"PRIu64, __func__, rc, val);
 }
 
+static void dec_lock_waiters(void *arg __attribute__((unused)))
+{
+	uatomic_dec(&lock_waiters);
+}
+
+/*
+ * Wait for vecs->lock until the client's command times out.
+ * Wait in slices, so that the worker can be cancelled in between.
+ */
+static int lock_for_client(struct client *c, struct vectors *vecs)
+{
+	struct timespec start, now, tmo;
+	bool waited = false;
+	int rc;
+
+	uatomic_inc(&lock_waiters);
+	pthread_cleanup_push(dec_lock_waiters, NULL);
+	rc = trylock(&vecs->lock);
+	if (rc != 0) {
+		waited = true;
+		get_monotonic_time(&start);
+		do {
+			pthread_testcancel();
+			get_monotonic_time(&now);
+			if (timespeccmp(&c->expires, &now) <= 0) {
+				rc = ETIMEDOUT;
+				break;
+			}
+			clock_gettime(CLOCK_REALTIME, &tmo);
+			tmo.tv_nsec += LOCK_WAIT_SLICE_MS * 1000000;
+			normalize_timespec(&tmo);
+			rc = timedlock(&vecs->lock, &tmo);
+		} while (rc == ETIMEDOUT);
+	}
+	pthread_cleanup_pop(1);
+	if (rc == 0)
+		lock_acquired(&vecs->lock, "cli", waited ? &start : NULL);
+	return rc;
+}
+
+static void do_client_work(struct client *c, struct vectors *vecs)
+{
+	TRACE_PROBE(cli_start, c->fd, c->cmd);
+	if (!c->handler->locked)
+		c->error = execute_handler(c, vecs);
+	else if (lock_for_client(c, vecs) != 0) {
+		condlog(2, "%s: cli[%d]: timed out waiting for lock",
+			__func__, c->fd);
+		c->error = -ETIMEDOUT;
+	} else {
+		condlog(4, "%s: cli[%d] grabbed lock", __func__, c->fd);
+		pthread_cleanup_push_cast(unlock__, &vecs->lock);
+		c->error = execute_handler(c, vecs);
+		pthread_cleanup_pop(1);
+	}
+
+	/*
+	 * Part of the reply has been sent already. We can't send
+	 * an error message any more, just drop the connection.
+	 */
+	if (c->streaming && c->error) {
+		condlog(2, "%s: cli[%d]: error %d in chunked reply",
+			__func__, c->fd, c->error);
+		c->error = -ECONNRESET;
+	}
+	TRACE_PROBE(cli_done, c->fd, c->error);
+}
+
+static void worker_cleanup(void *arg __attribute__((unused)))
+{
+	rcu_unregister_thread();
+}
+
+static void *uxsock_worker(void *arg)
+{
+	struct vectors *vecs = arg;
+	struct client *c;
+
+	rcu_register_thread();
+	pthread_cleanup_push(worker_cleanup, NULL);
+	for (;;) {
+		pthread_mutex_lock(&work_lock);
+		pthread_cleanup_push(cleanup_mutex, &work_lock);
+		while (list_empty(&work_queue))
+			pthread_cond_wait(&work_cond, &work_lock);
+		c = list_pop_entry(&work_queue, struct client, work_node);
+		pthread_cleanup_pop(1);
+
+		do_client_work(c, vecs);
+
+		pthread_mutex_lock(&work_lock);
+		list_add_tail(&c->work_node, &work_done);
+		pthread_mutex_unlock(&work_lock);
+		wakeup_listener();
+	}
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+static void start_workers(struct vectors *vecs)
+{
+	pthread_attr_t attr;
+	int i, rc;
+
+	setup_thread_attr(&attr, 64 * 1024, 0);
+	for (i = 0; i < UXSOCK_WORKERS; i++) {
+		rc = pthread_create(&workers[n_workers], &attr,
+				    uxsock_worker, vecs);
+		if (rc) {
+			condlog(1, "%s: failed to start worker: %s",
+				__func__, strerror(rc));
+			break;
+		}
+		n_workers++;
+	}
+	pthread_attr_destroy(&attr);
+}
+
+static void queue_client_work(struct client *c)
+{
+	pthread_mutex_lock(&work_lock);
+	list_add_tail(&c->work_node, &work_queue);
+	pthread_cond_signal(&work_cond);
+	pthread_mutex_unlock(&work_lock);
+}
+
+static struct event_record *alloc_event(const char *fmt, va_list ap)
+{
+	struct event_record *ev;
+	struct timespec now;
+	int n;
+
+	ev = malloc(sizeof(*ev) + MAX_EVENT_LEN);
+	if (!ev)
+		return NULL;
+	clock_gettime(CLOCK_REALTIME, &now);
+	n = snprintf(ev->msg, MAX_EVENT_LEN, "%lld.%06ld ",
+		     (long long)now.tv_sec, now.tv_nsec / 1000);
+	vsnprintf(ev->msg + n, MAX_EVENT_LEN - n, fmt, ap);
+	return ev;
+}
+
+static struct event_record *make_event(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static struct event_record *make_event(const char *fmt, ...)
+{
+	struct event_record *ev;
+	va_list ap;
+
+	va_start(ap, fmt);
+	ev = alloc_event(fmt, ap);
+	va_end(ap);
+	return ev;
+}
+
+/* Called with sub_lock held */
+static void queue_event(struct client *c, const struct event_record *ev)
+{
+	struct event_record *copy;
+	size_t len = strlen(ev->msg) + 1;
+	/* room for the event, and for the drop report before it */
+	unsigned int needed = c->dropped > 0 ? 2 : 1;
+
+	if (c->n_events + needed > MAX_QUEUED_EVENTS ||
+	    !(copy = malloc(sizeof(*copy) + len))) {
+		c->dropped++;
+		return;
+	}
+	/* Report earlier drops in order */
+	if (c->dropped > 0) {
+		struct event_record *drop;
+
+		drop = make_event("events_dropped count=%lu", c->dropped);
+		if (drop) {
+			list_add_tail(&drop->node, &c->event_queue);
+			c->n_events++;
+			c->dropped = 0;
+		}
+	}
+	memcpy(copy->msg, ev->msg, len);
+	list_add_tail(&copy->node, &c->event_queue);
+	c->n_events++;
+}
+
+/*
+ * Report an event to all clients that have sent "subscribe events".
+ * Events are queued per subscriber, and sent by the listener thread.
+ * If a subscriber's queue is full, events are dropped and counted.
+ */
+void publish_event(const char *fmt, ...)
+{
+	struct event_record *ev;
+	struct client *c;
+	va_list ap;
+
+	if (uatomic_read(&n_subscribers) == 0)
+		return;
+
+	va_start(ap, fmt);
+	ev = alloc_event(fmt, ap);
+	va_end(ap);
+	if (!ev)
+		return;
+
+	condlog(4, "%s: %s", __func__, ev->msg);
+	pthread_mutex_lock(&sub_lock);
+	list_for_each_entry(c, &subscribers, sub_node)
+		queue_event(c, ev);
+	pthread_mutex_unlock(&sub_lock);
+	free(ev);
+	wakeup_listener();
+}
+
+/* Move the next queued event to the client's reply buffer */
+static bool get_next_event(struct client *c)
+{
+	struct event_record *ev;
+	unsigned long dropped = 0;
+
+	pthread_mutex_lock(&sub_lock);
+	ev = list_pop_entry(&c->event_queue, struct event_record, node);
+	if (ev)
+		c->n_events--;
+	else if (c->dropped > 0) {
+		dropped = c->dropped;
+		c->dropped = 0;
+	}
+	pthread_mutex_unlock(&sub_lock);
+
+	if (ev) {
+		append_strbuf_str(&c->reply, ev->msg);
+		free(ev);
+	} else if (dropped > 0) {
+		ev = make_event("events_dropped count=%lu", dropped);
+		if (!ev)
+			return false;
+		append_strbuf_str(&c->reply, ev->msg);
+		free(ev);
+	}
+	return get_strbuf_len(&c->reply) > 0;
+}
+
+/* Make sure subscribers with new events are watched for EPOLLOUT */
+static void arm_subscribers(void)
+{
+	struct client *c, *tmp;
+
+	/* No lock needed, the list is only modified by this thread */
+	list_for_each_entry_safe(c, tmp, &subscribers, sub_node) {
+		if (c->dead)
+			continue;
+		update_client_events(c);
+		if (c->error == -ECONNRESET)
+			dead_client(c);
+	}
+}
+
 void default_reply(struct client *c, int r)
 {
 	if (r == 0) {
@@ -429,14 +871,16 @@ static void set_client_state(struct client *c, int state)
 		reset_strbuf(&c->reply);
 		memset(c->cmd, '\0', sizeof(c->cmd));
 		c->error = 0;
+		c->chunked = c->streaming = c->announced = false;
+		cli_stream_reset(&c->stream);
 		/* fallthrough */
 	case CLT_SEND:
 		/* no timeout while waiting for the client or sending a reply */
 		c->expires = ts_zero;
 		/* reuse these fields for next data transfer */
 		c->len = c->cmd_len = 0;
-		/* cmdvec isn't needed any more */
-		if (c->cmdvec) {
+		/* cmdvec isn't needed any more, unless there are more chunks */
+		if (c->cmdvec && !c->streaming) {
 			free_keys(c->cmdvec);
 			c->cmdvec = NULL;
 		}
@@ -452,28 +896,135 @@ enum {
 	STM_BREAK,
 };
 
-static int client_state_machine(struct client *c, struct vectors *vecs,
-				short revents)
+static void set_client_timeout(struct client *c)
+{
+	get_monotonic_time(&c->expires);
+	c->expires.tv_sec += uxsock_timeout / 1000;
+	c->expires.tv_nsec += (uxsock_timeout % 1000) * 1000000;
+	normalize_timespec(&c->expires);
+}
+
+/* Hand the client over to the workers, to execute its command */
+static void start_client_work(struct client *c)
+{
+	set_client_state(c, CLT_WORK);
+	update_client_events(c);
+	if (!c->error)
+		queue_client_work(c);
+}
+
+/* Returns true if the reply buffer has been sent completely */
+static bool send_reply_data(struct client *c)
+{
+	const char *buf = get_strbuf_str(&c->reply);
+	ssize_t n;
+
+	if (c->len < c->cmd_len) {
+		n = send(c->fd, buf + c->len, c->cmd_len - c->len, MSG_NOSIGNAL);
+		if (n == -1) {
+			if (!(errno == EAGAIN || errno == EINTR))
+				c->error = -ECONNRESET;
+		} else
+			c->len += n;
+	}
+	return c->len >= c->cmd_len;
+}
+
+static int send_reply_len(struct client *c, size_t len)
+{
+	if (send(c->fd, &len, sizeof(len), MSG_NOSIGNAL) != sizeof(len)) {
+		c->error = -ECONNRESET;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Send a reply that's produced in pieces, see mpath_cmd.h. After every
+ * chunk, the client is handed back to the workers to produce the next
+ * one. Thus the reply never needs more memory than about one chunk,
+ * and a slow client delays only itself.
+ */
+static int send_chunk(struct client *c)
+{
+	if (c->cmd_len == 0) {
+		size_t len = get_strbuf_len(&c->reply);
+
+		if (!c->announced) {
+			if (send_reply_len(c, MPATH_REPLY_CHUNKED) != 0)
+				return STM_BREAK;
+			c->announced = true;
+		}
+		/* a chunk of length 0 would terminate the reply */
+		if (len > 0) {
+			if (send_reply_len(c, len) == 0)
+				c->cmd_len = len;
+			return STM_BREAK;
+		}
+	} else {
+		if (!send_reply_data(c))
+			return STM_BREAK;
+		condlog(4, "cli[%d]: Reply chunk [%zu bytes]", c->fd, c->cmd_len);
+	}
+
+	if (c->stream.done) {
+		if (send_reply_len(c, 0) == 0)
+			set_client_state(c, CLT_RECV);
+		return STM_BREAK;
+	}
+
+	reset_strbuf(&c->reply);
+	c->len = c->cmd_len = 0;
+	set_client_timeout(c);
+	start_client_work(c);
+	return STM_BREAK;
+}
+
+/* Events are sent to subscribers like replies, one event per reply */
+static int send_event(struct client *c)
+{
+	if (c->cmd_len == 0) {
+		size_t len;
+
+		if (!get_next_event(c))
+			return STM_BREAK;
+		len = get_strbuf_len(&c->reply) + 1;
+		if (send_reply_len(c, len) == 0)
+			c->cmd_len = len;
+		return STM_BREAK;
+	}
+	if (!send_reply_data(c))
+		return STM_BREAK;
+
+	reset_strbuf(&c->reply);
+	c->len = c->cmd_len = 0;
+	return STM_CONT;
+}
+
+static bool is_subscription(const struct client *c)
+{
+	return c->error == 0 && c->handler &&
+		c->handler->fingerprint == (VRB_SUBSCRIBE | Q1_EVENTS);
+}
+
+static int client_state_machine(struct client *c, uint32_t revents)
 {
 	ssize_t n;
 
-	condlog(4, "%s: cli[%d] poll=%x state=%d cmd=\"%s\" repl \"%s\"", __func__,
+	condlog(4, "%s: cli[%d] events=%x state=%d cmd=\"%s\" repl \"%s\"", __func__,
 		c->fd, revents, c->state, c->cmd, get_strbuf_str(&c->reply));
 
 	switch (c->state) {
 	case CLT_RECV:
-		if (!(revents & POLLIN))
+		if (!(revents & EPOLLIN))
 			return STM_BREAK;
 		if (c->cmd_len == 0) {
 			size_t len;
 			/*
-			 * We got POLLIN; assume that at least the length can
+			 * We got EPOLLIN; assume that at least the length can
 			 * be read immediately.
 			 */
-			get_monotonic_time(&c->expires);
-			c->expires.tv_sec += uxsock_timeout / 1000;
-			c->expires.tv_nsec += (uxsock_timeout % 1000) * 1000000;
-			normalize_timespec(&c->expires);
+			set_client_timeout(c);
 			n = recv(c->fd, &len, sizeof(len), 0);
 			if (n < (ssize_t)sizeof(len)) {
 				condlog(1, "%s: cli[%d]: failed to receive reply len: %zd",
@@ -503,6 +1054,10 @@ static int client_state_machine(struct client *c, struct vectors *vecs,
 				return STM_BREAK;
 		}
 		condlog(4, "cli[%d]: Got request [%s]", c->fd, c->cmd);
+		/* see mpath_send_cmd_chunked() */
+		c->chunked = c->cmd_len >= 2 &&
+			strlen(c->cmd) == c->cmd_len - 2 &&
+			c->cmd[c->cmd_len - 1] == MPATH_CMD_CHUNKED;
 		set_client_state(c, CLT_PARSE);
 		return STM_CONT;
 
@@ -518,37 +1073,25 @@ static int client_state_machine(struct client *c, struct vectors *vecs,
 					__func__, c->fd, c->cmd);
 			}
 		}
-		if (c->error)
+		if (c->error) {
 			set_client_state(c, CLT_SEND);
-		else if (c->handler->locked)
-			set_client_state(c, CLT_LOCKED_WORK);
-		else
-			set_client_state(c, CLT_WORK);
-		return STM_CONT;
-
-	case CLT_LOCKED_WORK:
-		if (trylock(&vecs->lock) == 0) {
-			/* don't use cleanup_lock(), lest we wakeup ourselves */
-			pthread_cleanup_push_cast(unlock__, &vecs->lock);
-			c->error = execute_handler(c, vecs);
-			check_for_locked_work(c);
-			pthread_cleanup_pop(1);
-			condlog(4, "%s: cli[%d] grabbed lock", __func__, c->fd);
-			set_client_state(c, CLT_SEND);
-			/* Wait for POLLOUT */
-			return STM_BREAK;
-		} else {
-			condlog(4, "%s: cli[%d] waiting for lock", __func__, c->fd);
-			return STM_BREAK;
+			return STM_CONT;
 		}
+		/*
+		 * We get the client back through collect_done_clients(),
+		 * in CLT_SEND state.
+		 */
+		start_client_work(c);
+		return STM_BREAK;
 
 	case CLT_WORK:
-		c->error = execute_handler(c, vecs);
-		set_client_state(c, CLT_SEND);
-		/* Wait for POLLOUT */
+		/* not reached, the listener doesn't see working clients */
 		return STM_BREAK;
 
 	case CLT_SEND:
+		if (c->streaming)
+			return send_chunk(c);
+
 		if (get_strbuf_len(&c->reply) == 0)
 			default_reply(c, c->error);
 
@@ -562,55 +1105,118 @@ static int client_state_machine(struct client *c, struct vectors *vecs,
 			return STM_BREAK;
 		}
 
-		if (c->len < c->cmd_len) {
-			const char *buf = get_strbuf_str(&c->reply);
-
-			n = send(c->fd, buf + c->len, c->cmd_len - c->len, MSG_NOSIGNAL);
-			if (n == -1) {
-				if (!(errno == EAGAIN || errno == EINTR))
-					c->error = -ECONNRESET;
+		if (send_reply_data(c)) {
+			condlog(4, "cli[%d]: Reply [%zu bytes]", c->fd, c->cmd_len);
+			if (is_subscription(c)) {
+				reset_strbuf(&c->reply);
+				c->len = c->cmd_len = 0;
+				set_client_state(c, CLT_SUBSCRIBED);
+				add_subscriber(c);
 			} else
-				c->len += n;
+				set_client_state(c, CLT_RECV);
 		}
+		return STM_BREAK;
 
-		if (c->len >= c->cmd_len) {
-			condlog(4, "cli[%d]: Reply [%zu bytes]", c->fd, c->cmd_len);
-			set_client_state(c, CLT_RECV);
+	case CLT_SUBSCRIBED:
+		/* Subscribers don't send anything, this means EOF */
+		if (revents & EPOLLIN) {
+			condlog(4, "cli[%d]: unsubscribed", c->fd);
+			c->error = -ECONNRESET;
+			return STM_BREAK;
 		}
-		return STM_BREAK;
+		return send_event(c);
 
 	default:
 		return STM_BREAK;
 	}
 }
 
-static void check_timeout(struct client *c)
+static bool check_timeout(struct client *c, const struct timespec *now)
 {
-	struct timespec now;
-
-	if (timespeccmp(&c->expires, &ts_zero) == 0)
-		return;
-
-	get_monotonic_time(&now);
-	if (timespeccmp(&c->expires, &now) > 0)
-		return;
+	if (c->state == CLT_WORK ||
+	    timespeccmp(&c->expires, &ts_zero) == 0 ||
+	    timespeccmp(&c->expires, now) > 0)
+		return false;
 
 	condlog(2, "%s: cli[%d]: timed out at %ld.%03ld", __func__,
 		c->fd, (long)c->expires.tv_sec, c->expires.tv_nsec / 1000000);
 
 	c->error = -ETIMEDOUT;
 	set_client_state(c, CLT_SEND);
+	return true;
 }
 
-static void handle_client(struct client *c, struct vectors *vecs, short revents)
+static void handle_client(struct client *c, uint32_t revents)
 {
-	if (revents & (POLLHUP|POLLERR)) {
+	struct timespec now;
+
+	if (revents & (EPOLLHUP|EPOLLERR)) {
 		c->error = -ECONNRESET;
 		return;
 	}
 
-	check_timeout(c);
-	while (client_state_machine(c, vecs, revents) == STM_CONT);
+	get_monotonic_time(&now);
+	check_timeout(c, &now);
+	while (client_state_machine(c, revents) == STM_CONT);
+	if (c->error != -ECONNRESET)
+		update_client_events(c);
+}
+
+static void check_client(struct client *c, uint32_t revents)
+{
+	if (c->dead)
+		return;
+	handle_client(c, revents);
+	if (c->error == -ECONNRESET) {
+		condlog(4, "cli[%d]: disconnected", c->fd);
+		dead_client(c);
+	}
+}
+
+/* Take back clients whose commands have been executed */
+static void collect_done_clients(void)
+{
+	LIST_HEAD(done);
+	struct client *c;
+
+	pthread_mutex_lock(&work_lock);
+	list_splice_tail_init(&work_done, &done);
+	pthread_mutex_unlock(&work_lock);
+
+	while ((c = list_pop_entry(&done, struct client, work_node))) {
+		set_client_state(c, CLT_SEND);
+		update_client_events(c);
+		if (c->error == -ECONNRESET)
+			dead_client(c);
+	}
+}
+
+/* Send timeout replies to clients that haven't seen any events */
+static void expire_clients(void)
+{
+	struct client *c, *tmp;
+	struct timespec now;
+
+	get_monotonic_time(&now);
+	list_for_each_entry_safe(c, tmp, &clients, node) {
+		if (check_timeout(c, &now))
+			check_client(c, 0);
+	}
+}
+
+static void watch_ux_socks(long *ux_sock, bool enable)
+{
+	struct epoll_event ev;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (ux_sock[i] == -1)
+			continue;
+		ev.events = enable ? EPOLLIN : 0;
+		ev.data.u64 = POLLFD_UX1 + i;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, ux_sock[i], &ev) == -1)
+			condlog(1, "%s: epoll_ctl failed: %m", __func__);
+	}
 }
 
 /*
@@ -619,12 +1225,14 @@ static void handle_client(struct client *c, struct vectors *vecs, short revents)
 void *uxsock_listen(int n_socks, long *ux_sock_in, void *trigger_data)
 {
 	sigset_t mask;
-	int max_pfds = MIN_POLLS + POLLFDS_BASE;
 	long ux_sock[2] = {-1, -1};
 	/* conf->sequence_nr will be 1 when uxsock_listen is first called */
 	unsigned int sequence_nr = 0;
 	struct watch_descriptors wds = { .conf_wd = -1, .dir_wd = -1, .mp_wd = -1, };
 	struct vectors *vecs = trigger_data;
+	struct epoll_event events[MAX_EVENTS];
+	bool accepting = true;
+	int i;
 
 	if (n_socks < 1 || n_socks > 2) {
 		condlog(0, "uxsock: unsupported number of socket fds");
@@ -635,162 +1243,112 @@ void *uxsock_listen(int n_socks, long *ux_sock_in, void *trigger_data)
 	ux_sock[0] = ux_sock_in[0];
 
 	condlog(3, "uxsock: startup listener");
-	polls = calloc(1, max_pfds * sizeof(*polls));
-	if (!polls) {
-		condlog(0, "uxsock: failed to allocate poll fds");
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		condlog(0, "uxsock: failed to create epoll fd: %m");
 		exit_daemon();
 		return NULL;
 	}
+	done_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (done_fd == -1) {
+		condlog(0, "uxsock: failed to create eventfd: %m");
+		exit_daemon();
+		return NULL;
+	}
+	watch_fd(done_fd, EPOLLIN, POLLFD_DONE);
+	for (i = 0; i < 2; i++)
+		if (ux_sock[i] != -1)
+			watch_fd(ux_sock[i], EPOLLIN, POLLFD_UX1 + i);
+
 	notify_fd = inotify_init1(IN_NONBLOCK);
 	if (notify_fd == -1) /* it's fine if notifications fail */
 		condlog(3, "failed to start up configuration notifications");
+	else
+		watch_fd(notify_fd, EPOLLIN, POLLFD_NOTIFY);
 
-	pthread_cleanup_push(wakeup_cleanup, &vecs->lock);
-	idle_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
-	if (idle_fd == -1) {
-		condlog(1, "failed to create idle fd");
+	start_workers(vecs);
+	if (n_workers == 0) {
+		condlog(0, "uxsock: failed to start workers");
 		exit_daemon();
-	} else
-		set_wakeup_fn(&vecs->lock, wakeup_listener);
+		return NULL;
+	}
 
 	sigfillset(&mask);
 	sigdelset(&mask, SIGINT);
 	sigdelset(&mask, SIGTERM);
 	sigdelset(&mask, SIGHUP);
 	sigdelset(&mask, SIGUSR1);
+	sigdelset(&mask, SIGUSR2);
 	while (1) {
-		struct client *c, *tmp;
-		int i, n_pfds, poll_count, num_clients;
-		struct timespec __timeout, *timeout;
-
-		/* setup for a poll */
-		num_clients = 0;
-		list_for_each_entry(c, &clients, node) {
-			num_clients++;
-		}
-		if (num_clients + POLLFDS_BASE > max_pfds) {
-			struct pollfd *new;
-			int n_new = max_pfds + POLLFD_CHUNK;
-
-			new = realloc(polls, n_new * sizeof(*polls));
-			if (new) {
-				max_pfds = n_new;
-				polls = new;
-			} else {
-				condlog(1, "%s: realloc failure, %d clients not served",
-					__func__,
-					num_clients + POLLFDS_BASE - max_pfds);
-				num_clients = max_pfds - POLLFDS_BASE;
-			}
-		}
-		if (num_clients < MAX_CLIENTS) {
-			polls[POLLFD_UX1].fd = ux_sock[0];
-			polls[POLLFD_UX1].events = POLLIN;
-			polls[POLLFD_UX2].fd = ux_sock[1];
-			polls[POLLFD_UX2].events = POLLIN;
-		} else {
+		int n_events, timeout;
+
+		if (accepting && num_clients >= MAX_CLIENTS) {
 			/*
 			 * New clients can't connect, num_clients won't grow
 			 * to MAX_CLIENTS or higher
 			 */
 			condlog(1, "%s: max client connections reached, pausing polling",
 				__func__);
-			polls[POLLFD_UX1].fd = polls[POLLFD_UX2].fd = -1;
+			watch_ux_socks(ux_sock, false);
+			accepting = false;
+		} else if (!accepting && num_clients < MAX_CLIENTS) {
+			watch_ux_socks(ux_sock, true);
+			accepting = true;
 		}
 
 		reset_watch(notify_fd, &wds, &sequence_nr);
-		polls[POLLFD_NOTIFY].fd = notify_fd;
-		if (notify_fd == -1 || (wds.conf_wd == -1 && wds.dir_wd == -1
-					&& wds.mp_wd == -1))
-			polls[POLLFD_NOTIFY].events = 0;
-		else
-			polls[POLLFD_NOTIFY].events = POLLIN;
-
-		polls[POLLFD_IDLE].fd = idle_fd;
-		check_for_locked_work(NULL);
-		if (clients_need_lock)
-			polls[POLLFD_IDLE].events = POLLIN;
-		else
-			polls[POLLFD_IDLE].events = 0;
-
-		/* setup the clients */
-		i = POLLFDS_BASE;
-		list_for_each_entry(c, &clients, node) {
-			switch(c->state) {
-			case CLT_RECV:
-				polls[i].events = POLLIN;
-				break;
-			case CLT_SEND:
-				polls[i].events = POLLOUT;
-				break;
-			default:
-				/* don't poll for this client */
-				continue;
-			}
-			polls[i].fd = c->fd;
-			i++;
-			if (i >= max_pfds)
-				break;
-		}
-		n_pfds = i;
-		timeout = get_soonest_timeout(&__timeout);
+		timeout = get_soonest_timeout();
 
 		/* most of our life is spent in this call */
-		poll_count = ppoll(polls, n_pfds, timeout, &mask);
+		n_events = epoll_pwait(epoll_fd, events, MAX_EVENTS,
+				       timeout, &mask);
 
 		handle_signals(false);
-		if (poll_count == -1) {
+		if (n_events == -1) {
 			if (errno == EINTR) {
 				handle_signals(true);
 				continue;
 			}
 
 			/* something went badly wrong! */
-			condlog(0, "uxsock: poll failed with %d", errno);
+			condlog(0, "uxsock: epoll_pwait failed with %d", errno);
 			exit_daemon();
 			break;
 		}
 
-		if (polls[POLLFD_IDLE].fd != -1 &&
-		    polls[POLLFD_IDLE].revents & POLLIN)
-			drain_idle_fd(idle_fd);
-
-		/* see if a client needs handling */
-		list_for_each_entry_safe(c, tmp, &clients, node) {
-			short revents = 0;
+		for (i = 0; i < n_events; i++) {
+			uint64_t data = events[i].data.u64;
 
-			for (i = POLLFDS_BASE; i < n_pfds; i++) {
-				if (polls[i].fd == c->fd) {
-					revents = polls[i].revents;
-					break;
-				}
-			}
-
-			handle_client(c, trigger_data, revents);
-
-			if (c->error == -ECONNRESET) {
-				condlog(4, "cli[%d]: disconnected", c->fd);
-				dead_client(c);
-				if (i < n_pfds)
-					polls[i].fd = -1;
+			switch (data) {
+			case POLLFD_UX1:
+			case POLLFD_UX2:
+				/* see if we got a new client */
+				if (events[i].events & EPOLLIN)
+					new_client(ux_sock[data - POLLFD_UX1]);
+				break;
+			case POLLFD_NOTIFY:
+				/* handle inotify events on config files */
+				if (events[i].events & EPOLLIN)
+					handle_inotify(notify_fd, &wds);
+				break;
+			case POLLFD_DONE:
+				drain_done_fd(done_fd);
+				collect_done_clients();
+				arm_subscribers();
+				break;
+			default:
+				/* see if a client needs handling */
+				check_client(events[i].data.ptr,
+					     events[i].events);
+				break;
 			}
 		}
+		expire_clients();
+		reap_dead_clients();
+
 		/* see if we got a non-fatal signal */
 		handle_signals(true);
-
-		/* see if we got a new client */
-		if (polls[POLLFD_UX1].revents & POLLIN) {
-			new_client(ux_sock[0]);
-		}
-		if (polls[POLLFD_UX2].revents & POLLIN) {
-			new_client(ux_sock[1]);
-		}
-
-		/* handle inotify events on config files */
-		if (polls[POLLFD_NOTIFY].revents & POLLIN)
-			handle_inotify(notify_fd, &wds);
 	}
 
-	pthread_cleanup_pop(1);
 	return NULL;
 }
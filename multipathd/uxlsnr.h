@@ -6,5 +6,7 @@
 bool waiting_clients(void);
 void uxsock_cleanup(void *arg);
 void *uxsock_listen(int n_socks, long *ux_sock, void *trigger_data);
+void publish_event(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
 
 #endif
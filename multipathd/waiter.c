@@ -67,7 +67,7 @@ void stop_waiter_thread (struct multipath *mpp)
 	mpp->waiter = (pthread_t)0;
 	pthread_cleanup_push(cleanup_mutex, &waiter_lock);
 	pthread_mutex_lock(&waiter_lock);
-	pthread_kill(thread, SIGUSR2);
+	pthread_kill(thread, WAITER_WAKEUP_SIG);
 	pthread_cancel(thread);
 	pthread_cleanup_pop(1);
 }
@@ -110,7 +110,7 @@ static int waiteventloop (struct event_thread *waiter)
 
 	/* wait */
 	sigemptyset(&set);
-	sigaddset(&set, SIGUSR2);
+	sigaddset(&set, WAITER_WAKEUP_SIG);
 	pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
 
 	pthread_testcancel();
@@ -152,7 +152,7 @@ static int waiteventloop (struct event_thread *waiter)
 		 * 5) a switch group : nothing to do
 		 */
 		pthread_cleanup_push(cleanup_lock, &waiter->vecs->lock);
-		lock(&waiter->vecs->lock);
+		lock(&waiter->vecs->lock, __func__);
 		pthread_testcancel();
 		r = update_multipath(waiter->vecs, waiter->mapname);
 		lock_cleanup_pop(waiter->vecs->lock);
@@ -1,6 +1,14 @@
 #ifndef WAITER_H_INCLUDED
 #define WAITER_H_INCLUDED
 
+#include <signal.h>
+
+/*
+ * Sent to a waiter thread to interrupt DM_DEVICE_WAITEVENT. SIGUSR2 is
+ * reserved for the uxlsnr thread.
+ */
+#define WAITER_WAKEUP_SIG SIGRTMIN
+
 extern pthread_attr_t waiter_attr;
 
 struct event_thread {
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include "cmocka-compat.h"
+
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "discovery.h"
+#include "util.h"
+#include "debug.h"
+#include "test-lib.h"
+
+#include "globals.c"
+
+int __wrap_pathinfo(struct path *pp, struct config *conf, int mask)
+{
+	return PATHINFO_OK;
+}
+
+static int teardown_pathvec(void **state)
+{
+	free_pathvec(*state, FREE_PATHS);
+	return 0;
+}
+
+static int setup_small(void **state)
+{
+	static const char * const wwids[] = {
+		"a", "b", "", "a", "c", "b", "a", "",
+	};
+	vector pathvec = vector_alloc();
+	unsigned int i;
+
+	if (!pathvec)
+		return -1;
+	*state = pathvec;
+	for (i = 0; i < ARRAY_SIZE(wwids); i++)
+		if (!store_test_path(pathvec, i, wwids[i]))
+			return -1;
+	return 0;
+}
+
+/* Slots with @wwid after @prev, as found by wwid_index_next() */
+static void check_slots(const struct wwid_index *idx, vector pathvec,
+			const char *wwid, int prev, const int *slots, int n)
+{
+	int i, k = 0;
+
+	for (i = wwid_index_next(idx, pathvec, wwid, prev); i >= 0;
+	     i = wwid_index_next(idx, pathvec, wwid, i)) {
+		assert_true(k < n);
+		assert_int_equal(i, slots[k]);
+		k++;
+	}
+	assert_int_equal(k, n);
+}
+
+static void test_index_lookup(void **state)
+{
+	static const int a[] = { 0, 3, 6 }, b[] = { 1, 5 }, c[] = { 4 };
+	static const int empty[] = { 2, 7 };
+	vector pathvec = *state;
+	struct wwid_index *idx = alloc_wwid_index(pathvec);
+	int pass;
+
+	assert_non_null(idx);
+	/* pass 0 uses the index, pass 1 scans the vector */
+	for (pass = 0; pass < 2; pass++) {
+		const struct wwid_index *ix = pass ? NULL : idx;
+
+		check_slots(ix, pathvec, "a", -1, a, ARRAY_SIZE(a));
+		check_slots(ix, pathvec, "a", 0, a + 1, ARRAY_SIZE(a) - 1);
+		check_slots(ix, pathvec, "b", -1, b, ARRAY_SIZE(b));
+		check_slots(ix, pathvec, "c", -1, c, ARRAY_SIZE(c));
+		check_slots(ix, pathvec, "", -1, empty, ARRAY_SIZE(empty));
+		check_slots(ix, pathvec, "d", -1, NULL, 0);
+	}
+	free_wwid_index(idx);
+}
+
+static void test_index_empty(void **state)
+{
+	vector pathvec = vector_alloc();
+	struct wwid_index *idx;
+
+	assert_non_null(pathvec);
+	idx = alloc_wwid_index(pathvec);
+	assert_non_null(idx);
+	assert_int_equal(wwid_index_next(idx, pathvec, "a", -1), -1);
+	free_wwid_index(idx);
+	vector_free(pathvec);
+}
+
+static int test_adopt(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_index_lookup,
+						setup_small,
+						teardown_pathvec),
+		cmocka_unit_test(test_index_empty),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_adopt();
+	return ret;
+}
@@ -173,6 +173,46 @@ client_param(add_path_sda, "add path sda", VRB_ADD|Q1_PATH, "sda");
 client_test(list_list_path_sda, "list list path sda", 0,
 	    VRB_LIST|(VRB_LIST<<8)|(KEY_PATH<<16), false);
 
+static int dummy_stream_handler(void *v, struct strbuf *reply, void *data,
+				struct cli_stream *st)
+{
+	st->done = true;
+	return 0;
+}
+
+/* parse_cli_cmd() must accept handlers that only have a stream_fn */
+static void client_parse_stream(void **state)
+{
+	vector v = NULL;
+	struct handler *h = NULL;
+	char cmd[] = "show paths";
+
+	assert_int_equal(parse_cli_cmd(cmd, &v, &h), -EINVAL);
+	assert_ptr_not_equal(h, NULL);
+	assert_uint_equal(h->fingerprint, VRB_LIST|Q1_PATHS);
+	free_keys(v);
+	v = NULL;
+
+	h->stream_fn = dummy_stream_handler;
+	assert_int_equal(parse_cli_cmd(cmd, &v, &h), 0);
+	assert_ptr_not_equal(h, NULL);
+	assert_ptr_equal(h->fn, NULL);
+	assert_ptr_equal(h->stream_fn, dummy_stream_handler);
+	free_keys(v);
+	h->stream_fn = NULL;
+}
+
+static void client_parse_bogus(void **state)
+{
+	vector v = NULL;
+	struct handler *h = NULL;
+	char cmd[] = "show bogus";
+
+	assert_int_equal(parse_cli_cmd(cmd, &v, &h), -ESRCH);
+	assert_ptr_equal(h, NULL);
+	assert_ptr_equal(v, NULL);
+}
+
 static int client_tests(void)
 {
 	const struct CMUnitTest tests[] = {
@@ -221,6 +261,8 @@ static int client_tests(void)
 		cmocka_unit_test(client_param_list_path_sda),
 		cmocka_unit_test(client_param_add_path_sda),
 		cmocka_unit_test(client_test_list_list_path_sda),
+		cmocka_unit_test(client_parse_stream),
+		cmocka_unit_test(client_parse_bogus),
 	};
 
 	return cmocka_run_group_tests(tests, setup, teardown);
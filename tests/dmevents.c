@@ -154,7 +154,7 @@ struct dm_names *build_dm_names(void)
 		if (old_np)
 			old_np->next = (uint32_t) ((uintptr_t) np -
 						   (uintptr_t) old_np);
-		np->dev = 1;
+		np->dev = makedev(253, i);
 		np->next = 0;
 		strcpy(np->name, dev->name);
 
@@ -610,6 +610,12 @@ static void test_get_events_good1(void **state)
 	assert_ptr_equal(find_dmevents("baz"), NULL);
 	assert_ptr_equal(find_dmevents("qux"), NULL);
 	assert_int_equal(VECTOR_SIZE(waiter->events), 3);
+	/* the minor numbers are the positions in data.dm_devices */
+	assert_true(dmevent_map_unchanged(0, 6));
+	assert_false(dmevent_map_unchanged(0, 5));
+	assert_true(dmevent_map_unchanged(1, 7));
+	assert_false(dmevent_map_unchanged(2, 12));
+	assert_false(dmevent_map_unchanged(3, 4));
 }
 
 /* poll does not return an event. nothing happens. The
@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include "cmocka-compat.h"
+
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "dmparser.h"
+#include "util.h"
+#include "debug.h"
+#include "test-lib.h"
+
+#include "globals.c"
+
+static const char table[] =
+	"2 queue_if_no_path retain_attached_hw_handler 1 alua 2 1 "
+	"service-time 0 2 1 8:0 1 8:16 1 "
+	"service-time 0 2 1 8:32 1 8:48 1";
+
+static const char status[] =
+	"2 0 5 0 2 1 A 0 2 0 8:0 A 0 8:16 F 3 E 0 2 0 8:32 A 0 8:48 A 1";
+
+static int setup_pathvec(void **state)
+{
+	vector pathvec = vector_alloc();
+	int i;
+
+	if (!pathvec)
+		return -1;
+	*state = pathvec;
+	for (i = 0; i < 4; i++)
+		if (!store_test_path(pathvec, i, NULL))
+			return -1;
+	return 0;
+}
+
+static int teardown_pathvec(void **state)
+{
+	free_pathvec(*state, FREE_PATHS);
+	return 0;
+}
+
+/* Like update_pathvec_from_dm() does for paths that are in pathvec */
+static void claim_paths(struct multipath *mpp)
+{
+	struct pathgroup *pgp;
+	struct path *pp;
+	int i, j;
+
+	vector_foreach_slot(mpp->pg, pgp, i)
+		vector_foreach_slot(pgp->paths, pp, j)
+			pp->mpp = mpp;
+}
+
+static void check_map(const struct multipath *mpp, vector pathvec)
+{
+	struct pathgroup *pgp;
+	struct path *pp;
+	int i, j;
+
+	assert_string_equal(mpp->features,
+			    "2 queue_if_no_path retain_attached_hw_handler");
+	assert_string_equal(mpp->hwhandler, "1 alua");
+	assert_string_equal(mpp->selector, "service-time 0");
+	assert_int_equal(mpp->nextpg, 1);
+	assert_int_equal(mpp->minio, 1);
+	assert_int_equal(VECTOR_SIZE(mpp->pg), 2);
+	vector_foreach_slot(mpp->pg, pgp, i) {
+		assert_int_equal(VECTOR_SIZE(pgp->paths), 2);
+		vector_foreach_slot(pgp->paths, pp, j) {
+			assert_ptr_equal(pp, VECTOR_SLOT(pathvec, 2 * i + j));
+			assert_int_equal(pp->pgindex, i + 1);
+		}
+	}
+}
+
+static void test_disassemble_map(void **state)
+{
+	vector pathvec = *state;
+	struct multipath *mpp = alloc_multipath();
+
+	assert_non_null(mpp);
+	assert_int_equal(disassemble_map(pathvec, table, mpp), 0);
+	check_map(mpp, pathvec);
+	free_multipath(mpp);
+}
+
+/* An unchanged table keeps the path groups */
+static void test_map_unchanged(void **state)
+{
+	vector pathvec = *state;
+	struct multipath *mpp = alloc_multipath();
+	struct pathgroup *pgp0;
+	vector pg;
+
+	assert_non_null(mpp);
+	assert_int_equal(disassemble_map(pathvec, table, mpp), 0);
+	claim_paths(mpp);
+	pg = mpp->pg;
+	pgp0 = VECTOR_SLOT(pg, 0);
+	mpp->nextpg = 0;
+	assert_int_equal(disassemble_map(pathvec, table, mpp), 0);
+	assert_ptr_equal(mpp->pg, pg);
+	assert_ptr_equal(VECTOR_SLOT(mpp->pg, 0), pgp0);
+	check_map(mpp, pathvec);
+	free_multipath(mpp);
+}
+
+/* Any difference rebuilds the path groups */
+static void test_map_changed(void **state)
+{
+	static const char swapped[] =
+		"2 queue_if_no_path retain_attached_hw_handler 1 alua 2 1 "
+		"service-time 0 2 1 8:32 1 8:48 1 "
+		"service-time 0 2 1 8:0 1 8:16 1";
+	static const char no_queue[] =
+		"0 1 alua 2 1 "
+		"service-time 0 2 1 8:0 1 8:16 1 "
+		"service-time 0 2 1 8:32 1 8:48 1";
+	vector pathvec = *state;
+	struct multipath *mpp = alloc_multipath();
+	struct path *pp;
+
+	assert_non_null(mpp);
+	assert_int_equal(disassemble_map(pathvec, table, mpp), 0);
+	claim_paths(mpp);
+
+	assert_int_equal(disassemble_map(pathvec, swapped, mpp), 0);
+	assert_int_equal(VECTOR_SIZE(mpp->pg), 2);
+	pp = VECTOR_SLOT(((struct pathgroup *)VECTOR_SLOT(mpp->pg, 0))->paths,
+			 0);
+	assert_ptr_equal(pp, VECTOR_SLOT(pathvec, 2));
+	assert_int_equal(pp->pgindex, 1);
+	pp = VECTOR_SLOT(pathvec, 0);
+	assert_int_equal(pp->pgindex, 2);
+
+	assert_int_equal(disassemble_map(pathvec, no_queue, mpp), 0);
+	assert_string_equal(mpp->features, "0");
+	assert_int_equal(disassemble_map(pathvec, table, mpp), 0);
+	check_map(mpp, pathvec);
+	free_multipath(mpp);
+}
+
+/* Paths that aren't in pathvec are added uninitialized */
+static void test_unknown_path(void **state)
+{
+	static const char tbl[] = "0 0 1 1 round-robin 0 2 1 8:0 1000 65:0 1000";
+	vector pathvec = *state;
+	struct multipath *mpp = alloc_multipath();
+	struct pathgroup *pgp;
+	struct path *pp;
+
+	assert_non_null(mpp);
+	assert_int_equal(disassemble_map(pathvec, tbl, mpp), 0);
+	assert_string_equal(mpp->selector, "round-robin 0");
+	assert_int_equal(mpp->minio, 1000);
+	pgp = VECTOR_SLOT(mpp->pg, 0);
+	assert_ptr_equal(VECTOR_SLOT(pgp->paths, 0), VECTOR_SLOT(pathvec, 0));
+	pp = VECTOR_SLOT(pgp->paths, 1);
+	assert_int_equal(find_slot(pathvec, pp), -1);
+	assert_string_equal(pp->dev_t, "65:0");
+	free_multipath(mpp);
+	free_path(pp);
+}
+
+static void test_bad_map(void **state)
+{
+	static const char * const bad[] = {
+		"",
+		"2 queue_if_no_path",
+		"0 0 2 1 round-robin 0 2 1 8:0 1 8:16",
+		"0 0 1 1 round-robin 0 1 1 8:000000000000000000000000000000000000 1",
+	};
+	vector pathvec = *state;
+	struct multipath *mpp;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(bad); i++) {
+		mpp = alloc_multipath();
+		assert_non_null(mpp);
+		assert_int_equal(disassemble_map(pathvec, bad[i], mpp), 1);
+		assert_null(mpp->pg);
+		free_multipath(mpp);
+	}
+}
+
+static void test_disassemble_status(void **state)
+{
+	vector pathvec = *state;
+	struct multipath *mpp = alloc_multipath();
+	struct pathgroup *pgp;
+	struct path *pp;
+
+	assert_non_null(mpp);
+	assert_int_equal(disassemble_map(pathvec, table, mpp), 0);
+	assert_int_equal(disassemble_status(status, mpp), 0);
+	assert_int_equal(mpp->queuedio, 5);
+	pgp = VECTOR_SLOT(mpp->pg, 0);
+	assert_int_equal(pgp->status, PGSTATE_ACTIVE);
+	pp = VECTOR_SLOT(pgp->paths, 0);
+	assert_int_equal(pp->dmstate, PSTATE_ACTIVE);
+	assert_int_equal(pp->failcount, 0);
+	pp = VECTOR_SLOT(pgp->paths, 1);
+	assert_int_equal(pp->dmstate, PSTATE_FAILED);
+	assert_int_equal(pp->failcount, 3);
+	pgp = VECTOR_SLOT(mpp->pg, 1);
+	assert_int_equal(pgp->status, PGSTATE_ENABLED);
+	pp = VECTOR_SLOT(pgp->paths, 1);
+	assert_int_equal(pp->failcount, 1);
+	free_multipath(mpp);
+}
+
+static int test_dmparser(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_disassemble_map),
+		cmocka_unit_test(test_map_unchanged),
+		cmocka_unit_test(test_map_changed),
+		cmocka_unit_test(test_unknown_path),
+		cmocka_unit_test(test_bad_map),
+		cmocka_unit_test(test_disassemble_status),
+	};
+
+	return cmocka_run_group_tests(tests, setup_pathvec, teardown_pathvec);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_dmparser();
+	return ret;
+}
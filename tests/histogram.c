@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cmocka-compat.h"
+
+#include "histogram.h"
+#include "debug.h"
+
+#include "globals.c"
+
+static void test_empty(void **state)
+{
+	struct lat_hist h;
+
+	memset(&h, 0, sizeof(h));
+	assert_int_equal(lat_hist_count(&h), 0);
+	assert_int_equal(lat_hist_percentile(&h, 50), 0);
+	assert_int_equal(lat_hist_percentile(&h, 99), 0);
+}
+
+static void test_single(void **state)
+{
+	struct lat_hist h;
+
+	memset(&h, 0, sizeof(h));
+	lat_hist_add(&h, 1000);
+	assert_int_equal(lat_hist_count(&h), 1);
+	/* never more than the largest value */
+	assert_int_equal(lat_hist_percentile(&h, 0), 1000);
+	assert_int_equal(lat_hist_percentile(&h, 50), 1000);
+	assert_int_equal(lat_hist_percentile(&h, 100), 1000);
+	assert_int_equal(h.max_us, 1000);
+	assert_int_equal(h.last_us, 1000);
+}
+
+/* The upper bucket limit is at most 25% above the value */
+static void test_resolution(void **state)
+{
+	static const unsigned int values[] = {
+		0, 15, 16, 100, 999, 1000, 4096, 12345, 250000,
+		1000000, 29999999, 60000000,
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		struct lat_hist h;
+		unsigned int p;
+
+		memset(&h, 0, sizeof(h));
+		lat_hist_add(&h, values[i]);
+		/* make sure the bucket limit is reported, not max_us */
+		h.max_us = UINT32_MAX;
+		p = lat_hist_percentile(&h, 50);
+		assert_true(p > values[i]);
+		assert_true(p <= values[i] + 16 ||
+			    p <= values[i] + values[i] / 4);
+	}
+}
+
+static void test_percentiles(void **state)
+{
+	struct lat_hist h;
+	unsigned int i, p50, p99;
+
+	memset(&h, 0, sizeof(h));
+	/* 98 fast checks, 2 slow ones */
+	for (i = 0; i < 98; i++)
+		lat_hist_add(&h, 200);
+	lat_hist_add(&h, 2000000);
+	lat_hist_add(&h, 3000000);
+	assert_int_equal(lat_hist_count(&h), 100);
+
+	p50 = lat_hist_percentile(&h, 50);
+	assert_true(p50 > 200 && p50 <= 250);
+	p99 = lat_hist_percentile(&h, 99);
+	assert_true(p99 > 2000000 && p99 <= 2500000);
+	assert_int_equal(lat_hist_percentile(&h, 100), 3000000);
+	assert_int_equal(h.max_us, 3000000);
+	assert_int_equal(h.last_us, 3000000);
+}
+
+static void test_overflow(void **state)
+{
+	struct lat_hist h;
+	unsigned int i;
+
+	memset(&h, 0, sizeof(h));
+	lat_hist_add(&h, 5000000);
+	lat_hist_add(&h, 5000000);
+	for (i = 0; i <= UINT16_MAX; i++)
+		lat_hist_add(&h, 100);
+	/* counters have been halved once */
+	assert_int_equal(lat_hist_count(&h), UINT16_MAX / 2 + 1 + 1);
+	assert_true(lat_hist_percentile(&h, 50) <= 125);
+	assert_int_equal(lat_hist_percentile(&h, 100), 5000000);
+}
+
+static int test_histogram(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_empty),
+		cmocka_unit_test(test_single),
+		cmocka_unit_test(test_resolution),
+		cmocka_unit_test(test_percentiles),
+		cmocka_unit_test(test_overflow),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_histogram();
+	return ret;
+}
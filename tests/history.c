@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cmocka-compat.h"
+
+#include "history.h"
+#include "structs.h"
+#include "checkers.h"
+#include "strbuf.h"
+#include "debug.h"
+
+#include "globals.c"
+
+static int count_lines(const char *s)
+{
+	int n = 0;
+
+	for (; s && *s; s++)
+		if (*s == '\n')
+			n++;
+	return n;
+}
+
+/* The tests run in order, and see the records of the earlier ones */
+static void test_disabled(void **state)
+{
+	STRBUF_ON_STACK(buf);
+
+	history_map(HIST_PG_SWITCH, "mpatha", 2, NULL);
+	assert_int_equal(print_history(&buf, NULL, NULL), 0);
+}
+
+static void test_events(void **state)
+{
+	STRBUF_ON_STACK(buf);
+	struct multipath mpp = { .alias = "mpatha" };
+	struct path pp = { .dev = "sdb", .mpp = &mpp };
+	const char *s;
+
+	history_enable();
+	history_map(HIST_MAP_RELOAD, "mpatha", 0, "path added");
+	history_path_state(&pp, PATH_UP, PATH_DOWN);
+	history_map(HIST_PG_SWITCH, "mpatha", 2, NULL);
+	history_map(HIST_QUEUEING, "mpathb", 0, NULL);
+	history_map(HIST_MAP_RELOAD, "mpathb", 0, NULL);
+
+	assert_true(print_history(&buf, NULL, NULL) > 0);
+	s = get_strbuf_str(&buf);
+	assert_int_equal(count_lines(s), 5);
+	assert_ptr_not_equal(strstr(s, " mpatha: reload (path added)\n"), NULL);
+	assert_ptr_not_equal(strstr(s, " mpatha sdb: up -> down\n"), NULL);
+	assert_ptr_not_equal(strstr(s, " mpatha: switch to path group 2\n"),
+			     NULL);
+	assert_ptr_not_equal(strstr(s, " mpathb: queueing disabled\n"), NULL);
+	assert_ptr_not_equal(strstr(s, " mpathb: reload (unknown reason)\n"),
+			     NULL);
+	/* oldest first */
+	assert_true(strstr(s, "reload (path added)") < strstr(s, "up -> down"));
+}
+
+static void test_filter(void **state)
+{
+	STRBUF_ON_STACK(buf);
+
+	assert_true(print_history(&buf, "mpatha", NULL) > 0);
+	assert_int_equal(count_lines(get_strbuf_str(&buf)), 3);
+	truncate_strbuf(&buf, 0);
+	assert_true(print_history(&buf, NULL, "sdb") > 0);
+	assert_int_equal(count_lines(get_strbuf_str(&buf)), 1);
+	truncate_strbuf(&buf, 0);
+	assert_int_equal(print_history(&buf, "mpathc", NULL), 0);
+}
+
+/* Old records are overwritten */
+static void test_wrap(void **state)
+{
+	STRBUF_ON_STACK(buf);
+	int i;
+
+	for (i = 0; i < 5000; i++)
+		history_map(HIST_PG_SWITCH, "mpathc", i, NULL);
+	assert_true(print_history(&buf, NULL, NULL) > 0);
+	assert_int_equal(count_lines(get_strbuf_str(&buf)), 2048);
+	assert_ptr_equal(strstr(get_strbuf_str(&buf), "mpatha"), NULL);
+	assert_ptr_not_equal(strstr(get_strbuf_str(&buf),
+				    "switch to path group 4999\n"), NULL);
+}
+
+static int test_history(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_disabled),
+		cmocka_unit_test(test_events),
+		cmocka_unit_test(test_filter),
+		cmocka_unit_test(test_wrap),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_history();
+	return ret;
+}
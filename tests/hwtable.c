@@ -22,6 +22,7 @@
 #include "debug.h"
 #include "defaults.h"
 #include "pgpolicies.h"
+#include "propsel.h"
 #include "test-lib.h"
 #include "print.h"
 #include "util.h"
@@ -397,6 +398,7 @@ static const char _vpd_vnd[] = "vpd_vendor";
 static const char _uid_attr[] = "uid_attribute";
 static const char _bl_product[] = "product_blacklist";
 static const char _no_path_retry[] = "no_path_retry";
+static const char _pgpolicy[] = "path_grouping_policy";
 
 /* Device identifiers */
 static const struct key_value vnd_foo = { _vendor, "foo" };
@@ -432,6 +434,8 @@ static const struct key_value bl_barx = { _bl_product, "ba[[rxy]" };
 static const struct key_value bl_bazy = { _bl_product, "ba[zy]" };
 static const struct key_value npr_37 = { _no_path_retry, "37" };
 static const struct key_value npr_queue = { _no_path_retry, "queue" };
+static const struct key_value pgp_failover = { _pgpolicy, "failover" };
+static const struct key_value pgp_multibus = { _pgpolicy, "multibus" };
 
 /***** BEGIN TESTS SECTION *****/
 
@@ -1581,6 +1585,59 @@ static int setup_multipath_config(void **state)
 	return 0;
 }
 
+/*
+ * Maps with the same hwtable entries and multipaths entry share a
+ * propsel profile.
+ *
+ * Expected: the maps without multipaths entry share a profile, the map
+ * with a multipaths entry gets its own.
+ */
+static void test_propsel_profile(const struct hwt_state *hwt)
+{
+	struct path *pp;
+	struct multipath *mp, *mp1, *mp2;
+	const struct propsel_profile *prof;
+	struct config *conf;
+
+	pp = mock_path(vnd_foo.value, prd_bar.value);
+	mp = mock_multipath(pp);
+	assert_ptr_not_equal(mp->mpe, NULL);
+	assert_int_equal(mp->pgpolicy, FAILOVER);
+
+	pp = mock_path_wwid(vnd_foo.value, prd_bar.value, default_wwid_1);
+	mp1 = mock_multipath(pp);
+	assert_int_equal(mp1->pgpolicy, MULTIBUS);
+
+	pp = mock_path_wwid(vnd_foo.value, prd_bar.value, "TEST-WWID-2");
+	mp2 = mock_multipath(pp);
+	assert_int_equal(mp2->pgpolicy, MULTIBUS);
+
+	conf = get_multipath_config();
+	prof = get_propsel_profile(conf, mp1->mpe, mp1->hwe);
+	assert_ptr_not_equal(prof, NULL);
+	assert_ptr_equal(get_propsel_profile(conf, mp2->mpe, mp2->hwe), prof);
+	assert_ptr_not_equal(get_propsel_profile(conf, mp->mpe, mp->hwe), prof);
+	put_multipath_config(conf);
+}
+
+static int setup_propsel_profile(void **state)
+{
+	struct hwt_state *hwt = CHECK_STATE(state);
+	const struct key_value kvm[] = { wwid_test, pgp_failover };
+	const struct key_value kvp[] = { vnd_foo, prd_bar, pgp_multibus };
+
+	begin_config(hwt);
+	begin_section_all(hwt, "devices");
+	write_section(hwt->conf_dir_file[0], "device", ARRAY_SIZE(kvp), kvp);
+	end_section_all(hwt);
+	begin_section_all(hwt, "multipaths");
+	write_section(hwt->config_file, "multipath", ARRAY_SIZE(kvm), kvm);
+	end_section_all(hwt);
+	finish_config(hwt);
+	SET_TEST_FUNC(hwt, test_propsel_profile);
+	return 0;
+}
+
 /*
  * Basic test for multipath-based configuration. Two sections for the same wwid.
  *
@@ -1708,6 +1765,7 @@ define_test(blacklist_regex_matching)
 define_test(product_blacklist)
 define_test(product_blacklist_matching)
 define_test(multipath_config)
+define_test(propsel_profile)
 define_test(multipath_config_2)
 define_test(multipath_config_3)
 define_test(hidden)
@@ -1748,6 +1806,7 @@ static int test_hwtable(void)
 		test_entry(product_blacklist),
 		test_entry(product_blacklist_matching),
 		test_entry(multipath_config),
+		test_entry(propsel_profile),
 		test_entry(multipath_config_2),
 		test_entry(multipath_config_3),
 		test_entry(hidden),
@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "cmocka-compat.h"
+
+#include "mempool.h"
+#include "strbuf.h"
+#include "debug.h"
+
+#include "globals.c"
+
+struct obj {
+	char data[100];
+};
+
+struct aligned_obj {
+	char data[100];
+} __attribute__((aligned(64)));
+
+static void test_reuse(void **state)
+{
+	static struct mempool pool = MEMPOOL_INIT("test-reuse", struct obj, 1024);
+	struct obj *a, *b, *c;
+	unsigned int i;
+
+	a = mempool_alloc(&pool);
+	assert_non_null(a);
+	assert_int_equal(pool.stats.slabs, 1);
+	assert_true(pool.slab_objs >= MEMPOOL_MIN_SLAB_OBJS);
+	assert_int_equal(pool.stats.cached, pool.slab_objs - 1);
+	memset(a, 'x', sizeof(*a));
+	mempool_free(&pool, a);
+	assert_int_equal(pool.stats.cached, pool.slab_objs);
+	assert_int_equal(pool.stats.in_use, 0);
+
+	/* the freed object is handed out again, zeroed */
+	b = mempool_alloc(&pool);
+	assert_ptr_equal(b, a);
+	for (i = 0; i < sizeof(b->data); i++)
+		assert_int_equal(b->data[i], 0);
+
+	/* objects of a slab are adjacent, and don't overlap */
+	c = mempool_alloc(&pool);
+	assert_non_null(c);
+	assert_true((char *)c >= (char *)b + sizeof(*b));
+	assert_true((char *)c - (char *)b < 2 * (long)pool.slot_size);
+	assert_int_equal((size_t)c % __alignof__(max_align_t), 0);
+	assert_int_equal(pool.stats.in_use, 2);
+	assert_int_equal(pool.stats.peak, 2);
+	assert_int_equal(pool.stats.allocs, 3);
+	assert_int_equal(pool.stats.slabs, 1);
+
+	mempool_free(&pool, b);
+	mempool_free(&pool, c);
+	mempool_free(&pool, NULL);
+	assert_int_equal(pool.stats.in_use, 0);
+	assert_int_equal(pool.stats.slabs, 1);
+	assert_int_equal(pool.stats.released, 0);
+}
+
+static void test_slabs(void **state)
+{
+	/* don't keep empty slabs */
+	static struct mempool pool = MEMPOOL_INIT("test-slabs", struct obj, 0);
+	struct obj **objs;
+	unsigned int i, n;
+
+	mempool_free(&pool, mempool_alloc(&pool));
+	assert_int_equal(pool.stats.slabs, 0);
+	assert_int_equal(pool.stats.released, 1);
+
+	n = pool.slab_objs + 1;
+	objs = calloc(n, sizeof(*objs));
+	assert_non_null(objs);
+	for (i = 0; i < n; i++)
+		assert_non_null(objs[i] = mempool_alloc(&pool));
+	assert_int_equal(pool.stats.slabs, 2);
+	assert_int_equal(pool.stats.cached, pool.slab_objs - 1);
+
+	/* a slab with an object in use is kept */
+	for (i = 1; i < n; i++)
+		mempool_free(&pool, objs[i]);
+	assert_int_equal(pool.stats.slabs, 1);
+	assert_int_equal(pool.stats.released, 2);
+	assert_int_equal(pool.stats.cached, pool.slab_objs - 1);
+
+	mempool_free(&pool, objs[0]);
+	assert_int_equal(pool.stats.slabs, 0);
+	assert_int_equal(pool.stats.released, 3);
+	assert_int_equal(pool.stats.cached, 0);
+	assert_int_equal(pool.stats.in_use, 0);
+	free(objs);
+}
+
+static void test_align(void **state)
+{
+	static struct mempool pool =
+		MEMPOOL_INIT("test-align", struct aligned_obj, 1024);
+	struct aligned_obj *objs[8];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		assert_non_null(objs[i] = mempool_alloc(&pool));
+		assert_int_equal((size_t)objs[i] % 64, 0);
+	}
+	for (i = 0; i < 8; i++)
+		mempool_free(&pool, objs[i]);
+}
+
+static void test_release_idle(void **state)
+{
+	static struct mempool pool = MEMPOOL_INIT("test-idle", struct obj, 1024);
+	struct obj *objs[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		assert_non_null(objs[i] = mempool_alloc(&pool));
+	for (i = 0; i < 8; i++)
+		mempool_free(&pool, objs[i]);
+	assert_int_equal(pool.stats.slabs, 1);
+	assert_int_equal(pool.stats.cached, pool.slab_objs);
+
+	/* not idle for long enough */
+	mempool_release_idle(3600);
+	assert_int_equal(pool.stats.slabs, 1);
+
+	assert_true(mempool_release_idle(0));
+	assert_int_equal(pool.stats.slabs, 0);
+	assert_int_equal(pool.stats.cached, 0);
+	assert_int_equal(pool.stats.released, 1);
+	assert_false(mempool_release_idle(0));
+}
+
+static void test_print_stats(void **state)
+{
+	static struct mempool pool = MEMPOOL_INIT("test-print", struct obj, 1024);
+	STRBUF_ON_STACK(buf);
+	char expected[128];
+
+	mempool_free(&pool, mempool_alloc(&pool));
+	assert_true(print_mempool_stats(&buf) > 0);
+	snprintf(expected, sizeof(expected),
+		 "pool test-print: 0 in use, 1 peak, %u cached, 1 slabs, 1 allocs, 0 slabs released\n",
+		 pool.slab_objs);
+	assert_non_null(strstr(get_strbuf_str(&buf), expected));
+}
+
+static int test_mempool(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_reuse),
+		cmocka_unit_test(test_slabs),
+		cmocka_unit_test(test_align),
+		cmocka_unit_test(test_release_idle),
+		cmocka_unit_test(test_print_stats),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_mempool();
+	return ret;
+}
@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cmocka-compat.h"
+
+#include "metrics.h"
+#include "strbuf.h"
+#include "debug.h"
+
+#include "globals.c"
+
+static int reset(void **state)
+{
+	reset_metrics();
+	return 0;
+}
+
+static char *get_metrics(void)
+{
+	STRBUF_ON_STACK(buf);
+
+	assert_true(print_metrics(&buf) > 0);
+	return steal_strbuf_str(&buf);
+}
+
+static void assert_has_line(const char *text, const char *line)
+{
+	size_t len = strlen(line);
+	const char *p;
+
+	for (p = text; (p = strstr(p, line)) != NULL; p += len) {
+		if ((p == text || p[-1] == '\n') && p[len] == '\n')
+			return;
+	}
+	print_message("missing line: %s\n", line);
+	fail();
+}
+
+static void test_empty(void **state)
+{
+	char *text = get_metrics();
+	size_t len = strlen(text);
+
+	assert_has_line(text, "# TYPE multipathd_dm_reloads counter");
+	assert_has_line(text, "multipathd_dm_reloads_total 0");
+	assert_has_line(text, "multipathd_maps 0");
+	assert_has_line(text, "multipathd_tick_duration_seconds_count 0");
+	/* no time series for labelled metrics yet */
+	assert_null(strstr(text, "multipathd_checker_timeouts_total"));
+	assert_true(len > 6);
+	assert_string_equal(text + len - 6, "# EOF\n");
+	free(text);
+}
+
+static void test_counter(void **state)
+{
+	char *text;
+
+	metric_inc(MP_METRIC_DM_RELOADS, NULL);
+	metric_add(MP_METRIC_DM_RELOADS, NULL, 2);
+	metric_inc(MP_METRIC_CHECKER_TIMEOUTS, "tur");
+	metric_inc(MP_METRIC_CHECKER_TIMEOUTS, "tur");
+	metric_inc(MP_METRIC_CHECKER_TIMEOUTS, "directio");
+	/* wrong type is ignored */
+	metric_inc(MP_METRIC_MAPS, NULL);
+
+	text = get_metrics();
+	assert_has_line(text, "multipathd_dm_reloads_total 3");
+	assert_has_line(text,
+			"multipathd_checker_timeouts_total{checker=\"tur\"} 2");
+	assert_has_line(text,
+			"multipathd_checker_timeouts_total{checker=\"directio\"} 1");
+	assert_has_line(text, "multipathd_maps 0");
+	free(text);
+}
+
+static void test_gauge(void **state)
+{
+	char *text;
+
+	metric_set(MP_METRIC_MAPS, NULL, 5);
+	metric_set(MP_METRIC_MAPS, NULL, 4);
+	metric_set(MP_METRIC_PATHS, "up", 8);
+
+	text = get_metrics();
+	assert_has_line(text, "# TYPE multipathd_maps gauge");
+	assert_has_line(text, "multipathd_maps 4");
+	assert_has_line(text, "multipathd_paths{state=\"up\"} 8");
+	free(text);
+}
+
+static void test_histogram(void **state)
+{
+	struct timespec d1 = { .tv_nsec = 2000000 };
+	struct timespec d2 = { .tv_sec = 40 };
+	char *text;
+
+	metric_observe(MP_METRIC_CHECKER_DURATION, "tur", &d1);
+	metric_observe(MP_METRIC_CHECKER_DURATION, "tur", &d2);
+	metric_observe(MP_METRIC_TICK_DURATION, NULL, &d1);
+
+	text = get_metrics();
+	assert_has_line(text,
+			"# TYPE multipathd_checker_duration_seconds histogram");
+	assert_has_line(text, "multipathd_checker_duration_seconds_bucket{checker=\"tur\",le=\"0.001000\"} 0");
+	assert_has_line(text, "multipathd_checker_duration_seconds_bucket{checker=\"tur\",le=\"0.005000\"} 1");
+	assert_has_line(text, "multipathd_checker_duration_seconds_bucket{checker=\"tur\",le=\"30.000000\"} 1");
+	assert_has_line(text, "multipathd_checker_duration_seconds_bucket{checker=\"tur\",le=\"+Inf\"} 2");
+	assert_has_line(text, "multipathd_checker_duration_seconds_count{checker=\"tur\"} 2");
+	assert_has_line(text, "multipathd_checker_duration_seconds_sum{checker=\"tur\"} 40.002000");
+	assert_has_line(text, "multipathd_tick_duration_seconds_bucket{le=\"0.010000\"} 1");
+	assert_has_line(text, "multipathd_tick_duration_seconds_count 1");
+	assert_has_line(text, "multipathd_tick_duration_seconds_sum 0.002000");
+	free(text);
+}
+
+static int test_metrics(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup(test_empty, reset),
+		cmocka_unit_test_setup(test_counter, reset),
+		cmocka_unit_test_setup(test_gauge, reset),
+		cmocka_unit_test_setup(test_histogram, reset),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, reset);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_metrics();
+	return ret;
+}
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include "cmocka-compat.h"
+
+#include "structs.h"
+#include "debug.h"
+
+#include "globals.c"
+
+/*
+ * struct path is cache line aligned, and the checker state must stay
+ * within its first two cache lines. See the comment in structs.h.
+ */
+static void test_hot_layout(void **state)
+{
+	assert_int_equal(__alignof__(struct path), 64);
+	assert_int_equal(offsetof(struct path, is_checked), 0);
+	assert_true(offsetof(struct path, tick) < 64);
+	assert_true(offsetof(struct path, checkint) < 64);
+	assert_true(offsetof(struct path, initialized) < 64);
+	assert_true(offsetof(struct path, mpp) < 64);
+	assert_true(offsetof(struct path, add_when_online) < 64);
+	assert_true(offsetof(struct path, checker) + sizeof(struct checker)
+		    <= 128);
+}
+
+/* The alignment holds for allocated paths, too */
+static void test_alloc_aligned(void **state)
+{
+	struct path *pp[3];
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		pp[i] = alloc_path();
+		assert_non_null(pp[i]);
+		assert_int_equal((unsigned long)pp[i] % 64, 0);
+	}
+	for (i = 0; i < 3; i++)
+		free_path(pp[i]);
+}
+
+static int test_pathvec(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_hot_layout),
+		cmocka_unit_test(test_alloc_aligned),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_pathvec();
+	return ret;
+}
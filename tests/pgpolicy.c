@@ -13,6 +13,7 @@
 #include <stdio.h>
 
 #include "globals.c"
+#include "strpool.h"
 #include "pgpolicies.h"
 
 struct multipath mp8, mp4, mp1, mp0, mp_null;
@@ -51,7 +52,7 @@ static void set_tgt_node_name(struct path *pp, char **tgt_node_name, int size)
 	int i;
 
 	for (i = 0; i < size; i++) {
-		strcpy(pp[i].tgt_node_name, tgt_node_name[i]);
+		set_interned_str(&pp[i].tgt_node_name, tgt_node_name[i]);
 	}
 }
 
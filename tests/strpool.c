@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cmocka-compat.h"
+
+#include "strpool.h"
+#include "debug.h"
+
+#include "globals.c"
+
+static void test_intern_equal(void **state)
+{
+	char buf[16] = "HITACHI";
+	const char *a, *b, *c;
+
+	a = get_interned_str("HITACHI");
+	b = get_interned_str(buf);
+	c = get_interned_str("OPEN-V");
+	assert_string_equal(a, "HITACHI");
+	assert_ptr_not_equal(a, buf);
+	assert_ptr_equal(a, b);
+	assert_ptr_not_equal(a, c);
+
+	/* the copy must survive until the last reference is dropped */
+	put_interned_str(a);
+	assert_string_equal(b, "HITACHI");
+	put_interned_str(b);
+	put_interned_str(c);
+}
+
+static void test_intern_empty(void **state)
+{
+	const char *e = get_interned_str(NULL);
+
+	assert_string_equal(e, "");
+	assert_ptr_equal(e, get_interned_str(""));
+	put_interned_str(e);
+	put_interned_str(NULL);
+	/* strings that weren't interned are ignored */
+	put_interned_str("foo");
+}
+
+static void test_set_interned(void **state)
+{
+	const char *field = get_interned_str(NULL);
+	const char *other;
+
+	set_interned_str(&field, "a");
+	assert_string_equal(field, "a");
+	other = get_interned_str("a");
+	assert_ptr_equal(field, other);
+	set_interned_str(&field, "b");
+	assert_string_equal(field, "b");
+	assert_string_equal(other, "a");
+	/* setting the same value again */
+	set_interned_str(&field, field);
+	assert_string_equal(field, "b");
+	put_interned_str(field);
+	put_interned_str(other);
+}
+
+static int test_strpool(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_intern_equal),
+		cmocka_unit_test(test_intern_empty),
+		cmocka_unit_test(test_set_interned),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_strpool();
+	return ret;
+}
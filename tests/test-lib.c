@@ -119,6 +119,14 @@ const char *__wrap_udev_device_get_sysname(struct udev_device *ud)
 	return val;
 }
 
+const char *__wrap_udev_device_get_syspath(struct udev_device *ud)
+{
+	const char *val = mock_ptr_type(const char *);
+
+	condlog(5, "%s: %s", __func__, val);
+	return val;
+}
+
 const char *__wrap_udev_device_get_devnode(struct udev_device *ud)
 {
 	const char *val = mock_ptr_type(const char *);
@@ -336,6 +344,7 @@ void mock_pathinfo(int mask, const struct mocked_path *mp)
 	/* path_sysfs_state */
 	will_return(__wrap_udev_device_get_subsystem, "scsi");
 	will_return(__wrap_sysfs_attr_get_value, "running");
+	will_return(__wrap_udev_device_get_syspath, "/sys/class/scsi_device/4:0:3:1/device");
 
 	if (mask & DI_NOIO)
 		return;
@@ -409,12 +418,33 @@ struct multipath *mock_multipath__(struct vectors *vecs, struct path *pp)
 
 	/* TBD: mock setup_map() ... */
 	conf = get_multipath_config();
+	mp->profile = get_propsel_profile(conf, mp->mpe, mp->hwe);
 	select_pgpolicy(conf, mp);
 	select_no_path_retry(conf, mp);
 	will_return(__wrap_libmp_get_version, fake_dm_tgt_version);
 	select_retain_hwhandler(conf, mp);
 	select_minio(conf, mp);
+	mp->profile = NULL;
 	put_multipath_config(conf);
 
 	return mp;
 }
+
+struct path *store_test_path(vector pathvec, int i, const char *wwid)
+{
+	struct path *pp = alloc_path();
+
+	if (!pp)
+		return NULL;
+	snprintf(pp->dev, sizeof(pp->dev), "sd%d", i);
+	snprintf(pp->dev_t, sizeof(pp->dev_t), "%d:%d",
+		 8 + i / 16, (i % 16) * 16);
+	if (wwid)
+		strlcpy(pp->wwid, wwid, sizeof(pp->wwid));
+	pp->initialized = INIT_OK;
+	if (store_path(pathvec, pp)) {
+		free_path(pp);
+		return NULL;
+	}
+	return pp;
+}
@@ -65,4 +65,11 @@ struct path *mock_path__(vector pathvec,
 struct multipath *mock_multipath__(struct vectors *vecs, struct path *pp);
 #define mock_multipath(pp) mock_multipath__(hwt->vecs, (pp))
 
+/*
+ * Store an initialized path with device "sd<i>" and dev_t
+ * "<8 + i / 16>:<16 * (i % 16)>" in @pathvec, without calling pathinfo().
+ * @wwid may be NULL.
+ */
+struct path *store_test_path(vector pathvec, int i, const char *wwid);
+
 #endif
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cmocka-compat.h"
+
+#include "timing.h"
+#include "time-util.h"
+#include "strbuf.h"
+#include "debug.h"
+
+#include "globals.c"
+
+static void test_timespec_us(void **state)
+{
+	struct timespec ts = { .tv_sec = 2, .tv_nsec = 345678 };
+
+	assert_int_equal(timespec_us(&ts), 2000345);
+	ts.tv_sec = -1;
+	assert_int_equal(timespec_us(&ts), 0);
+}
+
+static void test_sum(void **state)
+{
+	struct timing_stats ts;
+	struct timing_slot sum;
+
+	memset(&ts, 0, sizeof(ts));
+	timing_sum(&ts, 15, &sum);
+	assert_int_equal(sum.count, 0);
+
+	timing_add(&ts, 100);
+	timing_add(&ts, 3000);
+	timing_add(&ts, 200);
+	timing_sum(&ts, 1, &sum);
+	assert_int_equal(sum.count, 3);
+	assert_int_equal(sum.total_us, 3300);
+	assert_int_equal(sum.max_us, 3000);
+}
+
+/* idx may be small shortly after boot */
+static struct timing_slot *slot_of(struct timing_stats *ts, time_t idx)
+{
+	return &ts->slot[(idx % TIMING_SLOTS + TIMING_SLOTS) % TIMING_SLOTS];
+}
+
+/* Slots from earlier minutes count only for the larger windows */
+static void test_windows(void **state)
+{
+	struct timing_stats ts;
+	struct timing_slot sum;
+	struct timespec now;
+	time_t idx;
+
+	memset(&ts, 0, sizeof(ts));
+	get_monotonic_time(&now);
+	idx = now.tv_sec / TIMING_SLOT_SECS;
+	*slot_of(&ts, idx - 3) = (struct timing_slot)
+		{ .idx = idx - 3, .count = 2, .max_us = 5000, .total_us = 6000 };
+	/* too old, but occupies a slot of the current rotation */
+	*slot_of(&ts, idx - 20) = (struct timing_slot)
+		{ .idx = idx - 20, .count = 7, .max_us = 1, .total_us = 7 };
+	timing_add(&ts, 10);
+
+	timing_sum(&ts, 1, &sum);
+	assert_int_equal(sum.count, 1);
+	assert_int_equal(sum.max_us, 10);
+	timing_sum(&ts, 5, &sum);
+	assert_int_equal(sum.count, 3);
+	assert_int_equal(sum.total_us, 6010);
+	assert_int_equal(sum.max_us, 5000);
+	timing_sum(&ts, 15, &sum);
+	assert_int_equal(sum.count, 3);
+}
+
+static void test_print(void **state)
+{
+	STRBUF_ON_STACK(buf);
+	struct timing_stats ts;
+
+	memset(&ts, 0, sizeof(ts));
+	timing_add(&ts, 1500);
+	timing_add(&ts, 2500);
+	assert_true(print_timing_header(&buf, "phase") > 0);
+	assert_true(print_timing(&buf, "check", &ts) > 0);
+	assert_ptr_not_equal(strstr(get_strbuf_str(&buf),
+				    "check                            2     2.000     2.500"),
+			     NULL);
+}
+
+static int test_timing(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_timespec_us),
+		cmocka_unit_test(test_sum),
+		cmocka_unit_test(test_windows),
+		cmocka_unit_test(test_print),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_timing();
+	return ret;
+}
@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "cmocka-compat.h"
+
+#include "vector.h"
+#include "debug.h"
+
+#include "globals.c"
+
+#define INT_PTR(x) ((void *)(uintptr_t)(x))
+#define PTR_INT(p) ((int)(uintptr_t)(p))
+
+static vector make_vector(int n)
+{
+	vector v = vector_alloc();
+	int i;
+
+	assert_non_null(v);
+	for (i = 0; i < n; i++) {
+		assert_true(vector_alloc_slot(v));
+		vector_set_slot(v, INT_PTR(i + 1));
+	}
+	return v;
+}
+
+static void test_alloc_slot(void **state)
+{
+	vector v = vector_alloc();
+	int i;
+
+	assert_non_null(v);
+	assert_int_equal(v->capacity, 0);
+	for (i = 0; i < 100; i++) {
+		assert_true(vector_alloc_slot(v));
+		assert_null(VECTOR_LAST_SLOT(v));
+		vector_set_slot(v, INT_PTR(i + 1));
+		assert_int_equal(VECTOR_SIZE(v), i + 1);
+		assert_true(v->capacity >= VECTOR_SIZE(v));
+		/* geometric growth: less than twice the size */
+		assert_true(v->capacity <= 2 * VECTOR_SIZE(v) ||
+			    v->capacity == 4);
+	}
+	for (i = 0; i < 100; i++)
+		assert_int_equal(PTR_INT(VECTOR_SLOT(v, i)), i + 1);
+	vector_free(v);
+}
+
+static void test_reserve(void **state)
+{
+	vector v = vector_alloc();
+	void **slot;
+	int i;
+
+	assert_non_null(v);
+	assert_false(vector_reserve(NULL, 10));
+	assert_false(vector_reserve(v, -1));
+	assert_true(vector_reserve(v, 0));
+	assert_true(vector_reserve(v, 1000));
+	assert_int_equal(VECTOR_SIZE(v), 0);
+	assert_int_equal(v->capacity, 1000);
+	slot = v->slot;
+	for (i = 0; i < 1000; i++) {
+		assert_true(vector_alloc_slot(v));
+		vector_set_slot(v, INT_PTR(i + 1));
+	}
+	/* no reallocation */
+	assert_ptr_equal(v->slot, slot);
+	assert_int_equal(v->capacity, 1000);
+	/* never shrinks */
+	assert_true(vector_reserve(v, 10));
+	assert_int_equal(v->capacity, 1000);
+	vector_free(v);
+}
+
+static void test_append(void **state)
+{
+	vector v = make_vector(3);
+	vector w = make_vector(1000);
+	vector empty = vector_alloc();
+	int i;
+
+	assert_non_null(empty);
+	assert_false(vector_append(NULL, w));
+	assert_true(vector_append(v, NULL));
+	assert_true(vector_append(v, empty));
+	assert_int_equal(VECTOR_SIZE(v), 3);
+
+	assert_true(vector_append(v, w));
+	assert_int_equal(VECTOR_SIZE(v), 1003);
+	assert_true(v->capacity >= 1003);
+	for (i = 0; i < 3; i++)
+		assert_int_equal(PTR_INT(VECTOR_SLOT(v, i)), i + 1);
+	for (i = 0; i < 1000; i++)
+		assert_int_equal(PTR_INT(VECTOR_SLOT(v, i + 3)), i + 1);
+	/* src is unchanged */
+	assert_int_equal(VECTOR_SIZE(w), 1000);
+
+	assert_true(vector_append(empty, w));
+	assert_int_equal(VECTOR_SIZE(empty), 1000);
+
+	vector_free(empty);
+	vector_free(w);
+	vector_free(v);
+}
+
+static void test_del_slot(void **state)
+{
+	vector v = make_vector(1000);
+	int i;
+
+	vector_del_slot(v, -1);
+	vector_del_slot(v, 1000);
+	assert_int_equal(VECTOR_SIZE(v), 1000);
+
+	/* delete all odd elements, order is kept */
+	for (i = 0; i < VECTOR_SIZE(v); i++)
+		vector_del_slot(v, i);
+	assert_int_equal(VECTOR_SIZE(v), 500);
+	for (i = 0; i < 500; i++)
+		assert_int_equal(PTR_INT(VECTOR_SLOT(v, i)), 2 * i + 2);
+
+	while (VECTOR_SIZE(v) > 10)
+		vector_del_slot(v, 0);
+	/* memory has been given back */
+	assert_true(v->capacity < 100);
+	assert_int_equal(PTR_INT(VECTOR_SLOT(v, 0)), 982);
+
+	while (VECTOR_SIZE(v) > 0)
+		vector_del_slot(v, 0);
+	assert_null(v->slot);
+	assert_int_equal(v->capacity, 0);
+	vector_free(v);
+}
+
+static void test_convert(void **state)
+{
+	vector v = make_vector(100);
+	vector w;
+	int i;
+
+	w = vector_convert(NULL, v, void, identity);
+	assert_non_null(w);
+	assert_int_equal(VECTOR_SIZE(w), 100);
+	assert_int_equal(w->capacity, 100);
+	for (i = 0; i < 100; i++)
+		assert_ptr_equal(VECTOR_SLOT(w, i), VECTOR_SLOT(v, i));
+	vector_free(w);
+	vector_free(v);
+}
+
+static int test_vector(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_alloc_slot),
+		cmocka_unit_test(test_reserve),
+		cmocka_unit_test(test_append),
+		cmocka_unit_test(test_del_slot),
+		cmocka_unit_test(test_convert),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_vector();
+	return ret;
+}